@@ -0,0 +1,300 @@
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <random>
+
+#include "AllocationCounter.h"
+#include "Audio2Image.h"
+#include "AudioVisualFilters.h"
+#include "SpectralKernels.h"
+#include "common.h"
+
+/* Microbenchmarks of the conversion stages and end-to-end throughput on a
+ * generated corpus, written as JSON:
+ *
+ *   Audiovisual_bench [results.json] [corpus directory]
+ *
+ * Allocation counts need a build with AUDIOVISUAL_COUNT_ALLOCATIONS=ON,
+ * otherwise they read 0 and "allocation_counter" is false. */
+
+static constexpr double MIN_BENCH_SECONDS = 0.5;
+static constexpr int MIN_BENCH_ITERATIONS = 3;
+static constexpr double CORPUS_DURATION_SEC = 10.0;
+
+struct BenchResult {
+  std::string name;
+  int64_t iterations;
+  double seconds;
+  double items_per_iteration;  // samples, segments or pixels
+  const char* item_unit;
+  uint64_t allocations;
+};
+
+/* Runs op in doubling batches until MIN_BENCH_SECONDS have passed */
+template <typename Op>
+static BenchResult run_bench(std::string name, double items_per_iteration,
+                             const char* item_unit, Op op) {
+  op();  // warm up caches, plans and pools
+
+  int64_t iterations = 0;
+  int64_t batch = 1;
+  double seconds = 0.0;
+  const uint64_t start_allocations = allocation_count();
+  while (seconds < MIN_BENCH_SECONDS || iterations < MIN_BENCH_ITERATIONS) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < batch; ++i) {
+      op();
+    }
+    seconds += std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    iterations += batch;
+    batch *= 2;
+  }
+
+  return {std::move(name), iterations, seconds, items_per_iteration, item_unit,
+          allocation_count() - start_allocations};
+}
+
+/*==========================================
+=              SYNTHETIC CORPUS            =
+==========================================*/
+
+enum class SIGNAL_T { SINE, CHIRP, NOISE };
+
+static const char* signal_name(SIGNAL_T signal) {
+  switch (signal) {
+    case SIGNAL_T::SINE:
+      return "sine";
+    case SIGNAL_T::CHIRP:
+      return "chirp";
+    default:
+      return "noise";
+  }
+}
+
+/* 1 kHz sine, 20 Hz to 20 kHz exponential chirp or white noise, -6 dBFS */
+static std::vector<float> generate_signal(SIGNAL_T signal,
+                                          int sample_rate_hz) {
+  const int64_t num_samples =
+      std::llround(CORPUS_DURATION_SEC * sample_rate_hz);
+  std::vector<float> samples(num_samples);
+  std::mt19937 generator(1234);
+  std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+
+  const double chirp_rate = std::log(20000.0 / 20.0) / CORPUS_DURATION_SEC;
+  for (int64_t n = 0; n < num_samples; ++n) {
+    const double t = static_cast<double>(n) / sample_rate_hz;
+    switch (signal) {
+      case SIGNAL_T::SINE:
+        samples[n] = 0.5f * static_cast<float>(std::sin(2 * M_PI * 1000 * t));
+        break;
+      case SIGNAL_T::CHIRP:
+        samples[n] = 0.5f * static_cast<float>(std::sin(
+                                2 * M_PI * 20 * (std::exp(chirp_rate * t) - 1) /
+                                chirp_rate));
+        break;
+      default:
+        samples[n] = noise(generator);
+    }
+  }
+  return samples;
+}
+
+/* Mono 16-bit PCM WAV */
+static bool write_wav(const std::string& filename,
+                      const std::vector<float>& samples, int sample_rate_hz) {
+  std::ofstream file(filename, std::ios::binary);
+  auto write_u32 = [&](uint32_t value) {
+    file.write(reinterpret_cast<const char*>(&value), 4);
+  };
+  auto write_u16 = [&](uint16_t value) {
+    file.write(reinterpret_cast<const char*>(&value), 2);
+  };
+
+  const uint32_t data_bytes = static_cast<uint32_t>(samples.size() * 2);
+  file.write("RIFF", 4);
+  write_u32(36 + data_bytes);
+  file.write("WAVEfmt ", 8);
+  write_u32(16);
+  write_u16(1);  // PCM
+  write_u16(1);  // mono
+  write_u32(sample_rate_hz);
+  write_u32(sample_rate_hz * 2);
+  write_u16(2);
+  write_u16(16);
+  file.write("data", 4);
+  write_u32(data_bytes);
+  for (float sample : samples) {
+    write_u16(static_cast<uint16_t>(static_cast<int16_t>(
+        std::lround(std::clamp(sample, -1.0f, 1.0f) * 32767.0f))));
+  }
+  return static_cast<bool>(file);
+}
+
+/*==========================================
+=                 BENCHMARKS               =
+==========================================*/
+
+/* Reaches the private per-frame stage of a converter */
+struct Audio2ImageBench {
+  template <typename Config>
+  static BenchResult insert_frame(BasicAudio2Image<Config>& converter,
+                                  const std::vector<float>& samples) {
+    cv::Mat image(Config::IMAGE_SIZE_Y_PIXELS, Config::IMAGE_SIZE_X_PIXELS,
+                  CV_8UC3);
+    FFTEngine& fft_engine = *converter.fft_engines.front();
+    FrameScratch& scratch = converter.frame_scratches.front();
+    const int samples_per_frame = BasicAudio2Image<Config>::SAMPLES_PER_FRAME;
+
+    return run_bench(
+        "insert_codec_frame_to_image/" +
+            std::to_string(Config::SAMPLE_RATE_HZ),
+        samples_per_frame, "samples", [&] {
+          converter.insert_codec_frame_to_image(fft_engine, scratch, 0,
+                                                samples.data(),
+                                                samples_per_frame, image);
+        });
+  }
+};
+
+static void bench_kernels(std::vector<BenchResult>& results) {
+  constexpr int SEGMENT_SIZE = 16;
+  constexpr int NUM_SEGMENTS = 64;
+  FFTEngine fft_engine(SEGMENT_SIZE, NUM_SEGMENTS);
+  std::vector<float> noise = generate_signal(SIGNAL_T::NOISE, 44100);
+  std::copy_n(noise.begin(), SEGMENT_SIZE * NUM_SEGMENTS, fft_engine.input());
+  fft_engine.execute();
+
+  std::vector<double> frequency(NUM_SEGMENTS);
+  std::vector<double> amplitude(NUM_SEGMENTS);
+  std::vector<uint8_t> blue(NUM_SEGMENTS);
+  std::vector<uint8_t> red(NUM_SEGMENTS);
+
+  results.push_back(
+      run_bench("fft_execute", NUM_SEGMENTS, "segments",
+                [&] { fft_engine.execute(); }));
+  results.push_back(run_bench(
+      "compute_average_frequency_and_amplitude", NUM_SEGMENTS, "segments",
+      [&] {
+        compute_average_frequency_and_amplitude_batch(
+            fft_engine.real_output(), fft_engine.imag_output(), NUM_SEGMENTS,
+            SEGMENT_SIZE / 2, frequency.data(), amplitude.data());
+      }));
+  results.push_back(run_bench(
+      "normalize_to_pixel_values", NUM_SEGMENTS, "segments", [&] {
+        normalize_to_pixel_values_batch(frequency.data(), amplitude.data(),
+                                        NUM_SEGMENTS, 14.1, blue.data(),
+                                        red.data());
+      }));
+}
+
+static void bench_filters(std::vector<BenchResult>& results) {
+  cv::Mat image(SQUARE_IMG_SIZE_Y, SQUARE_IMG_SIZE_X, CV_8UC3);
+  std::mt19937 generator(1234);
+  for (int y = 0; y < image.rows; ++y) {
+    uint8_t* row = image.ptr<uint8_t>(y);
+    for (int x = 0; x < 3 * image.cols; ++x) {
+      row[x] = static_cast<uint8_t>(generator());
+    }
+  }
+  const double pixels = static_cast<double>(image.rows) * image.cols;
+
+  FilterChain chain;
+  chain.add(low_pass_filter(8000.0, 0.0, 10.0, FILTER_EDGE_T::GRADIENT, 0.5));
+  chain.add(high_pass_filter(200.0));
+  chain.add(scale_amplitude_filter(0.8, 2.0, 6.0));
+  results.push_back(run_bench("filter_chain_apply", pixels, "pixels",
+                              [&] { chain.apply(image); }));
+
+  results.push_back(run_bench("filter_chain_compile", 1, "chains", [&] {
+    FilterChain compiled;
+    compiled.add(low_pass_filter(8000.0));
+    compiled.add(scale_amplitude_filter(0.8, 2.0, 6.0));
+  }));
+}
+
+/* The decode loop (FFmpeg), the mapped path and one frame, per signal */
+template <typename Config>
+static void bench_sample_rate(const std::string& corpus_directory,
+                              std::vector<BenchResult>& results) {
+  const int sample_rate_hz = Config::SAMPLE_RATE_HZ;
+  const double clip_samples = CORPUS_DURATION_SEC * sample_rate_hz;
+  BasicAudio2Image<Config> converter;
+  BasicAudio2Image<Config> single_thread_converter(1);
+
+  for (SIGNAL_T signal : {SIGNAL_T::SINE, SIGNAL_T::CHIRP, SIGNAL_T::NOISE}) {
+    const std::string name =
+        std::string(signal_name(signal)) + "/" + std::to_string(sample_rate_hz);
+    const std::string filename = corpus_directory + "/" + signal_name(signal) +
+                                 "_" + std::to_string(sample_rate_hz) + ".wav";
+    std::vector<float> samples = generate_signal(signal, sample_rate_hz);
+    if (!write_wav(filename, samples, sample_rate_hz)) {
+      LOG_ERROR("CANNOT WRITE BENCHMARK CORPUS");
+      continue;
+    }
+
+    cv::Mat image;
+    results.push_back(
+        run_bench("end_to_end/mapped/" + name, clip_samples, "samples", [&] {
+          converter.audio_file_to_image(filename, image);
+        }));
+
+    // Probing included, a session is consumed by its conversion
+    MediaSession session;
+    if (session.open(filename) == AUDIO2IMAGE_RET_T::GOOD_IMPORT) {
+      results.push_back(run_bench(
+          "decode_loop/ffmpeg/" + name, clip_samples, "samples", [&] {
+            session.open(filename);
+            single_thread_converter.audio_file_to_image(session);
+          }));
+    }
+
+    if (signal == SIGNAL_T::NOISE) {
+      results.push_back(
+          Audio2ImageBench::insert_frame(single_thread_converter, samples));
+    }
+  }
+}
+
+static bool write_json(const std::string& filename,
+                       const std::vector<BenchResult>& results) {
+  std::ofstream file(filename);
+  file << "{\n  \"allocation_counter\": "
+       << (ALLOCATION_COUNTER_ENABLED ? "true" : "false")
+       << ",\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& result = results[i];
+    const double iterations = static_cast<double>(result.iterations);
+    file << "    {\"name\": \"" << result.name
+         << "\", \"iterations\": " << result.iterations
+         << ", \"ns_per_iteration\": " << 1e9 * result.seconds / iterations
+         << ", \"" << result.item_unit << "_per_sec\": "
+         << result.items_per_iteration * iterations / result.seconds
+         << ", \"allocations_per_iteration\": "
+         << static_cast<double>(result.allocations) / iterations << "}"
+         << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  file << "  ]\n}\n";
+  return static_cast<bool>(file);
+}
+
+int main(int argc, char** argv) {
+  const std::string output_filename = argc > 1 ? argv[1] : "bench.json";
+  const std::string corpus_directory = argc > 2 ? argv[2] : ".";
+
+  std::vector<BenchResult> results;
+  bench_kernels(results);
+  bench_filters(results);
+  bench_sample_rate<Audio2ImageConfig<44100>>(corpus_directory, results);
+  bench_sample_rate<Audio2ImageConfig<48000>>(corpus_directory, results);
+  bench_sample_rate<Audio2ImageConfig<96000>>(corpus_directory, results);
+
+  if (!write_json(output_filename, results)) {
+    LOG_ERROR("CANNOT WRITE BENCHMARK RESULTS");
+    return 1;
+  }
+  LOG_INFO(std::format("{} benchmarks written to {}", results.size(),
+                       output_filename));
+  return 0;
+}
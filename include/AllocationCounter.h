@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+/* Counts calls to the global operator new, used to check that the conversion
+ * loop runs without heap allocations.
+ *
+ * Only compiled in when AUDIOVISUAL_COUNT_ALLOCATIONS is defined (CMake option
+ * of the same name), otherwise allocation_count() always returns 0. Memory
+ * allocated by FFmpeg, FFTW and OpenCV goes through malloc and is not
+ * counted. */
+#if defined(AUDIOVISUAL_COUNT_ALLOCATIONS)
+inline constexpr bool ALLOCATION_COUNTER_ENABLED = true;
+#else
+inline constexpr bool ALLOCATION_COUNTER_ENABLED = false;
+#endif
+
+uint64_t allocation_count();
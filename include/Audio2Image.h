@@ -1,68 +1,375 @@
 #pragma once
 
 #include <limits>
+#include <memory>
 #include <string>
+#include <thread>
 #include <tuple>
 
+#include "AllocationCounter.h"
+#include "Audio2ImageStatus.h"
+#include "AudioImagePyramid.h"
+#include "BoundedQueue.h"
+#include "BufferPool.h"
+#include "ConversionCache.h"
+#include "ConversionStats.h"
+#include "FFTEngine.h"
+#include "MappedPCMFile.h"
+#include "MediaSession.h"
+#include "PlanarBuffer.h"
+#include "SampleRing.h"
+#include "SpectralKernels.h"
+#include "SpectralMatrix.h"
+#include "TiledAudioImage.h"
 #include "common.h"
 
-enum class AUDIO2IMAGE_RET_T {
-  GOOD_IMPORT,
-  GOOD_CONVERSION,
-  GOOD_AUDIO2IMAGE,
-  GOOD_FRAME_INSERTION_TO_IMAGE,
-
-  UNFILLED_MATRIX,
-  INVALID_AUDIO_FILE_TYPE,
-  AUDIO_FILE_DURATION_TOO_SHORT,
-  CANNOT_CLIP_AUDIO_FILE,
-
-  FFMPEG_ERROR_OPENING_AUDIO_FILE,
-  FFMPEG_ERROR_FINDING_AUDIO_STREAM_INFO,
-  FFMPEG_ERROR_ALLOCATING_CODEC_CONTEXT,
-  FFMPEG_ERROR_ALLOCATING_FRAME,
-  FFMPEG_ERROR_RECEIVING_FRAME_FROM_CODEC,
-  FFMPEG_ERROR_SENDING_PACKET_TO_CODEC,
-  FFMPEG_ERROR_COPY_CODEC_PARAM_TO_CONTEXT,
-
-  FFMPEG_CANNOT_OPEN_CODEC,
-  FFMPEG_CODEC_NOT_FOUND,
-  FFMPEG_AUDIO_STREAM_NOT_FOUND,
+/* Analysis window applied to every segment before its FFT */
+enum class STFT_WINDOW_T {
+  RECTANGULAR,
+  HANN,
+  BLACKMAN,
 };
 
-class Audio2Image {
+/* Samples of one analysis frame, tagged with its position in the stream */
+struct SampleBlock {
+  int frame_index = 0;
+  std::vector<float>* samples = nullptr;  // decoded by FFmpeg, pooled
+
+  // ... or a range of a memory-mapped PCM file, converted by the worker
+  const MappedPCMFile* pcm_file = nullptr;
+  int64_t pcm_first_frame = 0;
+  int pcm_num_frames = 0;
+
+  int channel = 0;  // image of a per-channel conversion
+};
+
+/* Per-worker buffers reused by every frame the worker converts, sized once
+ * when the converter is constructed */
+struct FrameScratch {
+  std::vector<float> pcm_samples;  // memory-mapped blocks converted to float
+  std::vector<double> average_frequency;
+  std::vector<double> average_amplitude;
+  std::vector<uint8_t> blue;
+  std::vector<uint8_t> red;
+  std::vector<uint8_t> encoded_spectra;  // data matrix segments
+  std::vector<PyramidCell> pyramid_cells;
+
+  int invalid_amplitudes = 0;  // reported once per conversion
+  ConversionStats stats;       // merged into the converter's on join
+};
+
+/* Per-conversion fan-out of sample blocks to the FFT workers */
+struct FramePipeline {
+  BoundedQueue<SampleBlock> block_queue;
+  std::vector<std::thread> fft_workers;
+
+  explicit FramePipeline(size_t capacity) : block_queue(capacity) {}
+};
+
+/* Compile-time parameters of a converter, see BasicAudio2Image */
+template <int SampleRateHz, int NumSamplesPerSegment = 16,
+          int SegmentsPerFrame = 64, int ImageSizeXPixels = SQUARE_IMG_SIZE_X,
+          int ImageSizeYPixels = SQUARE_IMG_SIZE_Y, int AudioDurationSec = 10>
+struct Audio2ImageConfig {
+  static constexpr int SAMPLE_RATE_HZ = SampleRateHz;
+  static constexpr int NUM_SAMPLES_PER_SEGMENT = NumSamplesPerSegment;
+  static constexpr int SEGMENTS_PER_FRAME = SegmentsPerFrame;
+  static constexpr int IMAGE_SIZE_X_PIXELS = ImageSizeXPixels;
+  static constexpr int IMAGE_SIZE_Y_PIXELS = ImageSizeYPixels;
+  static constexpr int AUDIO_DURATION_SEC = AudioDurationSec;
+};
+
+/* Audio to image converter specialized for one Audio2ImageConfig.
+ *
+ * Segment size, frame size, image size and sample rate are constants, so the
+ * pixel counts and the bin to Hz to pixel scaling fold away and the fixed size
+ * loops can be fully unrolled. Instantiated in Audio2Image.cpp for 44.1, 48
+ * and 96 kHz. */
+template <typename Config>
+class BasicAudio2Image {
  private:
-  const int IMAGE_SIZE_X_PIXELS = SQUARE_IMG_SIZE_X;
-  const int IMAGE_SIZE_Y_PIXELS = SQUARE_IMG_SIZE_Y;
+  friend struct Audio2ImageBench;  // times the private stages, bench/
+
+  static constexpr int IMAGE_SIZE_X_PIXELS = Config::IMAGE_SIZE_X_PIXELS;
+  static constexpr int IMAGE_SIZE_Y_PIXELS = Config::IMAGE_SIZE_Y_PIXELS;
+  static constexpr int TOTAL_PIXELS = IMAGE_SIZE_X_PIXELS * IMAGE_SIZE_Y_PIXELS;
+
+  static constexpr int SAMPLE_RATE_HZ = Config::SAMPLE_RATE_HZ;
+  static constexpr int NUM_SAMPLES_PER_SEGMENT =
+      Config::NUM_SAMPLES_PER_SEGMENT;
+  static constexpr int SEGMENTS_PER_FRAME = Config::SEGMENTS_PER_FRAME;
+  static constexpr int SAMPLES_PER_FRAME =
+      NUM_SAMPLES_PER_SEGMENT * SEGMENTS_PER_FRAME;
+
+  static constexpr double AUDIO_DURATION_SEC = Config::AUDIO_DURATION_SEC;
+
+  // FFT bin k is centered on k * BIN_WIDTH_HZ, then scaled to 0-255
+  static constexpr double BIN_WIDTH_HZ =
+      static_cast<double>(SAMPLE_RATE_HZ) / NUM_SAMPLES_PER_SEGMENT;
+  static constexpr double BIN_TO_PIXEL =
+      BIN_WIDTH_HZ * MAX_PIXEL_VALUE / MAX_FREQUENCY_IN_AUDIO_SIGNAL_HZ;
+
+  // Decoded frames waiting for a worker, bounds memory if FFT falls behind
+  const size_t BLOCK_QUEUE_CAPACITY = 64;
+
+  // One engine and one scratch per FFT worker, planned once per converter
+  std::vector<std::unique_ptr<FFTEngine>> fft_engines;
+  std::vector<FrameScratch> frame_scratches;
+
+  // Decoded samples, enough buffers for a full queue, one block per worker
+  // and the block being filled
+  BufferPool<std::vector<float>> sample_pool;
+
+  // Reused by every decode loop
+  AVPacket* packet = nullptr;
+  AVFrame* decoded_frame = nullptr;
+
+  // Any layout and sample format to mono float, or to planar float per
+  // channel, reconfigured for every stream
+  SwrContext* resampler = nullptr;
+  const bool RESAMPLE_TO_SAMPLE_RATE;
+
+  // Resampler output of one codec frame, grows to the largest frame once
+  PlanarBuffer output_samples;
+
+  // STFT front end: cell s covers samples [s * hop_size, s * hop_size + N),
+  // so a frame reads SEGMENTS_PER_FRAME - 1 hops plus one segment and the
+  // next one starts SEGMENTS_PER_FRAME hops later, whatever the codec frames
+  int hop_size = NUM_SAMPLES_PER_SEGMENT;
+  std::vector<double> window;  // unit mean, empty when rectangular
+  std::vector<SampleRing> sample_rings;  // one per output channel
+
+  void clear_sample_rings() {
+    for (SampleRing& ring : this->sample_rings) {
+      ring.clear();
+    }
+  }
+
+  int frame_length() const {
+    return (SEGMENTS_PER_FRAME - 1) * this->hop_size + NUM_SAMPLES_PER_SEGMENT;
+  }
+  int frame_hop() const { return SEGMENTS_PER_FRAME * this->hop_size; }
+
+  // High-fidelity mode: every spectrum of the image also goes to D
+  SpectralMatrixWriter* data_matrix = nullptr;
+
+  // Overview levels built alongside the image
+  AudioImagePyramid* pyramid = nullptr;
+
+  // Tiled conversions write their cells to tiles instead of one image, and
+  // are bounded by neither the image size nor AUDIO_DURATION_SEC
+  TiledAudioImage* tile_sink = nullptr;
+  int cell_limit = TOTAL_PIXELS;
+  double clip_duration_sec = AUDIO_DURATION_SEC;
+
+  bool frame_fits(int frame_index) const {
+    return static_cast<int64_t>(frame_index) * SEGMENTS_PER_FRAME <
+           this->cell_limit;
+  }
+
+  // Per-channel conversions write channel c to (*channel_images)[c] instead
+  // of downmixing, see audio_file_to_channel_images
+  std::vector<cv::Mat>* channel_images = nullptr;
+  int num_output_channels = 1;
+
+  cv::Mat& target_image(int channel, cv::Mat& result_image) {
+    return this->channel_images ? (*this->channel_images)[channel]
+                                : result_image;
+  }
+
+  int64_t clip_num_samples(int sample_rate) const;
+
+  /* Allocates the images unless tiling, one per output channel of an input
+   * with input_channels, and starts the pyramid over */
+  void begin_image(int input_channels, cv::Mat& result_image);
+
+  // Conversions of whole files are looked up here first, see set_cache
+  ConversionCache* cache = nullptr;
 
-  const int NUM_SAMPLES_PER_SEGMENT = 16;
-  const int SEGMENTS_PER_FRAME = 64;
+  std::optional<uint64_t> cache_key(const std::string& filename,
+                                    double clip_start_sec) const;
 
-  const double AUDIO_DURATION_SEC = 10.0;
+  // Filled by every conversion when set, see set_stats
+  ConversionStats* stats = nullptr;
 
-  void print_complex_fft(fftw_complex* out, int num_samples);
+  // Where a worker times its stages, nullptr when nobody asked
+  ConversionStats* worker_stats(FrameScratch& scratch) const {
+    return CONVERSION_STATS_ENABLED && this->stats ? &scratch.stats : nullptr;
+  }
 
-  std::tuple<int, int> normalize_to_pixel_values(const double frequency,
-                                                 const double amplitude);
+  void count_stat(uint64_t ConversionStats::*counter, uint64_t amount) {
+    if (CONVERSION_STATS_ENABLED && this->stats) {
+      this->stats->*counter += amount;
+    }
+  }
 
-  AUDIO2IMAGE_RET_T insert_codec_frame_to_image(
-      int& pixel_count,
-      std::vector<float>& audio_data, cv::Mat& result_image);
+  // operator new calls made by the last conversion loop after its first block
+  uint64_t steady_state_allocations = 0;
 
-  double get_audio_duration(const std::string filename);
+  void print_complex_fft(const FFTEngine& fft_engine, int segment);
 
-  std::string generateClippedFilename(const std::string& filename,
-                                      double new_duration);
+  AUDIO2IMAGE_RET_T insert_codec_frame_to_image(FFTEngine& fft_engine,
+                                                FrameScratch& scratch,
+                                                int first_pixel,
+                                                const float* audio_data,
+                                                int num_samples,
+                                                cv::Mat& result_image);
 
-  bool clip_audio_file(const std::string filename,
-                       const std::string new_filename, double new_duration);
+  void process_block(FFTEngine& fft_engine, FrameScratch& scratch,
+                     const SampleBlock& block, cv::Mat& result_image);
 
-  std::tuple<double, double> compute_average_frequency_and_amplitude(
-      fftw_complex* out, int num_samples);
+  void run_fft_worker(FFTEngine& fft_engine, FrameScratch& scratch,
+                      FramePipeline& pipeline, cv::Mat& result_image);
+
+  void start_fft_workers(FramePipeline& pipeline, cv::Mat& result_image);
+
+  void dispatch_block(FramePipeline& pipeline, SampleBlock&& block,
+                      cv::Mat& result_image);
+
+  void join_fft_workers(FramePipeline& pipeline);
+
+  int dispatch_frame_from_ring(FramePipeline& pipeline, int channel,
+                               int frame_index, int num_samples,
+                               cv::Mat& result_image);
+
+  int dispatch_samples(FramePipeline& pipeline, int channel,
+                       const float* samples, int num_samples, int frame_index,
+                       cv::Mat& result_image);
+
+  int dispatch_output_samples(FramePipeline& pipeline, int num_samples,
+                              int frame_index, cv::Mat& result_image);
+
+  int flush_samples(FramePipeline& pipeline, int frame_index,
+                    cv::Mat& result_image);
+
+  bool needs_resampling(const MappedPCMFile& pcm_file) const;
+
+  AUDIO2IMAGE_RET_T configure_resampler(const AVCodecContext* codec_ctx,
+                                        int output_sample_rate);
+
+  int resample(const uint8_t** input_planes, int num_samples);
+
+  bool read_packet(AVFormatContext* format_ctx, AVPacket* packet);
+
+  AUDIO2IMAGE_RET_T finish_image(int pixel_count, bool clip_complete,
+                                 cv::Mat& result_image);
+
+  AUDIO2IMAGE_RET_T convert_session(MediaSession& session,
+                                    double clip_start_sec,
+                                    cv::Mat& result_image);
+
+  AUDIO2IMAGE_RET_T convert_pcm_file(const MappedPCMFile& pcm_file,
+                                     double clip_start_sec,
+                                     cv::Mat& result_image);
+
+  AUDIO2IMAGE_RET_T convert_file(const std::string& filename,
+                                 double clip_start_sec,
+                                 cv::Mat& result_image);
 
  public:
+  /* num_fft_workers <= 1 runs the whole conversion on the calling thread.
+   * resample_to_sample_rate converts inputs at other rates to SAMPLE_RATE_HZ
+   * so the frequency scale holds, otherwise they are used as they are. */
+  explicit BasicAudio2Image(int num_fft_workers = static_cast<int>(
+                                std::thread::hardware_concurrency()),
+                            bool resample_to_sample_rate = false);
+  ~BasicAudio2Image();
+
+  BasicAudio2Image(const BasicAudio2Image&) = delete;
+  BasicAudio2Image& operator=(const BasicAudio2Image&) = delete;
+
+  /* Converts AUDIO_DURATION_SEC of audio starting at clip_start_sec. The
+   * cells past the clip are black; UNFILLED_MATRIX means the file ended
+   * before the clip did. */
   std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> audio_file_to_image(
-      std::string filename);
+      std::string filename, double clip_start_sec = 0.0);
+
+  /* Same as above into a caller owned image, whose buffer is reused when it
+   * already has the converter's size */
+  AUDIO2IMAGE_RET_T audio_file_to_image(std::string filename,
+                                        cv::Mat& result_image,
+                                        double clip_start_sec = 0.0);
+
+  /* Same as above on an already opened session, reusing its probe */
+  std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> audio_file_to_image(
+      MediaSession& session, double clip_start_sec = 0.0);
+
+  /* Fast path for uncompressed WAV/AIFF, reads the mapped samples directly */
+  std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> audio_file_to_image(
+      const MappedPCMFile& pcm_file, double clip_start_sec = 0.0);
 
   std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> audio2image(std::string filename);
+
+  /* Converts AUDIO_DURATION_SEC from clip_start_sec on into one image per
+   * channel, in the file's channel order, instead of downmixing to mono.
+   * Channels are deinterleaved once and their frames are transformed
+   * concurrently by the FFT workers. The data matrix, pyramid and cache only
+   * apply to mono conversions and are skipped. */
+  AUDIO2IMAGE_RET_T audio_file_to_channel_images(
+      std::string filename, std::vector<cv::Mat>& channel_images,
+      double clip_start_sec = 0.0);
+
+  /* Converts the whole file from clip_start_sec on, whatever its length,
+   * into image-sized tiles produced as decoding goes. Tile times assume the
+   * input is at SAMPLE_RATE_HZ, or is resampled to it. */
+  AUDIO2IMAGE_RET_T audio_file_to_tiles(std::string filename,
+                                        TiledAudioImage& tiles,
+                                        double clip_start_sec = 0.0);
+
+  /* High-fidelity mode: the following conversions also write the spectrum of
+   * every cell to data_matrix, which the caller opens with this converter's
+   * sample rate and segment size and finishes. nullptr goes back to
+   * low-fidelity. */
+  void set_data_matrix(SpectralMatrixWriter* data_matrix) {
+    this->data_matrix = data_matrix;
+  }
+
+  /* Every following conversion, to an image or to tiles, also rebuilds
+   * pyramid, which can be queried while it grows. nullptr stops it. */
+  void set_pyramid(AudioImagePyramid* pyramid) { this->pyramid = pyramid; }
+
+  /* Conversions of a file by name, to an image, are first looked up in
+   * cache and stored there after a miss, keyed by the file's contents and
+   * this converter's parameters. A hit zeroes the stats. Tiles and pyramids
+   * always convert. nullptr stops it. */
+  void set_cache(ConversionCache* cache) { this->cache = cache; }
+
+  /* Every following conversion starts stats over and fills it with the time
+   * spent in each stage and the packets, frames and samples it went
+   * through. Stays zero unless built with AUDIOVISUAL_CONVERSION_STATS.
+   * nullptr stops it. */
+  void set_stats(ConversionStats* stats) { this->stats = stats; }
+
+  /* Window applied to every segment and hop from one segment to the next,
+   * 1 to NUM_SAMPLES_PER_SEGMENT samples; a cell then lasts hop_size
+   * samples. Windows peak at 1, which keeps the red level a tone has with
+   * the rectangular window. Image2Audio, the filters and the data matrix
+   * assume the default, rectangular windows a whole segment apart. False if
+   * hop_size is out of range. */
+  bool set_stft(STFT_WINDOW_T window_type,
+                int hop_size = NUM_SAMPLES_PER_SEGMENT);
+
+  /* Test hook, always 0 unless built with AUDIOVISUAL_COUNT_ALLOCATIONS */
+  uint64_t last_steady_state_allocations() const {
+    return this->steady_state_allocations;
+  }
 };
+
+extern template class BasicAudio2Image<Audio2ImageConfig<44100>>;
+extern template class BasicAudio2Image<Audio2ImageConfig<48000>>;
+extern template class BasicAudio2Image<Audio2ImageConfig<96000>>;
+
+using Audio2Image =
+    BasicAudio2Image<Audio2ImageConfig<CD_AUDIO_FILE_FREQUENCY_HZ>>;
+using Audio2Image48kHz = BasicAudio2Image<Audio2ImageConfig<48000>>;
+using Audio2Image96kHz = BasicAudio2Image<Audio2ImageConfig<96000>>;
+
+/* Picks the converter instantiated for sample_rate_hz at runtime, for jobs
+ * that choose their configuration per file. One converter per rate is
+ * planned on the first call and reused by every later one. */
+std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> audio2image_at_sample_rate(
+    int sample_rate_hz, std::string filename);
+
+/* Combined view of a per-channel conversion: the channel images stacked top
+ * to bottom in channel order, all of the same size and type */
+cv::Mat stack_channel_images(const std::vector<cv::Mat>& channel_images);
@@ -0,0 +1,31 @@
+#pragma once
+
+enum class AUDIO2IMAGE_RET_T {
+  GOOD_IMPORT,
+  GOOD_CONVERSION,
+  GOOD_AUDIO2IMAGE,
+  GOOD_FRAME_INSERTION_TO_IMAGE,
+
+  UNFILLED_MATRIX,
+  INVALID_AUDIO_FILE_TYPE,
+  AUDIO_FILE_DURATION_TOO_SHORT,
+  CANNOT_CLIP_AUDIO_FILE,
+  UNSUPPORTED_SAMPLE_RATE,
+
+  FFMPEG_ERROR_OPENING_AUDIO_FILE,
+  FFMPEG_ERROR_FINDING_AUDIO_STREAM_INFO,
+  FFMPEG_ERROR_ALLOCATING_CODEC_CONTEXT,
+  FFMPEG_ERROR_ALLOCATING_FRAME,
+  FFMPEG_ERROR_RECEIVING_FRAME_FROM_CODEC,
+  FFMPEG_ERROR_SENDING_PACKET_TO_CODEC,
+  FFMPEG_ERROR_COPY_CODEC_PARAM_TO_CONTEXT,
+
+  FFMPEG_CANNOT_OPEN_CODEC,
+  FFMPEG_CODEC_NOT_FOUND,
+  FFMPEG_AUDIO_STREAM_NOT_FOUND,
+  FFMPEG_CANNOT_INIT_RESAMPLER,
+  FFMPEG_ERROR_RESAMPLING_FRAME,
+
+  ERROR_WRITING_DATA_MATRIX,
+  ERROR_WRITING_IMAGE,
+};
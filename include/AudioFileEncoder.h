@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "Image2AudioStatus.h"
+#include "common.h"
+
+/* Float sample clamped to [-1, 1] as written by AudioFileEncoder */
+inline int16_t to_pcm_s16(float sample) {
+  return static_cast<int16_t>(
+      std::lrint(std::clamp(sample, -1.0f, 1.0f) * 32767.0f));
+}
+
+/* Mono 16-bit WAV or FLAC file written incrementally.
+ *
+ * write() converts float samples into the current codec frame and encodes it
+ * as soon as it is full, so only one frame is ever buffered whatever the
+ * length of the signal. The codec follows the file extension. */
+class AudioFileEncoder {
+ private:
+  // Frame size for codecs that accept any, like PCM
+  const int DEFAULT_FRAME_SIZE = 4096;
+
+  AVFormatContext* format_ctx = nullptr;
+  AVCodecContext* codec_ctx = nullptr;
+  AVStream* audio_stream = nullptr;
+  AVFrame* frame = nullptr;
+  AVPacket* packet = nullptr;
+
+  int frame_capacity = 0;  // samples per full frame
+  int frame_fill = 0;      // samples already in the current frame
+  int64_t next_pts = 0;
+
+  IMAGE2AUDIO_RET_T encode_frame(const AVFrame* input_frame);
+
+ public:
+  AudioFileEncoder() = default;
+  ~AudioFileEncoder();
+
+  AudioFileEncoder(const AudioFileEncoder&) = delete;
+  AudioFileEncoder& operator=(const AudioFileEncoder&) = delete;
+
+  /* Creates the file and writes its header */
+  IMAGE2AUDIO_RET_T open(const std::string& filename, int sample_rate_hz);
+
+  /* Samples are clamped to [-1, 1] */
+  IMAGE2AUDIO_RET_T write(const float* samples, int num_samples);
+
+  /* Encodes the last partial frame, drains the encoder, writes the trailer */
+  IMAGE2AUDIO_RET_T finish();
+
+  void close();
+};
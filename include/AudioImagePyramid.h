@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "common.h"
+
+/* A run of merged cells, in physical units */
+struct PyramidCell {
+  float frequency_hz;  // amplitude weighted mean
+  float amplitude;     // mean
+};
+
+/* Mipmap of an audio image along time, for overviews of long recordings.
+ *
+ * Level l merges 2^l consecutive cells into one; level 0 is the image itself
+ * and is not stored. Merging keeps the meaning of a cell: the amplitude is the
+ * mean amplitude and the frequency the amplitude weighted mean frequency of
+ * the merged segments, which is what the average of one segment spanning them
+ * would have been. Pixels are only made when queried, with the image mapping.
+ *
+ * Levels are built while converting. Each block of cells_per_block cells, a
+ * frame, is reduced to one cell by the worker that computed it, and the
+ * levels above grow as the run of finished blocks from the start does. */
+class AudioImagePyramid {
+ private:
+  int block_levels = 0;  // levels reduced within a block
+  int cells_per_block = 0;
+  double seconds_per_cell = 0.0;
+  double bin_width_hz = 0.0;
+
+  // levels[l - 1] is level l, level_sizes[l - 1] its cells valid so far
+  std::vector<std::vector<PyramidCell>> levels;
+  std::vector<int64_t> level_sizes;
+  std::vector<bool> finished_blocks;
+  int64_t finished_prefix = 0;  // blocks finished from the start
+  mutable std::mutex levels_mutex;
+
+  void extend_levels(bool finished);
+
+ public:
+  AudioImagePyramid() = default;
+
+  AudioImagePyramid(const AudioImagePyramid&) = delete;
+  AudioImagePyramid& operator=(const AudioImagePyramid&) = delete;
+
+  /* Drops every level. cells_per_block is a power of two, at least 2. */
+  void reset(double seconds_per_cell, int cells_per_block,
+             double bin_width_hz);
+
+  /* Adds the block starting at first_cell, a multiple of cells_per_block,
+   * from the per-segment averages of the FFT (frequency in bins). Only the
+   * last block may be short. scratch is the caller's, reused across calls.
+   * Thread safe. */
+  void add_block(int64_t first_cell, int count, const double* frequency,
+                 const double* amplitude, std::vector<PyramidCell>& scratch);
+
+  /* Ends the image after num_cells cells, merging the odd cells left over */
+  void finish(int64_t num_cells);
+
+  int num_levels() const;
+  int64_t num_cells(int level) const;
+  double cell_duration_sec(int level) const {
+    return this->seconds_per_cell * static_cast<double>(int64_t{1} << level);
+  }
+
+  /* Cells over [start_sec, end_sec) from the finest level that needs at most
+   * max_cells of them (the coarsest one if none does), as image pixels.
+   * Returns that level and the pixels, empty where nothing is built yet. */
+  std::tuple<int, std::vector<cv::Vec3b>> query(double start_sec,
+                                                double end_sec,
+                                                int max_cells) const;
+};
@@ -1,10 +1,138 @@
-/**
- * Implement the following filters for images as required to match it's interpretation in 1D signals
- *  Create the overloads for them as well.
- * 
- * - low-pass(frequency, image, time init, time end, binary/gradient, gradient value)
- * - high-pass(frequency, image, time init, time end, binary/gradient, gradient value)
- * - scale_amplitude(scaling factor, image)
- */ 
-
-#pragma once
\ No newline at end of file
+#pragma once
+
+#include <array>
+#include <limits>
+#include <vector>
+
+#include "Audio2Image.h"
+#include "AudioVisualFiltersStatus.h"
+#include "DirtyRegions.h"
+#include "SpectralKernels.h"
+#include "common.h"
+
+enum class FILTER_T { LOW_PASS, HIGH_PASS, SCALE_AMPLITUDE };
+
+/* BINARY keeps or cuts a cell whole. GRADIENT attenuates cells past the
+ * cutoff by half every gradient_value octaves, so values close to 0 approach
+ * the binary cut and 1.0 rolls off at 6 dB per octave. */
+enum class FILTER_EDGE_T { BINARY, GRADIENT };
+
+/* One filter over [start_sec, end_sec) of an image, the 1D filter as seen
+ * through the blue (frequency) and red (log2 amplitude) channels */
+struct ImageFilter {
+  FILTER_T type = FILTER_T::SCALE_AMPLITUDE;
+  double value = 1.0;  // cutoff in Hz, or amplitude scaling factor
+  double start_sec = 0.0;
+  double end_sec = std::numeric_limits<double>::infinity();
+  FILTER_EDGE_T edge = FILTER_EDGE_T::BINARY;
+  double gradient_value = 1.0;
+};
+
+ImageFilter low_pass_filter(
+    double cutoff_hz, double start_sec = 0.0,
+    double end_sec = std::numeric_limits<double>::infinity(),
+    FILTER_EDGE_T edge = FILTER_EDGE_T::BINARY, double gradient_value = 1.0);
+
+ImageFilter high_pass_filter(
+    double cutoff_hz, double start_sec = 0.0,
+    double end_sec = std::numeric_limits<double>::infinity(),
+    FILTER_EDGE_T edge = FILTER_EDGE_T::BINARY, double gradient_value = 1.0);
+
+/* A factor of 0 or less silences the cells */
+ImageFilter scale_amplitude_filter(
+    double factor, double start_sec = 0.0,
+    double end_sec = std::numeric_limits<double>::infinity());
+
+/* Stack of filters applied to images made by the BasicAudio2Image of the
+ * same Config.
+ *
+ * Every filter is a gain per blue value over a range of cells. Gains
+ * multiply, so in the log2 red channel they add up: the chain is compiled
+ * into one table of red offsets per stretch of cells where the same filters
+ * overlap, and applying it is a single pass over the rows those stretches
+ * cover, in parallel with cv::parallel_for_. A cut cell turns black, which
+ * Image2Audio renders as silence. Red saturates at full scale and at the
+ * floor of its level scale, so a boost clips at an amplitude of 1 and an
+ * attenuation below 2^-16 is silence.
+ *
+ * In high-fidelity mode the same gains apply per bin to the spectra of the
+ * data matrix, as they are read. */
+template <typename Config>
+class BasicFilterChain {
+ private:
+  static constexpr int IMAGE_SIZE_X_PIXELS = Config::IMAGE_SIZE_X_PIXELS;
+  static constexpr int IMAGE_SIZE_Y_PIXELS = Config::IMAGE_SIZE_Y_PIXELS;
+  static constexpr int TOTAL_PIXELS = IMAGE_SIZE_X_PIXELS * IMAGE_SIZE_Y_PIXELS;
+
+  static constexpr double SECONDS_PER_CELL =
+      static_cast<double>(Config::NUM_SAMPLES_PER_SEGMENT) /
+      Config::SAMPLE_RATE_HZ;
+
+  // Bins of the data matrix, bin k is centered on k * BIN_WIDTH_HZ
+  static constexpr int NUM_BINS = Config::NUM_SAMPLES_PER_SEGMENT / 2 + 1;
+  static constexpr double BIN_WIDTH_HZ =
+      static_cast<double>(Config::SAMPLE_RATE_HZ) /
+      Config::NUM_SAMPLES_PER_SEGMENT;
+
+  /* Cells [first_cell, end_cell) all see the same filters */
+  struct FusedSpan {
+    int first_cell;
+    int end_cell;
+    std::array<uint32_t, 256> lut;  // see apply_filter_lut_span
+    std::array<float, NUM_BINS> bin_gain;
+  };
+
+  std::vector<ImageFilter> filters;
+  std::vector<FusedSpan> fused_spans;
+
+  int to_cell(double seconds) const;
+
+  void compile();
+
+  void apply_rows(const cv::Range& rows, cv::Mat& image) const;
+
+ public:
+  FILTERS_RET_T add(const ImageFilter& filter);
+
+  void clear();
+
+  int size() const { return static_cast<int>(this->filters.size()); }
+
+  /* Runs every filter of the chain on the image, in place */
+  FILTERS_RET_T apply(cv::Mat& image);
+
+  /* Same as above, marking the cells the chain changed in dirty */
+  FILTERS_RET_T apply(cv::Mat& image, DirtyRegions& dirty);
+
+  /* Filters interleaved re, im spectra of segments (cells) [first_segment,
+   * first_segment + num_segments), as read from a SpectralMatrix. Thread
+   * safe. */
+  void apply_to_spectra(int64_t first_segment, int num_segments,
+                        float* spectra) const;
+};
+
+extern template class BasicFilterChain<Audio2ImageConfig<44100>>;
+extern template class BasicFilterChain<Audio2ImageConfig<48000>>;
+extern template class BasicFilterChain<Audio2ImageConfig<96000>>;
+
+using FilterChain =
+    BasicFilterChain<Audio2ImageConfig<CD_AUDIO_FILE_FREQUENCY_HZ>>;
+using FilterChain48kHz = BasicFilterChain<Audio2ImageConfig<48000>>;
+using FilterChain96kHz = BasicFilterChain<Audio2ImageConfig<96000>>;
+
+/* Single filters on a FilterChain image, for one-off edits */
+FILTERS_RET_T low_pass(double cutoff_hz, cv::Mat& image,
+                       double start_sec = 0.0,
+                       double end_sec = std::numeric_limits<double>::infinity(),
+                       FILTER_EDGE_T edge = FILTER_EDGE_T::BINARY,
+                       double gradient_value = 1.0);
+
+FILTERS_RET_T high_pass(
+    double cutoff_hz, cv::Mat& image, double start_sec = 0.0,
+    double end_sec = std::numeric_limits<double>::infinity(),
+    FILTER_EDGE_T edge = FILTER_EDGE_T::BINARY, double gradient_value = 1.0);
+
+FILTERS_RET_T scale_amplitude(double factor, cv::Mat& image);
+
+FILTERS_RET_T scale_amplitude(double factor, cv::Mat& image, double start_sec,
+                              double end_sec);
@@ -0,0 +1,8 @@
+#pragma once
+
+enum class FILTERS_RET_T {
+  GOOD_FILTERING,
+
+  INVALID_IMAGE,
+  INVALID_FILTER_PARAMETER,
+};
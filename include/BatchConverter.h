@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Audio2Image.h"
+#include "Audio2ImageStatus.h"
+#include "ConversionStats.h"
+#include "WorkStealingQueues.h"
+#include "common.h"
+
+/* Outcome of one file of a batch */
+struct BatchResult {
+  std::string input_filename;
+  std::string output_filename;  // empty if no image was written
+  AUDIO2IMAGE_RET_T status;
+  ConversionStats stats;  // see BasicAudio2Image::set_stats
+};
+
+/* Files as they are, the audio and video files of directories (not
+ * recursive) and the matches of glob patterns, sorted within each input. */
+std::vector<std::string> expand_batch_inputs(
+    const std::vector<std::string>& inputs);
+
+/* Converts many files at once on a fixed pool of threads.
+ *
+ * Each thread owns a single-threaded converter, with its own FFT plans,
+ * packet, frame and resampler, and opens its own demuxer and decoder per
+ * file, so files are converted in parallel instead of frames. Jobs are
+ * spread over the threads in order and idle threads steal from the others.
+ * Every image is written to output_directory as <input stem>.png by the
+ * thread that made it. */
+template <typename Config>
+class BasicBatchConverter {
+ private:
+  std::vector<std::unique_ptr<BasicAudio2Image<Config>>> converters;
+
+  void run_worker(size_t worker, WorkStealingQueues<size_t>& jobs,
+                  std::vector<BatchResult>& results, double clip_start_sec);
+
+ public:
+  explicit BasicBatchConverter(
+      int num_threads = static_cast<int>(std::thread::hardware_concurrency()),
+      bool resample_to_sample_rate = false);
+
+  BasicBatchConverter(const BasicBatchConverter&) = delete;
+  BasicBatchConverter& operator=(const BasicBatchConverter&) = delete;
+
+  int num_threads() const { return static_cast<int>(this->converters.size()); }
+
+  /* One result per input filename, in the same order. Stems shared by
+   * several inputs get a _<index> suffix, and a further _<n> if that is
+   * taken too, so no image overwrites another. */
+  std::vector<BatchResult> convert(
+      const std::vector<std::string>& input_filenames,
+      const std::string& output_directory, double clip_start_sec = 0.0);
+};
+
+extern template class BasicBatchConverter<Audio2ImageConfig<44100>>;
+extern template class BasicBatchConverter<Audio2ImageConfig<48000>>;
+extern template class BasicBatchConverter<Audio2ImageConfig<96000>>;
+
+using BatchConverter =
+    BasicBatchConverter<Audio2ImageConfig<CD_AUDIO_FILE_FREQUENCY_HZ>>;
+using BatchConverter48kHz = BasicBatchConverter<Audio2ImageConfig<48000>>;
+using BatchConverter96kHz = BasicBatchConverter<Audio2ImageConfig<96000>>;
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/* Blocking multi-producer/multi-consumer FIFO with a fixed capacity.
+ *
+ * push() waits while the queue is full, pop() waits while it is empty and
+ * returns std::nullopt once the queue has been closed and fully drained.
+ * Items live in a ring of CAPACITY slots allocated on construction, so
+ * pushing and popping never allocate. */
+template <typename T>
+class BoundedQueue {
+ private:
+  const size_t CAPACITY;
+
+  std::vector<T> slots;
+  size_t head = 0;  // next slot to pop
+  size_t count = 0;
+  bool closed = false;
+
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+
+ public:
+  explicit BoundedQueue(size_t capacity)
+      : CAPACITY(capacity), slots(capacity) {}
+
+  /* Returns false if the queue was closed before the item could be queued */
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_full.wait(lock, [this] {
+      return this->closed || this->count < this->CAPACITY;
+    });
+    if (this->closed) {
+      return false;
+    }
+    this->slots[(this->head + this->count) % this->CAPACITY] = std::move(item);
+    ++this->count;
+    lock.unlock();
+    this->not_empty.notify_one();
+    return true;
+  }
+
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_empty.wait(
+        lock, [this] { return this->closed || this->count > 0; });
+    if (this->count == 0) {
+      return std::nullopt;
+    }
+    T item = std::move(this->slots[this->head]);
+    this->head = (this->head + 1) % this->CAPACITY;
+    --this->count;
+    lock.unlock();
+    this->not_full.notify_one();
+    return item;
+  }
+
+  /* Wake every waiter; queued items can still be popped */
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->closed = true;
+    }
+    this->not_full.notify_all();
+    this->not_empty.notify_all();
+  }
+};
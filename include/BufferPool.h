@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* Fixed set of reusable objects shared by the decode loop and the FFT workers.
+ *
+ * Every object is created up front by reserve(), acquire() hands one out and
+ * release() gives it back, so the steady state never touches the allocator.
+ * acquire() waits while all objects are in use, which also bounds the number
+ * of blocks in flight. */
+template <typename T>
+class BufferPool {
+ private:
+  std::vector<std::unique_ptr<T>> objects;
+  std::vector<T*> free_objects;
+
+  std::mutex mutex;
+  std::condition_variable released;
+
+ public:
+  BufferPool() = default;
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  /* Grows the pool to count objects, each set up by init(T&) */
+  template <typename Init>
+  void reserve(size_t count, Init init) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->free_objects.reserve(count);
+    while (this->objects.size() < count) {
+      this->objects.push_back(std::make_unique<T>());
+      init(*this->objects.back());
+      this->free_objects.push_back(this->objects.back().get());
+    }
+  }
+
+  T* acquire() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->released.wait(lock, [this] { return !this->free_objects.empty(); });
+    T* object = this->free_objects.back();
+    this->free_objects.pop_back();
+    return object;
+  }
+
+  void release(T* object) {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->free_objects.push_back(object);
+    }
+    this->released.notify_one();
+  }
+
+  size_t size() const { return this->objects.size(); }
+};
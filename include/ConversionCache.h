@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "Audio2ImageStatus.h"
+#include "SpectralMatrix.h"
+#include "common.h"
+
+/* On-disk cache of audio to image conversions, see
+ * BasicAudio2Image::set_cache.
+ *
+ * Entries are keyed by a 64-bit XXH64 hash of the input file's bytes and of
+ * the converter parameters, so a renamed or touched file still hits and an
+ * edited one never does. Each entry is <key>.image, the raw pixels and the
+ * conversion status, plus <key>.matrix, a finished data matrix, for
+ * high-fidelity conversions.
+ *
+ * Several processes may share a directory: files are written under a
+ * temporary name and renamed into place, so readers only ever see whole
+ * entries, and evictions are serialized with flock. Hits refresh the
+ * modification time and eviction removes the least recently used entries
+ * once the directory holds more than max_bytes. */
+class ConversionCache {
+ private:
+  const std::string DIRECTORY;
+  const uint64_t MAX_BYTES;
+
+  std::atomic<uint64_t> temporary_count{0};
+
+  std::string entry_filename(uint64_t key, const char* extension) const;
+  std::string temporary_filename(const std::string& filename);
+
+  bool write_image(const std::string& filename, const cv::Mat& image,
+                   AUDIO2IMAGE_RET_T status) const;
+  std::optional<AUDIO2IMAGE_RET_T> read_image(const std::string& filename,
+                                              cv::Mat& image) const;
+
+  void evict();
+
+ public:
+  /* The directory is created if needed */
+  ConversionCache(std::string directory, uint64_t max_bytes);
+
+  ConversionCache(const ConversionCache&) = delete;
+  ConversionCache& operator=(const ConversionCache&) = delete;
+
+  /* Hash of the contents of filename, seeded with parameters. std::nullopt
+   * if the file cannot be read. */
+  static std::optional<uint64_t> make_key(const std::string& filename,
+                                          const std::string& parameters);
+
+  /* The image and status stored under key, std::nullopt on a miss. An entry
+   * that store() could not have written, e.g. a corrupt one, misses. With a
+   * data_matrix, only entries holding spectra hit and they are copied into
+   * it. */
+  std::optional<AUDIO2IMAGE_RET_T> load(uint64_t key, cv::Mat& image,
+                                        SpectralMatrixWriter* data_matrix);
+
+  /* Stores a conversion and the spectra written to data_matrix, if any,
+   * then evicts down to max_bytes. Only CV_8UC3 images of a GOOD_CONVERSION
+   * or UNFILLED_MATRIX are stored. False if nothing was stored. */
+  bool store(uint64_t key, const cv::Mat& image, AUDIO2IMAGE_RET_T status,
+             const SpectralMatrixWriter* data_matrix);
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Audio2Image.h"
+#include "AudioVisualFilters.h"
+#include "Image2Audio.h"
+#include "common.h"
+
+/* Long-lived conversion service on a local Unix domain socket.
+ *
+ * Process start, library initialization and FFT planning are paid once: the
+ * converters, their plans and buffers and the filter chain live as long as
+ * the server, and FFTW wisdom is imported on construction and saved back so
+ * the next start skips planning too.
+ *
+ * Requests are single lines of whitespace separated fields, quoted if they
+ * hold spaces, and a connection may send any number of them:
+ *
+ *   image <audio file> <output image> [clip start sec]
+ *   filter <input image> <output image> <filter>...
+ *   audio <input image> <output WAV or FLAC>
+ *   quit                 closes the connection
+ *   shutdown             stops the server
+ *
+ * with filters low_pass:<Hz>, high_pass:<Hz> or scale:<factor>, each
+ * optionally followed by :<start sec>:<end sec>. Every request is answered
+ * with "OK <status>" or "ERROR <status>", the numeric status of the
+ * conversion, or "ERROR <message>" for a malformed request. An output image
+ * of "-" is streamed back as PNG instead: "OK <status> <bytes>" followed by
+ * the encoded bytes.
+ *
+ * Connections are served one at a time, each conversion already uses every
+ * core. */
+template <typename Config>
+class BasicConversionServer {
+ private:
+  const std::string SOCKET_PATH;
+  const std::string WISDOM_FILENAME;
+
+  int listen_fd = -1;
+  std::atomic<bool> stop_requested{false};
+
+  // Warm between requests, built once the wisdom is imported
+  std::unique_ptr<BasicAudio2Image<Config>> audio2image;
+  std::unique_ptr<BasicImage2Audio<Config>> image2audio;
+  BasicFilterChain<Config> filter_chain;
+
+  void serve_connection(int connection_fd);
+
+  bool handle_request(int connection_fd,
+                      const std::vector<std::string>& fields);
+
+  bool reply_image(int connection_fd, const std::string& output_filename,
+                   const cv::Mat& image, int status);
+
+  bool convert_audio(int connection_fd,
+                     const std::vector<std::string>& fields);
+
+  bool filter_image(int connection_fd,
+                    const std::vector<std::string>& fields);
+
+  bool render_audio(int connection_fd,
+                    const std::vector<std::string>& fields);
+
+ public:
+  /* An empty wisdom_filename plans from scratch and saves nothing */
+  explicit BasicConversionServer(std::string socket_path,
+                                 std::string wisdom_filename = "");
+  ~BasicConversionServer();
+
+  BasicConversionServer(const BasicConversionServer&) = delete;
+  BasicConversionServer& operator=(const BasicConversionServer&) = delete;
+
+  /* Binds and listens, replacing a stale socket file. False on failure. */
+  bool start();
+
+  /* Serves connections until stop() or a shutdown request */
+  void run();
+
+  /* Makes run() return after the current connection. Async-signal-safe. */
+  void stop();
+};
+
+extern template class BasicConversionServer<Audio2ImageConfig<44100>>;
+extern template class BasicConversionServer<Audio2ImageConfig<48000>>;
+extern template class BasicConversionServer<Audio2ImageConfig<96000>>;
+
+using ConversionServer =
+    BasicConversionServer<Audio2ImageConfig<CD_AUDIO_FILE_FREQUENCY_HZ>>;
+using ConversionServer48kHz = BasicConversionServer<Audio2ImageConfig<48000>>;
+using ConversionServer96kHz = BasicConversionServer<Audio2ImageConfig<96000>>;
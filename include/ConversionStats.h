@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/* Per-stage timings and counters of a conversion, see
+ * BasicAudio2Image::set_stats.
+ *
+ * Only compiled in when AUDIOVISUAL_CONVERSION_STATS is defined (CMake option
+ * of the same name, on by default), otherwise the timers and counters fold
+ * away and the struct stays zero. Collection costs two steady_clock reads per
+ * stage per packet or frame. */
+#if defined(AUDIOVISUAL_CONVERSION_STATS)
+inline constexpr bool CONVERSION_STATS_ENABLED = true;
+#else
+inline constexpr bool CONVERSION_STATS_ENABLED = false;
+#endif
+
+struct ConversionStats {
+  using Duration = std::chrono::steady_clock::duration;
+
+  // Worker stages are summed over the FFT workers, so they can exceed the
+  // wall time of the conversion
+  Duration demux{};
+  Duration decode{};  // codec, or the float conversion of mapped PCM
+  Duration resample{};
+  Duration fft{};        // loading and windowing segments, then the FFT
+  Duration normalize{};  // averaging and mapping to pixel values
+  Duration pixel_write{};
+
+  uint64_t packets = 0;
+  uint64_t frames = 0;   // decoded codec frames
+  uint64_t samples = 0;          // samples decoded or read, all channels
+  uint64_t dropped_samples = 0;  // of those, past the end of the image
+
+  void merge(const ConversionStats& other) {
+    this->demux += other.demux;
+    this->decode += other.decode;
+    this->resample += other.resample;
+    this->fft += other.fft;
+    this->normalize += other.normalize;
+    this->pixel_write += other.pixel_write;
+    this->packets += other.packets;
+    this->frames += other.frames;
+    this->samples += other.samples;
+    this->dropped_samples += other.dropped_samples;
+  }
+};
+
+/* Splits time between stages of stats: lap() adds the time since the last
+ * lap or restart() to a stage. Does nothing without stats. */
+class StageClock {
+ private:
+  ConversionStats* stats;
+  std::chrono::steady_clock::time_point last;
+
+ public:
+  explicit StageClock(ConversionStats* stats) : stats(stats) {
+    this->restart();
+  }
+
+  void restart() {
+    if (CONVERSION_STATS_ENABLED && this->stats) {
+      this->last = std::chrono::steady_clock::now();
+    }
+  }
+
+  void lap(ConversionStats::Duration ConversionStats::*stage) {
+    if (CONVERSION_STATS_ENABLED && this->stats) {
+      const auto now = std::chrono::steady_clock::now();
+      this->stats->*stage += now - this->last;
+      this->last = now;
+    }
+  }
+};
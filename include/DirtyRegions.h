@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/* Cells [first_cell, end_cell) of an image, in row-major (time) order */
+struct CellRange {
+  int first_cell = 0;
+  int end_cell = 0;
+};
+
+/* Cells of an image changed since its audio was last rendered.
+ *
+ * Ranges are kept sorted, with overlapping and touching ones merged, so every
+ * changed cell is re-synthesized exactly once. Filled by
+ * BasicFilterChain::apply and consumed by BasicImage2Audio::update_audio. */
+class DirtyRegions {
+ private:
+  std::vector<CellRange> dirty_ranges;
+
+ public:
+  void mark(int first_cell, int end_cell) {
+    if (first_cell >= end_cell) {
+      return;
+    }
+
+    auto it = std::lower_bound(
+        this->dirty_ranges.begin(), this->dirty_ranges.end(), first_cell,
+        [](const CellRange& range, int cell) { return range.end_cell < cell; });
+    auto last = it;
+    while (last != this->dirty_ranges.end() && last->first_cell <= end_cell) {
+      first_cell = std::min(first_cell, last->first_cell);
+      end_cell = std::max(end_cell, last->end_cell);
+      ++last;
+    }
+
+    it = this->dirty_ranges.erase(it, last);
+    this->dirty_ranges.insert(it, CellRange{first_cell, end_cell});
+  }
+
+  const std::vector<CellRange>& ranges() const { return this->dirty_ranges; }
+
+  bool empty() const { return this->dirty_ranges.empty(); }
+
+  int64_t num_cells() const {
+    int64_t count = 0;
+    for (const CellRange& range : this->dirty_ranges) {
+      count += range.end_cell - range.first_cell;
+    }
+    return count;
+  }
+
+  void clear() { this->dirty_ranges.clear(); }
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+
+#include "common.h"
+
+/* Batched real-to-complex FFT over a fixed number of equally sized segments.
+ *
+ * The plan and its aligned buffers are created once, on construction, and
+ * reused by every call to execute(), so the per-frame cost is the transform
+ * itself. Planning can be skipped entirely by importing FFTW wisdom saved by a
+ * previous run.
+ *
+ * The spectra come out split into real and imaginary arrays, bin-major:
+ * bin k of segment s is at [k * num_segments() + s], so the SIMD kernels can
+ * process several segments per instruction. */
+class FFTEngine {
+ private:
+  const int SEGMENT_SIZE;
+  const int NUM_SEGMENTS;
+  const int NUM_BINS;  // SEGMENT_SIZE / 2 + 1 (non-redundant half spectrum)
+
+  double* in = nullptr;         // NUM_SEGMENTS * SEGMENT_SIZE real samples
+  double* real_out = nullptr;   // NUM_BINS * NUM_SEGMENTS, bin-major
+  double* imag_out = nullptr;
+  fftw_plan plan = nullptr;
+
+ public:
+  FFTEngine(int segment_size, int num_segments,
+            unsigned planner_flags = FFTW_MEASURE);
+  ~FFTEngine();
+
+  FFTEngine(const FFTEngine&) = delete;
+  FFTEngine& operator=(const FFTEngine&) = delete;
+
+  /* Input buffer, segment i starts at input() + i * segment_size() */
+  double* input() { return this->in; }
+
+  /* Half spectra of all segments, valid after execute() */
+  const double* real_output() const { return this->real_out; }
+  const double* imag_output() const { return this->imag_out; }
+
+  int segment_size() const { return this->SEGMENT_SIZE; }
+  int num_segments() const { return this->NUM_SEGMENTS; }
+  int num_bins() const { return this->NUM_BINS; }
+
+  /* Transform all segments with a single plan execution */
+  void execute();
+
+  static bool import_wisdom(const std::string& filename);
+  static bool export_wisdom(const std::string& filename);
+};
@@ -1,7 +1,141 @@
-/**
- * Implement the following Image2Audio conversion
- * 
- * quality: measure of frequency in output (input to determine resolution of A*sin(w*t))
- * - export_image_to_audio_file(image, filename, quality)
- * - image_to_audio(image, audio_t, quality)
- */
\ No newline at end of file
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "Audio2Image.h"
+#include "AudioVisualFilters.h"
+#include "AudioFileEncoder.h"
+#include "BoundedQueue.h"
+#include "BufferPool.h"
+#include "DirtyRegions.h"
+#include "Image2AudioStatus.h"
+#include "SpectralKernels.h"
+#include "SpectralMatrix.h"
+#include "common.h"
+
+/* Mono float signal rendered from an image */
+struct AudioBuffer {
+  int sample_rate_hz = 0;
+  std::vector<float> samples;
+};
+
+/* Low-fidelity image to audio conversion for images made by the
+ * BasicAudio2Image of the same Config.
+ *
+ * Every cell (pixel) becomes one segment of A * sin(2 pi F n): F is read back
+ * from blue and A from red, inverting normalize_to_pixel_values_batch. The
+ * oscillator phase carries over from one cell to the next, so segment
+ * boundaries do not click.
+ *
+ * Rows are decoded and rendered in parallel with cv::parallel_for_, straight
+ * into their slice of the output buffer. Only the phase offset of every row
+ * is found serially, from the per-row phase advances. Exports render a few
+ * rows at a time and hand them to an encoder thread, so synthesis overlaps
+ * compression and the signal is never held in memory as a whole.
+ *
+ * The oscillators of the last render are kept, so after an edit only the
+ * dirty cells are decoded and rendered again, spliced into the previous
+ * render and, for WAV, patched into the exported file. */
+template <typename Config>
+class BasicImage2Audio {
+ private:
+  static constexpr int IMAGE_SIZE_X_PIXELS = Config::IMAGE_SIZE_X_PIXELS;
+  static constexpr int IMAGE_SIZE_Y_PIXELS = Config::IMAGE_SIZE_Y_PIXELS;
+  static constexpr int TOTAL_PIXELS = IMAGE_SIZE_X_PIXELS * IMAGE_SIZE_Y_PIXELS;
+
+  static constexpr int SAMPLE_RATE_HZ = Config::SAMPLE_RATE_HZ;
+  static constexpr int NUM_SAMPLES_PER_SEGMENT =
+      Config::NUM_SAMPLES_PER_SEGMENT;
+
+  static constexpr int MAX_QUALITY = 16;
+
+  // Rows rendered per exported chunk, and chunks waiting for the encoder
+  static constexpr int ROWS_PER_CHUNK = 16;
+  const size_t CHUNK_QUEUE_CAPACITY = 4;
+
+  // Pixel value to oscillator parameter
+  std::array<float, 256> blue_to_frequency_hz;
+  std::array<float, 256> red_to_amplitude;
+
+  // Oscillator of every cell, reused by every render
+  std::vector<float> start_phase;      // turns
+  std::vector<float> phase_increment;  // turns per sample
+  std::vector<float> amplitude;
+  std::vector<double> row_start_phase;  // turns
+
+  // Quality of the render the oscillators belong to, 0 if none
+  int rendered_quality = 0;
+
+  // Exported chunks, a full queue plus the one being encoded and rendered
+  BufferPool<std::vector<float>> chunk_pool;
+
+  IMAGE2AUDIO_RET_T check_input(const cv::Mat& image, int quality);
+
+  void decode_cell(const cv::Vec3b& pixel, int cell, int output_sample_rate_hz);
+
+  void decode_rows(const cv::Mat& image, const cv::Range& rows,
+                   int output_sample_rate_hz, int samples_per_cell);
+
+  void prepare_oscillators(const cv::Mat& image, int output_sample_rate_hz,
+                           int samples_per_cell);
+
+  /* out holds the samples of the rows from first_row on */
+  void render_rows(const cv::Range& rows, int samples_per_cell, int first_row,
+                   float* out);
+
+  /* out holds the whole render */
+  void resynthesize_cells(const cv::Mat& image, const CellRange& cells,
+                          int output_sample_rate_hz, int samples_per_cell,
+                          float* out);
+
+ public:
+  BasicImage2Audio();
+
+  /* Renders the image at quality * SAMPLE_RATE_HZ, so a higher quality
+   * resolves A*sin(w*t) with more samples per cell for the same duration.
+   * audio.samples keeps its buffer when it already has the right size. */
+  IMAGE2AUDIO_RET_T image_to_audio(const cv::Mat& image, AudioBuffer& audio,
+                                   int quality = 1);
+
+  /* Streams the same signal into a 16-bit mono WAV or FLAC file, picked by
+   * the extension. Memory stays bounded by a few chunks of rows whatever the
+   * quality. */
+  IMAGE2AUDIO_RET_T export_image_to_audio_file(const cv::Mat& image,
+                                               std::string filename,
+                                               int quality = 1);
+
+  /* High-fidelity rendering: every segment of the data matrix is brought
+   * back to samples with an inverse DFT, after the filters' gains, if any.
+   * Spectra are read one chunk at a time, in parallel, straight from the
+   * mapping. */
+  IMAGE2AUDIO_RET_T data_matrix_to_audio(
+      const SpectralMatrix& data_matrix, AudioBuffer& audio,
+      const BasicFilterChain<Config>* filters = nullptr);
+
+  /* Brings audio, the last render of this converter, up to date with the
+   * dirty cells of the image. Each dirty range starts on the phase the
+   * previous render had there and its frequencies are nudged so it ends on
+   * the phase of the next clean cell, so the splices do not click. Falls
+   * back to a full render when audio is not that render. The caller clears
+   * dirty afterwards. */
+  IMAGE2AUDIO_RET_T update_audio(const cv::Mat& image,
+                                 const DirtyRegions& dirty, AudioBuffer& audio,
+                                 int quality = 1);
+
+  /* Rewrites the dirty spans of a WAV file exported from audio, in place.
+   * CANNOT_PATCH_AUDIO_FILE means it has to be exported again, e.g. FLAC or
+   * a file of another length or format. */
+  IMAGE2AUDIO_RET_T patch_exported_file(const std::string& filename,
+                                        const AudioBuffer& audio,
+                                        const DirtyRegions& dirty);
+};
+
+extern template class BasicImage2Audio<Audio2ImageConfig<44100>>;
+extern template class BasicImage2Audio<Audio2ImageConfig<48000>>;
+extern template class BasicImage2Audio<Audio2ImageConfig<96000>>;
+
+using Image2Audio =
+    BasicImage2Audio<Audio2ImageConfig<CD_AUDIO_FILE_FREQUENCY_HZ>>;
+using Image2Audio48kHz = BasicImage2Audio<Audio2ImageConfig<48000>>;
+using Image2Audio96kHz = BasicImage2Audio<Audio2ImageConfig<96000>>;
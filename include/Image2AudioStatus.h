@@ -0,0 +1,23 @@
+#pragma once
+
+enum class IMAGE2AUDIO_RET_T {
+  GOOD_IMAGE2AUDIO,
+  GOOD_EXPORT,
+
+  INVALID_IMAGE,
+  INVALID_QUALITY,
+  INVALID_AUDIO_FILE_TYPE,
+  INVALID_DATA_MATRIX,
+
+  FFMPEG_ERROR_CREATING_OUTPUT,
+  FFMPEG_ENCODER_NOT_FOUND,
+  FFMPEG_CANNOT_OPEN_ENCODER,
+  FFMPEG_ERROR_OPENING_OUTPUT_FILE,
+  FFMPEG_ERROR_WRITING_HEADER,
+  FFMPEG_ERROR_ENCODING_FRAME,
+  FFMPEG_ERROR_WRITING_PACKET,
+  FFMPEG_ERROR_WRITING_TRAILER,
+
+  CANNOT_PATCH_AUDIO_FILE,
+  ERROR_WRITING_AUDIO_FILE,
+};
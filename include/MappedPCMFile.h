@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "common.h"
+
+enum class PCM_ENCODING_T {
+  UNSIGNED_8,  // WAV
+  SIGNED_8,    // AIFF
+  SIGNED_16,
+  SIGNED_24,
+  SIGNED_32,
+  FLOAT_32,
+};
+
+/* Interleaved PCM samples as they lie in the mapped file, nothing copied */
+struct PCMView {
+  const uint8_t* data = nullptr;  // first byte of the first frame
+  int64_t num_frames = 0;
+  int channels = 0;
+  int frame_stride = 0;  // bytes from one frame to the next
+  int sample_rate = 0;
+  PCM_ENCODING_T encoding = PCM_ENCODING_T::SIGNED_16;
+  bool big_endian = false;
+};
+
+/* Uncompressed WAV/AIFF file read straight from a memory mapping.
+ *
+ * Only the RIFF/FORM headers are parsed; samples are converted to float on
+ * demand from the mapping, without going through libavformat. open() returns
+ * false for anything it does not understand (FLAC, compressed AIFC,
+ * WAVE_FORMAT_EXTENSIBLE with a non-PCM subformat...) so the caller can fall
+ * back to FFmpeg. */
+class MappedPCMFile {
+ private:
+  void* mapping = nullptr;
+  size_t mapping_size = 0;
+  PCMView pcm;
+
+  bool parse_wav(const uint8_t* file, size_t size);
+  bool parse_aiff(const uint8_t* file, size_t size);
+
+ public:
+  MappedPCMFile() = default;
+  ~MappedPCMFile();
+
+  MappedPCMFile(const MappedPCMFile&) = delete;
+  MappedPCMFile& operator=(const MappedPCMFile&) = delete;
+
+  bool open(const std::string& filename);
+  void close();
+
+  const PCMView& view() const { return this->pcm; }
+
+  /* Byte offset of the first frame in the file */
+  int64_t data_offset() const {
+    return this->pcm.data - static_cast<const uint8_t*>(this->mapping);
+  }
+  double duration() const {
+    return static_cast<double>(this->pcm.num_frames) / this->pcm.sample_rate;
+  }
+
+  /* Convert frames [first_frame, first_frame + num_frames) to mono float,
+   * averaging the channels. Frames past the end of the file read as 0.
+   * Packed little-endian mono and stereo 16-bit, 32-bit and float files are
+   * converted with SSE2; 8 and 24-bit, big-endian and more than two channels
+   * take a scalar loop. */
+  void read_mono(int64_t first_frame, int num_frames, float* out) const;
+
+  /* Same range of channel alone, deinterleaved to float */
+  void read_channel(int64_t first_frame, int num_frames, int channel,
+                    float* out) const;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include "Audio2ImageStatus.h"
+#include "common.h"
+
+/* An audio file, or the soundtrack of a video, opened and probed once.
+ *
+ * Holds the demuxer, the selected audio stream and its opened decoder so the
+ * duration check, the clip seek and the conversion all share a single
+ * avformat_open_input/avformat_find_stream_info. Every other stream is
+ * discarded, the demuxer skips their packets instead of returning them. */
+class MediaSession {
+ private:
+  AVFormatContext* format_ctx = nullptr;
+  AVCodecContext* codec_ctx = nullptr;
+  AVStream* audio_stream = nullptr;
+
+  double duration_sec = -1.0;
+
+ public:
+  MediaSession() = default;
+  ~MediaSession();
+
+  MediaSession(const MediaSession&) = delete;
+  MediaSession& operator=(const MediaSession&) = delete;
+
+  AUDIO2IMAGE_RET_T open(const std::string& filename);
+  void close();
+
+  /* Position the demuxer at start_sec and reset the decoder */
+  AUDIO2IMAGE_RET_T seek(double start_sec);
+
+  bool is_open() const { return this->codec_ctx != nullptr; }
+
+  AVFormatContext* format_context() { return this->format_ctx; }
+  AVCodecContext* codec_context() { return this->codec_ctx; }
+  AVStream* stream() { return this->audio_stream; }
+  int stream_index() const { return this->audio_stream->index; }
+
+  double duration() const { return this->duration_sec; }
+  int sample_rate() const { return this->codec_ctx->sample_rate; }
+  int channels() const { return this->codec_ctx->channels; }
+  AVSampleFormat sample_format() const { return this->codec_ctx->sample_fmt; }
+};
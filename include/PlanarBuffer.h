@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+/* Float samples of several channels, one plane per channel, in a single
+ * allocation where every plane starts on its own cache line.
+ *
+ * Resampler output of the decode loop: swresample writes the planes
+ * directly, and the per-channel STFT framing then streams each plane
+ * without sharing a line with its neighbours. Only grows, like the other
+ * buffers of the loop. */
+class PlanarBuffer {
+ private:
+  static constexpr size_t CACHE_LINE_BYTES = 64;
+  static constexpr size_t FLOATS_PER_LINE = CACHE_LINE_BYTES / sizeof(float);
+
+  struct FreeDeleter {
+    void operator()(float* data) const { std::free(data); }
+  };
+
+  std::unique_ptr<float, FreeDeleter> data;
+  size_t capacity = 0;      // floats allocated
+  size_t plane_stride = 0;  // floats from one plane to the next
+  std::vector<uint8_t*> plane_pointers;
+
+ public:
+  PlanarBuffer() = default;
+
+  /* Room for num_planes planes of num_samples each, keeping the allocation
+   * when it is already large enough. Contents are not preserved. */
+  void reserve(int num_planes, size_t num_samples) {
+    // Whole cache lines per plane keep the next plane aligned
+    this->plane_stride =
+        (num_samples + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE *
+        FLOATS_PER_LINE;
+    const size_t needed = this->plane_stride * num_planes;
+    if (needed > this->capacity) {
+      this->data.reset(static_cast<float*>(
+          std::aligned_alloc(CACHE_LINE_BYTES, needed * sizeof(float))));
+      this->capacity = needed;
+    }
+
+    this->plane_pointers.resize(num_planes);
+    for (int i = 0; i < num_planes; ++i) {
+      this->plane_pointers[i] = reinterpret_cast<uint8_t*>(this->plane(i));
+    }
+  }
+
+  int num_planes() const {
+    return static_cast<int>(this->plane_pointers.size());
+  }
+  size_t plane_size() const { return this->plane_stride; }
+
+  float* plane(int i) { return this->data.get() + i * this->plane_stride; }
+
+  /* Output array in the form swr_convert takes it */
+  uint8_t** planes() { return this->plane_pointers.data(); }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/* Fixed-capacity FIFO of samples between the decoder and the STFT framing.
+ *
+ * Codec frames of any size go in, analysis frames come out as contiguous
+ * copies, and the overlap between consecutive analysis frames simply stays
+ * in the ring until the next one is taken. Single-threaded, the decode loop
+ * owns it. */
+class SampleRing {
+ private:
+  std::vector<float> samples;
+  size_t read_position = 0;
+  size_t count = 0;
+
+ public:
+  SampleRing() = default;
+
+  /* Allocates the ring, dropping its contents */
+  void reserve(size_t capacity) {
+    this->samples.assign(capacity, 0.0f);
+    this->clear();
+  }
+
+  void clear() {
+    this->read_position = 0;
+    this->count = 0;
+  }
+
+  size_t size() const { return this->count; }
+  size_t capacity() const { return this->samples.size(); }
+
+  /* Appends as many samples as fit, returns how many */
+  size_t write(const float* input, size_t num_samples) {
+    num_samples = std::min(num_samples, this->capacity() - this->count);
+    if (num_samples == 0) {
+      return 0;
+    }
+
+    size_t write_position =
+        (this->read_position + this->count) % this->capacity();
+    for (size_t done = 0; done < num_samples;) {
+      const size_t chunk = std::min(num_samples - done,
+                                    this->capacity() - write_position);
+      std::copy_n(input + done, chunk, this->samples.begin() + write_position);
+      done += chunk;
+      write_position = 0;
+    }
+    this->count += num_samples;
+    return num_samples;
+  }
+
+  /* Copies the oldest num_samples, at most size(), without removing them */
+  void peek(float* output, size_t num_samples) const {
+    size_t position = this->read_position;
+    for (size_t done = 0; done < num_samples;) {
+      const size_t chunk =
+          std::min(num_samples - done, this->capacity() - position);
+      std::copy_n(this->samples.begin() + position, chunk, output + done);
+      done += chunk;
+      position = 0;
+    }
+  }
+
+  /* Drops the oldest num_samples, at most size() */
+  void discard(size_t num_samples) {
+    num_samples = std::min(num_samples, this->count);
+    this->read_position = (this->read_position + num_samples) %
+                          std::max<size_t>(1, this->capacity());
+    this->count -= num_samples;
+  }
+};
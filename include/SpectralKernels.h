@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+/* Batched spectral reduction, pixel normalization, sine synthesis and pixel
+ * filtering.
+ *
+ * All kernels work on a whole frame at once in structure-of-arrays layout and
+ * pick an AVX2, SSE2 or scalar implementation at runtime. */
+
+/* Spectra are bin-major: bin k of segment s is real[k * num_segments + s].
+ * For every segment, writes the magnitude-weighted mean bin index over bins
+ * [0, num_bins) and the mean magnitude of those bins. */
+void compute_average_frequency_and_amplitude_batch(const double* real,
+                                                   const double* imag,
+                                                   int num_segments,
+                                                   int num_bins,
+                                                   double* average_frequency,
+                                                   double* average_amplitude);
+
+/* Red is a log2 level of amplitude over the RED_AMPLITUDE_OCTAVES below full
+ * scale: 255 at |amplitude| 1, one level per 1/RED_LEVELS_PER_OCTAVE octave,
+ * 0 at 2^-16 (about -96 dB) and below */
+inline constexpr float RED_AMPLITUDE_OCTAVES = 16.0f;
+inline constexpr float RED_LEVELS_PER_OCTAVE = 255.0f / RED_AMPLITUDE_OCTAVES;
+
+/* Maps frequency to blue as frequency * frequency_scale and amplitude to red
+ * as (log2(|amplitude| + 1e-10) + RED_AMPLITUDE_OCTAVES) *
+ * RED_LEVELS_PER_OCTAVE, both truncated and clamped to 0-255. Amplitudes
+ * outside [-1, 1] produce a black pixel and are counted in the return value.
+ *
+ * log2 is approximated by the exponent plus a degree 5 polynomial of the
+ * mantissa, with an absolute error below 2e-5 (under 0.0004 of a pixel level),
+ * so a red value can only differ from the exact mapping by one level, and only
+ * when the exact value lies that close to an integer. */
+int normalize_to_pixel_values_batch(const double* frequency,
+                                    const double* amplitude, int count,
+                                    double frequency_scale, uint8_t* blue,
+                                    uint8_t* red);
+
+/* Renders num_segments consecutive segments of samples_per_segment samples,
+ *   out[s * samples_per_segment + n] =
+ *       amplitude[s] * sin(2 pi (start_phase[s] + n * phase_increment[s]))
+ * with phases in turns, which must be non-negative. sin is a polynomial with
+ * an absolute error below 1e-7, float rounding of phases of a few turns
+ * dominates at around 5e-6 (-105 dB). */
+void synthesize_sine_segments_batch(const float* start_phase,
+                                    const float* phase_increment,
+                                    const float* amplitude, int num_segments,
+                                    int samples_per_segment, float* out);
+
+/* Filters count BGR pixels in place through a 256 entry table keyed on blue.
+ * Entry bits 0-7 are added to red, bits 8-15 subtracted from it, saturating
+ * to 0-255, and bit 16 clear turns the pixel black. */
+void apply_filter_lut_span(uint8_t* bgr, int count, const uint32_t* lut);
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+/* How the bins of every segment are stored */
+enum class SPECTRUM_ENCODING_T : uint32_t {
+  FLOAT_32,   // re, im as float
+  FLOAT_16,   // re, im as IEEE half
+  QUANTIZED,  // float scale per segment, then re, im as int8 * scale / 127
+};
+
+/* High-fidelity data matrix D on disk, little-endian:
+ *
+ *   header      SpectralMatrixHeader, padded to DATA_ALIGNMENT
+ *   chunks      segments_per_chunk segments each, every chunk starting on a
+ *               page so it can be mapped, prefetched and dropped on its own
+ *   index       one SpectralChunkEntry per chunk
+ *
+ * Segment s holds the num_bins half spectrum of samples [s * N, (s + 1) * N),
+ * the same segment that became cell s of the image. */
+struct SpectralMatrixHeader {
+  char magic[8];
+  uint32_t version;
+  SPECTRUM_ENCODING_T encoding;
+  uint32_t sample_rate_hz;
+  uint32_t samples_per_segment;
+  uint32_t num_bins;
+  uint32_t segment_bytes;
+  uint32_t segments_per_chunk;
+  uint32_t reserved;
+  uint64_t chunk_stride;  // bytes from one chunk to the next
+  uint64_t data_offset;
+  uint64_t num_segments;
+  uint64_t index_offset;
+  uint64_t num_chunks;
+};
+
+struct SpectralChunkEntry {
+  uint64_t first_segment;
+  uint64_t offset;  // from the start of the file
+  uint32_t num_segments;
+  uint32_t bytes;
+};
+
+/* Writes D while the image is converted.
+ *
+ * Every segment has a fixed place in the file, so FFT workers write their
+ * frames in any order and concurrently, straight with pwrite. The length is
+ * whatever was written when finish() adds the index and the header. */
+class SpectralMatrixWriter {
+ private:
+  static constexpr int DEFAULT_SEGMENTS_PER_CHUNK = 4096;
+
+  int fd = -1;
+  SpectralMatrixHeader header{};
+  std::atomic<int64_t> end_segment{0};
+  std::atomic<bool> write_failed{false};
+
+  uint64_t segment_offset(int64_t segment) const;
+
+ public:
+  SpectralMatrixWriter() = default;
+  ~SpectralMatrixWriter();
+
+  SpectralMatrixWriter(const SpectralMatrixWriter&) = delete;
+  SpectralMatrixWriter& operator=(const SpectralMatrixWriter&) = delete;
+
+  bool open(const std::string& filename, int sample_rate_hz,
+            int samples_per_segment,
+            SPECTRUM_ENCODING_T encoding = SPECTRUM_ENCODING_T::FLOAT_32,
+            int segments_per_chunk = DEFAULT_SEGMENTS_PER_CHUNK);
+
+  /* Spectra in FFTEngine layout, bin k of segment s at [k * stride + s].
+   * encoded is the caller's scratch, reused across calls. Thread safe. */
+  void write_segments(int64_t first_segment, int num_segments,
+                      const double* real, const double* imag, int stride,
+                      std::vector<uint8_t>& encoded);
+
+  /* False once any write failed */
+  bool good() const { return this->fd >= 0 && !this->write_failed; }
+
+  /* Saves what was written so far as a finished file, this writer stays
+   * open. Thread safe once the writes are done. */
+  bool save_copy(const std::string& filename) const;
+
+  /* Writes the segments of a finished file with the same layout (encoding,
+   * sample rate, segment size and chunk size) as if written here. False,
+   * with nothing written, if its header or index do not match that layout
+   * or the file; false too if it ends early. */
+  bool copy_segments_from(const std::string& filename);
+
+  bool finish();
+  void close();
+};
+
+/* D read straight from a memory mapping. Nothing is decoded until asked
+ * for, and only the pages of the chunks touched are ever read, so the size of
+ * the matrix does not matter. */
+class SpectralMatrix {
+ private:
+  void* mapping = nullptr;
+  size_t mapping_size = 0;
+  SpectralMatrixHeader header{};
+  const SpectralChunkEntry* chunk_index = nullptr;
+
+  const uint8_t* segment_data(int64_t segment) const;
+
+ public:
+  SpectralMatrix() = default;
+  ~SpectralMatrix();
+
+  SpectralMatrix(const SpectralMatrix&) = delete;
+  SpectralMatrix& operator=(const SpectralMatrix&) = delete;
+
+  bool open(const std::string& filename);
+  void close();
+
+  int sample_rate_hz() const { return this->header.sample_rate_hz; }
+  int samples_per_segment() const { return this->header.samples_per_segment; }
+  int num_bins() const { return this->header.num_bins; }
+  int64_t num_segments() const { return this->header.num_segments; }
+  int segments_per_chunk() const { return this->header.segments_per_chunk; }
+  SPECTRUM_ENCODING_T encoding() const { return this->header.encoding; }
+
+  /* Decodes segments [first_segment, first_segment + num_segments) as
+   * interleaved re, im pairs, num_bins per segment. Segments past the end
+   * read as 0. */
+  void read_segments(int64_t first_segment, int num_segments,
+                     float* out) const;
+
+  /* Asks the kernel to read the chunks of a range ahead of read_segments */
+  void prefetch(int64_t first_segment, int64_t num_segments) const;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "common.h"
+
+/* Audio image of any length, as a sequence of fixed-size tiles.
+ *
+ * Tile k holds cells [k * cells_per_tile(), (k + 1) * cells_per_tile()) in
+ * the usual row-major order, so a recording maps to tiles the way a clip maps
+ * to one image. Tiles are filled while the audio is decoded, by any number of
+ * FFT workers. Once a tile is complete and more than max_resident_tiles are
+ * in memory, the oldest complete ones are spilled to spill_directory and
+ * read back on demand; without a spill directory every tile stays in memory.
+ * Writers wait for a spill instead of growing past the limit. */
+class TiledAudioImage {
+ private:
+  struct Tile {
+    cv::Mat image;  // empty once spilled
+    std::atomic<int> written_cells{0};
+    bool complete = false;
+    bool spilling = false;
+    bool spilled = false;
+  };
+
+  const std::string SPILL_DIRECTORY;
+  const size_t MAX_RESIDENT_TILES;
+
+  int tile_cols = 0;
+  int tile_rows = 0;
+  int tile_cells = 0;
+  double seconds_per_cell = 0.0;
+
+  // Tiles are only appended, so references stay valid while workers write
+  std::deque<Tile> tiles;
+  size_t resident_tiles = 0;
+  bool spill_failed = false;  // then the limit is no longer enforced
+  int64_t total_cells = 0;
+  std::mutex tiles_mutex;
+  std::condition_variable tile_spilled;
+
+  std::string spill_filename(int64_t tile_index) const;
+
+  Tile& acquire_tile(int64_t tile_index);
+  void complete_tile(int64_t tile_index);
+  void spill_complete_tiles(std::unique_lock<std::mutex>& lock);
+  void remove_spill_files();
+
+ public:
+  /* max_resident_tiles is at least 2, the tiles a frame can straddle */
+  explicit TiledAudioImage(std::string spill_directory = "",
+                           size_t max_resident_tiles = 4);
+  ~TiledAudioImage();
+
+  TiledAudioImage(const TiledAudioImage&) = delete;
+  TiledAudioImage& operator=(const TiledAudioImage&) = delete;
+
+  /* Drops every tile and starts over with a new geometry */
+  void reset(int tile_cols, int tile_rows, double seconds_per_cell);
+
+  /* Writes cells [first_cell, first_cell + count). Thread safe as long as
+   * no two writers share a cell. */
+  void write_cells(int64_t first_cell, int count, const uint8_t* blue,
+                   const uint8_t* red);
+
+  /* Ends the image after num_cells cells, completing the last tile */
+  void finish(int64_t num_cells);
+
+  int64_t num_tiles() const {
+    return static_cast<int64_t>(this->tiles.size());
+  }
+  int cells_per_tile() const { return this->tile_cells; }
+  double tile_duration_sec() const {
+    return this->tile_cells * this->seconds_per_cell;
+  }
+  double duration_sec() const {
+    return this->total_cells * this->seconds_per_cell;
+  }
+
+  /* Tile and cell within the tile that hold the audio at seconds */
+  std::tuple<int64_t, int> locate(double seconds) const;
+
+  /* Tiles [first, end) covering [start_sec, end_sec) */
+  std::tuple<int64_t, int64_t> tiles_in_range(double start_sec,
+                                              double end_sec) const;
+
+  /* The tile itself while resident, otherwise a copy read back from disk.
+   * Empty if it does not exist or cannot be read. */
+  cv::Mat tile(int64_t tile_index);
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/* One deque of jobs per worker of a fixed-size pool.
+ *
+ * A worker takes jobs from the front of its own deque and, once that is
+ * empty, steals from the back of the others, so a few long jobs never leave
+ * the rest of the pool idle. Each deque has its own lock, workers only
+ * contend when stealing. */
+template <typename T>
+class WorkStealingQueues {
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<T> jobs;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+
+ public:
+  explicit WorkStealingQueues(size_t num_workers) {
+    for (size_t i = 0; i < std::max<size_t>(1, num_workers); ++i) {
+      this->queues.push_back(std::make_unique<Queue>());
+    }
+  }
+
+  WorkStealingQueues(const WorkStealingQueues&) = delete;
+  WorkStealingQueues& operator=(const WorkStealingQueues&) = delete;
+
+  size_t num_workers() const { return this->queues.size(); }
+
+  void push(size_t worker, T job) {
+    Queue& queue = *this->queues[worker % this->queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(std::move(job));
+  }
+
+  /* std::nullopt once every deque is empty */
+  std::optional<T> pop(size_t worker) {
+    const size_t num_queues = this->queues.size();
+    for (size_t i = 0; i < num_queues; ++i) {
+      Queue& queue = *this->queues[(worker + i) % num_queues];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.jobs.empty()) {
+        continue;
+      }
+
+      // Own jobs in order, stolen ones from the far end
+      T job;
+      if (i == 0) {
+        job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+      } else {
+        job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+      }
+      return job;
+    }
+    return std::nullopt;
+  }
+};
@@ -22,9 +22,12 @@ extern "C" {
 #include <opencv2/imgproc.hpp>
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
+#include <format>
 #include <iostream>
 #include <regex>
 #include <sstream>
+#include <string_view>
 #include <vector>
 
 #define CD_AUDIO_FILE_FREQUENCY_HZ 44100
@@ -41,6 +44,10 @@ struct CDAudioFormatsRegex {
                         std::regex::icase};
   const std::regex FLAC{R"((?:[\w\-\/\.]+\/)*[\w\-\.]+\.FLAC$)",
                         std::regex::icase};
+  // Containers whose soundtrack is demuxed on its own
+  const std::regex VIDEO{
+      R"((?:[\w\-\/\.]+\/)*[\w\-\.]+\.(?:MP4|M4A|MOV|MKV|WEBM|AVI)$)",
+      std::regex::icase};
 };
 
 static CDAudioFormatsRegex audio_file_regex;
@@ -51,23 +58,59 @@ static CDAudioFormatsRegex audio_file_regex;
 #define GREEN "\033[32m"
 #define RESET "\033[0m"
 
+/* Log levels, anything below LOG_MIN_LEVEL is compiled out together with the
+ * evaluation of its message. Override with -DLOG_MIN_LEVEL=LOG_LEVEL_<NAME>
+ * (CMake AUDIOVISUAL_LOG_LEVEL) */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#define LOG_RING_CAPACITY 1024  // queued lines, power of two
+#define LOG_MESSAGE_MAX_LENGTH 512
+
+#ifndef LOG_MIN_LEVEL
+#ifdef DEBUG_BUILD
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_ERROR
 #define LOG_ERROR(msg) log_message("ERROR", RED, __FILE__, __LINE__, __FUNCTION__, msg)
+#else
+#define LOG_ERROR(msg) ((void)0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARNING
 #define LOG_WARNING(msg) log_message("WARNING", YELLOW, __FILE__, __LINE__, __FUNCTION__, msg)
+#else
+#define LOG_WARNING(msg) ((void)0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
 #define LOG_INFO(msg) log_message("INFO", BLUE, __FILE__, __LINE__, __FUNCTION__, msg)
 #define LOG_SUCCESS(msg) log_message("INFO", GREEN, __FILE__, __LINE__, __FUNCTION__, msg)
+#else
+#define LOG_INFO(msg) ((void)0)
+#define LOG_SUCCESS(msg) ((void)0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(msg) log_message("DEBUG", RESET, __FILE__, __LINE__, __FUNCTION__, msg)
+#else
+#define LOG_DEBUG(msg) ((void)0)
+#endif
+
+/* Queues a log line for the background writer thread (src/common.cpp).
+ *
+ * Never blocks: the message is copied into a lock-free ring, truncated to
+ * LOG_MESSAGE_MAX_LENGTH, and dropped if the ring is full. The timestamp is
+ * formatted and the line written by the writer. */
+void log_message(const char* level, const char* color, const char* file,
+                 int line, const char* func, std::string_view msg);
 
-/* Function to log messages with additional context */
-inline void log_message(const std::string& level, const std::string& color,
-                        const std::string& file, int line, const std::string& func,
-                        const std::string& msg) {
-  std::time_t now = std::time(nullptr);
-  std::tm* tm_info = std::localtime(&now);
-  char timestamp[20];
-  std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-
-  // Print the log message with context and color
-  std::cout << "[" << timestamp << "] ["
-            << color << level << RESET << "] "
-            << "[" << file << ":" << line << "] "
-            << "[" << func << "] " << msg << std::endl;
-}
\ No newline at end of file
+/* Blocks until every line queued so far has been written to stdout */
+void flush_log();
@@ -4,385 +4,1030 @@
 =                 PRIVATE                  =
 ==========================================*/
 
-void Audio2Image::print_complex_fft(fftw_complex* out, int num_samples) {
-  std::vector<std::complex<double>> fft_result(num_samples);
-  for (int i = 0; i < num_samples; ++i) {
-    fft_result[i] = std::complex<double>(out[i][0], out[i][1]);
+template <typename Config>
+void BasicAudio2Image<Config>::print_complex_fft(
+    [[maybe_unused]] const FFTEngine& fft_engine,
+    [[maybe_unused]] int segment) {
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+  const int stride = fft_engine.num_segments();
+  for (int i = 0; i < fft_engine.num_bins(); ++i) {
+    LOG_DEBUG(std::format("Real: {} Imag: {}",
+                          fft_engine.real_output()[i * stride + segment],
+                          fft_engine.imag_output()[i * stride + segment]));
   }
+#endif
+}
 
-  for (const auto& cplx : fft_result) {
-    std::cout << "Real: " << cplx.real() << " Imag: " << cplx.imag()
-              << std::endl;
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::insert_codec_frame_to_image(
+    FFTEngine& fft_engine, FrameScratch& scratch, int first_pixel,
+    const float* audio_data, int num_samples, cv::Mat& result_image) {
+  StageClock clock(this->worker_stats(scratch));
+  const int available_samples = std::min(num_samples, this->frame_length());
+
+  // Load every segment of the frame, zero-padding a short last frame
+  double* in = fft_engine.input();
+  if (this->hop_size == this->NUM_SAMPLES_PER_SEGMENT &&
+      this->window.empty()) {
+    // Back to back rectangular segments are the frame itself
+    std::copy_n(audio_data, available_samples, in);
+    std::fill(in + available_samples, in + this->SAMPLES_PER_FRAME, 0.0);
+  } else {
+    for (int segment = 0; segment < this->SEGMENTS_PER_FRAME; ++segment) {
+      const int first_sample = segment * this->hop_size;
+      double* segment_in = in + segment * this->NUM_SAMPLES_PER_SEGMENT;
+      for (int n = 0; n < this->NUM_SAMPLES_PER_SEGMENT; ++n) {
+        const double sample = (first_sample + n < available_samples)
+                                  ? audio_data[first_sample + n]
+                                  : 0.0;
+        segment_in[n] =
+            this->window.empty() ? sample : sample * this->window[n];
+      }
+    }
   }
-}
 
-std::tuple<int, int> Audio2Image::normalize_to_pixel_values(
-    const double frequency, const double amplitude) {
-  if (amplitude < -1.0 || amplitude > 1.0) {
-    LOG_WARNING(std::format("Invalid amplitude value: {}", amplitude));
-    return std::make_tuple(std::numeric_limits<int>::min(),
-                           std::numeric_limits<int>::min());
+  // Transform all SEGMENTS_PER_FRAME windows in one execution
+  fft_engine.execute();
+  clock.lap(&ConversionStats::fft);
+
+  if (this->data_matrix) {
+    const int num_segments =
+        std::min(this->SEGMENTS_PER_FRAME, this->cell_limit - first_pixel);
+    this->data_matrix->write_segments(
+        first_pixel, num_segments, fft_engine.real_output(),
+        fft_engine.imag_output(), this->SEGMENTS_PER_FRAME,
+        scratch.encoded_spectra);
+    clock.lap(&ConversionStats::pixel_write);
   }
 
-  int frequency_value = static_cast<int>(
-      (frequency / MAX_FREQUENCY_IN_AUDIO_SIGNAL_HZ) * MAX_PIXEL_VALUE);
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+  for (int segment = 0; segment < this->SEGMENTS_PER_FRAME; ++segment) {
+    this->print_complex_fft(fft_engine, segment);
+  }
+#endif
+
+  // Average every window, then normalize the whole frame to pixel values
+  compute_average_frequency_and_amplitude_batch(
+      fft_engine.real_output(), fft_engine.imag_output(),
+      this->SEGMENTS_PER_FRAME, this->NUM_SAMPLES_PER_SEGMENT / 2,
+      scratch.average_frequency.data(), scratch.average_amplitude.data());
+
+  scratch.invalid_amplitudes += normalize_to_pixel_values_batch(
+      scratch.average_frequency.data(), scratch.average_amplitude.data(),
+      this->SEGMENTS_PER_FRAME,
+      this->BIN_TO_PIXEL, scratch.blue.data(), scratch.red.data());
+  clock.lap(&ConversionStats::normalize);
+
+  if (this->pyramid) {
+    this->pyramid->add_block(
+        first_pixel,
+        std::min(this->SEGMENTS_PER_FRAME, this->cell_limit - first_pixel),
+        scratch.average_frequency.data(), scratch.average_amplitude.data(),
+        scratch.pyramid_cells);
+  }
 
-  // Normalize amplitude to a 0-255 scale using a logarithmic scale
-  double normalized_amplitude = std::clamp(amplitude, -1.0, 1.0);
-  double log_amplitude =
-      std::log10(std::abs(normalized_amplitude) +
-                 1e-10);  // Prevent log(0) by adding a small epsilon
+  if (this->tile_sink) {
+    this->tile_sink->write_cells(first_pixel, this->SEGMENTS_PER_FRAME,
+                                 scratch.blue.data(), scratch.red.data());
+    clock.lap(&ConversionStats::pixel_write);
+    return AUDIO2IMAGE_RET_T::GOOD_FRAME_INSERTION_TO_IMAGE;
+  }
 
-  // Map the logarithmic value to the 0-255 scale
-  int amplitude_value =
-      static_cast<int>((log_amplitude * MAX_PIXEL_VALUE) /
-                       std::log10(2.0));  // Scale based on log10(2)
+  // The last frame may run past the image, its cells there are dropped
+  const int num_cells =
+      std::min(this->SEGMENTS_PER_FRAME, this->cell_limit - first_pixel);
+  for (int segment = 0; segment < num_cells; ++segment) {
+    // Every frame owns a fixed run of pixels, so workers never overlap
+    int pixel_count = first_pixel + segment;
+    int y_pixel = pixel_count / this->IMAGE_SIZE_X_PIXELS;
+    int x_pixel = pixel_count % this->IMAGE_SIZE_X_PIXELS;
 
-  amplitude_value = std::clamp(amplitude_value, 0, 255);
-  frequency_value = std::clamp(frequency_value, 0, 255);
+    // Set the pixel values in the result image
+    cv::Vec3b& pixel = result_image.at<cv::Vec3b>(y_pixel, x_pixel);
+    pixel[0] = scratch.blue[segment];  // Blue channel (normalized frequency)
+    pixel[1] = 0;                      // Green channel (unused)
+    pixel[2] = scratch.red[segment];   // Red channel (normalized amplitude)
+  }
+  clock.lap(&ConversionStats::pixel_write);
 
-  return std::make_tuple(frequency_value, amplitude_value);
+  return AUDIO2IMAGE_RET_T::GOOD_FRAME_INSERTION_TO_IMAGE;
 }
 
-AUDIO2IMAGE_RET_T Audio2Image::insert_codec_frame_to_image(
-    int& pixel_count,
-    std::vector<float>& audio_data, cv::Mat& result_image) {
-  // Create an FFT plan for a single segment
-  fftw_complex* in = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) *
-                                                this->NUM_SAMPLES_PER_SEGMENT);
-  fftw_complex* out = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) *
-                                                 this->NUM_SAMPLES_PER_SEGMENT);
-  fftw_plan p = fftw_plan_dft_1d(this->NUM_SAMPLES_PER_SEGMENT, in, out, FFTW_FORWARD,
-                                 FFTW_ESTIMATE);
-
-  // Process the FFT for each window (segment)
-  for (int frame_sec_increment = 0;
-       frame_sec_increment < this->SEGMENTS_PER_FRAME; ++frame_sec_increment) {
-    int window_start = frame_sec_increment * NUM_SAMPLES_PER_SEGMENT;
-
-    if (window_start + this->NUM_SAMPLES_PER_SEGMENT > this->NUM_SAMPLES_PER_SEGMENT * this->SEGMENTS_PER_FRAME) {
-      LOG_ERROR("Window exceeds audio_data range.");
-      return AUDIO2IMAGE_RET_T::UNFILLED_MATRIX;
+template <typename Config>
+void BasicAudio2Image<Config>::process_block(FFTEngine& fft_engine,
+                                             FrameScratch& scratch,
+                                             const SampleBlock& block,
+                                             cv::Mat& result_image) {
+  const int first_pixel = block.frame_index * this->SEGMENTS_PER_FRAME;
+  cv::Mat& image = this->target_image(block.channel, result_image);
+
+  if (block.pcm_file) {
+    // Straight from the mapping, the only copy is the float conversion
+    StageClock clock(this->worker_stats(scratch));
+    if (this->channel_images) {
+      block.pcm_file->read_channel(block.pcm_first_frame,
+                                   block.pcm_num_frames, block.channel,
+                                   scratch.pcm_samples.data());
+    } else {
+      block.pcm_file->read_mono(block.pcm_first_frame, block.pcm_num_frames,
+                                scratch.pcm_samples.data());
     }
+    clock.lap(&ConversionStats::decode);
+    this->insert_codec_frame_to_image(fft_engine, scratch, first_pixel,
+                                      scratch.pcm_samples.data(),
+                                      block.pcm_num_frames, image);
+  } else {
+    this->insert_codec_frame_to_image(
+        fft_engine, scratch, first_pixel, block.samples->data(),
+        static_cast<int>(block.samples->size()), image);
+    this->sample_pool.release(block.samples);
+  }
+}
 
-    // Extract the current sliding window of audio data (16 samples)
-    for (int i = 0; i < this->NUM_SAMPLES_PER_SEGMENT; ++i) {
-      in[i][0] = audio_data[window_start + i];  // Real part
-      in[i][1] = 0;                             // Imaginary part
-    }
+template <typename Config>
+void BasicAudio2Image<Config>::run_fft_worker(FFTEngine& fft_engine,
+                                              FrameScratch& scratch,
+                                              FramePipeline& pipeline,
+                                              cv::Mat& result_image) {
+  while (std::optional<SampleBlock> block = pipeline.block_queue.pop()) {
+    this->process_block(fft_engine, scratch, *block, result_image);
+  }
+}
 
-    // Execute the FFT for this window
-    fftw_execute(p);
+template <typename Config>
+void BasicAudio2Image<Config>::start_fft_workers(FramePipeline& pipeline,
+                                                 cv::Mat& result_image) {
+  for (FrameScratch& scratch : this->frame_scratches) {
+    scratch.invalid_amplitudes = 0;
+    scratch.stats = {};
+  }
 
-    this->print_complex_fft(out, this->NUM_SAMPLES_PER_SEGMENT);
+  // A single engine means no workers, blocks are processed on dispatch
+  if (this->fft_engines.size() <= 1) {
+    return;
+  }
 
-    // Compute the average frequency and amplitude for the current window
-    auto [average_frequency, average_amplitude] =
-        this->compute_average_frequency_and_amplitude(out,
-                                                      this->NUM_SAMPLES_PER_SEGMENT);
+  for (size_t i = 0; i < this->fft_engines.size(); ++i) {
+    pipeline.fft_workers.emplace_back(&BasicAudio2Image::run_fft_worker, this,
+                                      std::ref(*this->fft_engines[i]),
+                                      std::ref(this->frame_scratches[i]),
+                                      std::ref(pipeline),
+                                      std::ref(result_image));
+  }
+}
 
-    // Normalize the average frequency and amplitude to pixel values
-    auto [norm_average_frequency, norm_average_amplitude] =
-        this->normalize_to_pixel_values(average_frequency, average_amplitude);
+template <typename Config>
+void BasicAudio2Image<Config>::dispatch_block(FramePipeline& pipeline,
+                                              SampleBlock&& block,
+                                              cv::Mat& result_image) {
+  if (pipeline.fft_workers.empty()) {
+    this->process_block(*this->fft_engines.front(),
+                        this->frame_scratches.front(), block, result_image);
+  } else {
+    pipeline.block_queue.push(std::move(block));
+  }
+}
 
-    // Compute pixel coordinates based on pixel_count
-    int y_pixel = pixel_count / this->IMAGE_SIZE_X_PIXELS;
-    int x_pixel = pixel_count % this->IMAGE_SIZE_X_PIXELS;
+template <typename Config>
+void BasicAudio2Image<Config>::join_fft_workers(FramePipeline& pipeline) {
+  pipeline.block_queue.close();
+  for (std::thread& worker : pipeline.fft_workers) {
+    worker.join();
+  }
+  pipeline.fft_workers.clear();
 
-    // Check if the pixel is within bounds of the image
-    if (y_pixel >= this->IMAGE_SIZE_Y_PIXELS ||
-        x_pixel >= this->IMAGE_SIZE_X_PIXELS) {
-      LOG_ERROR("UNFILLED MATRIX");
-      return AUDIO2IMAGE_RET_T::UNFILLED_MATRIX;
+  int invalid_amplitudes = 0;
+  for (const FrameScratch& scratch : this->frame_scratches) {
+    invalid_amplitudes += scratch.invalid_amplitudes;
+    if (CONVERSION_STATS_ENABLED && this->stats) {
+      this->stats->merge(scratch.stats);
     }
+  }
+  if (invalid_amplitudes > 0) {
+    LOG_WARNING(
+        std::format("Invalid amplitude values: {}", invalid_amplitudes));
+  }
+}
 
-    // Set the pixel values in the result image
-    cv::Vec3b& pixel = result_image.at<cv::Vec3b>(y_pixel, x_pixel);
-    pixel[0] = norm_average_frequency;  // Blue channel (normalized frequency)
-    pixel[1] = 0;                       // Green channel (unused)
-    pixel[2] = norm_average_amplitude;  // Red channel (normalized amplitude)
-
-    // Increment pixel_count for the next iteration
-    pixel_count++;
+template <typename Config>
+int BasicAudio2Image<Config>::dispatch_frame_from_ring(
+    FramePipeline& pipeline, int channel, int frame_index, int num_samples,
+    cv::Mat& result_image) {
+  // Copied out contiguous, the overlap with the next frame stays in the ring
+  SampleRing& ring = this->sample_rings[channel];
+  std::vector<float>* samples = this->sample_pool.acquire();
+  samples->resize(num_samples);
+  ring.peek(samples->data(), num_samples);
+  ring.discard(this->frame_hop());
+
+  SampleBlock block{frame_index, samples};
+  block.channel = channel;
+  this->dispatch_block(pipeline, std::move(block), result_image);
+  return frame_index + 1;
+}
 
-    // Log the results for debugging
-    LOG_INFO(std::format(
-        "Norm average frequency: {}, and norm average amplitude: {}",
-        norm_average_frequency, norm_average_amplitude));
-    LOG_INFO(std::format("Cell X:{} Y:{} updated.", x_pixel, y_pixel));
+template <typename Config>
+int BasicAudio2Image<Config>::dispatch_samples(FramePipeline& pipeline,
+                                               int channel,
+                                               const float* samples,
+                                               int num_samples, int frame_index,
+                                               cv::Mat& result_image) {
+  // Frames are cut from the ring as soon as it holds one, independently of
+  // the codec frame size
+  SampleRing& ring = this->sample_rings[channel];
+  int consumed = 0;
+  while (consumed < num_samples && this->frame_fits(frame_index)) {
+    consumed += static_cast<int>(
+        ring.write(samples + consumed, num_samples - consumed));
+
+    while (static_cast<int>(ring.size()) >= this->frame_length() &&
+           this->frame_fits(frame_index)) {
+      frame_index = this->dispatch_frame_from_ring(
+          pipeline, channel, frame_index, this->frame_length(), result_image);
+    }
   }
 
-  // Clean up FFT resources
-  fftw_destroy_plan(p);
-  fftw_free(in);
-  fftw_free(out);
-
-  return AUDIO2IMAGE_RET_T::GOOD_FRAME_INSERTION_TO_IMAGE;
+  this->count_stat(&ConversionStats::samples, num_samples);
+  this->count_stat(&ConversionStats::dropped_samples, num_samples - consumed);
+  return frame_index;
 }
 
-double Audio2Image::get_audio_duration(const std::string filename) {
-  // Check if the file has a valid audio extension
-  if (!(std::regex_match(filename, audio_file_regex.WAV) ||
-        std::regex_match(filename, audio_file_regex.AIFF) ||
-        std::regex_match(filename, audio_file_regex.FLAC))) {
-    LOG_WARNING("Audio file did not match a valid extension.");
-    return -1.0;  // Invalid file format
+template <typename Config>
+int BasicAudio2Image<Config>::dispatch_output_samples(FramePipeline& pipeline,
+                                                      int num_samples,
+                                                      int frame_index,
+                                                      cv::Mat& result_image) {
+  // Every plane holds the same number of samples, so the channels cut their
+  // frames in lockstep and the workers pick them up side by side
+  int next_frame_index = frame_index;
+  for (int channel = 0; channel < this->num_output_channels; ++channel) {
+    next_frame_index = this->dispatch_samples(
+        pipeline, channel, this->output_samples.plane(channel), num_samples,
+        frame_index, result_image);
   }
+  return next_frame_index;
+}
 
-  // Initialize FFmpeg
-  AVFormatContext* format_ctx = nullptr;
-  if (avformat_open_input(&format_ctx, filename.c_str(), nullptr, nullptr) !=
-      0) {
-    LOG_ERROR("AVformat could not open file.");
-    return -1.0;
+template <typename Config>
+int BasicAudio2Image<Config>::flush_samples(FramePipeline& pipeline,
+                                            int frame_index,
+                                            cv::Mat& result_image) {
+  // The last partial frame is zero-padded, unless all it holds is the
+  // overlap already analyzed by the frame before
+  const int overlap = this->frame_length() - this->frame_hop();
+  int next_frame_index = frame_index;
+  for (int channel = 0; channel < this->num_output_channels; ++channel) {
+    SampleRing& ring = this->sample_rings[channel];
+    const int num_samples = static_cast<int>(ring.size());
+    if (this->frame_fits(frame_index) &&
+        num_samples > (frame_index > 0 ? overlap : 0)) {
+      next_frame_index = this->dispatch_frame_from_ring(
+          pipeline, channel, frame_index, num_samples, result_image);
+    } else if (frame_index > 0) {
+      this->count_stat(&ConversionStats::dropped_samples,
+                       std::max(0, num_samples - overlap));
+    }
+    ring.clear();
   }
+  return next_frame_index;
+}
 
-  // Retrieve stream info
-  if (avformat_find_stream_info(format_ctx, nullptr) < 0) {
-    LOG_ERROR("Error: Could not retrieve stream info");
-    avformat_close_input(&format_ctx);
-    return -1.0;
-  }
+template <typename Config>
+bool BasicAudio2Image<Config>::needs_resampling(
+    const MappedPCMFile& pcm_file) const {
+  return this->RESAMPLE_TO_SAMPLE_RATE &&
+         pcm_file.view().sample_rate != this->SAMPLE_RATE_HZ;
+}
 
-  // Get duration in seconds
-  double duration = static_cast<double>(format_ctx->duration) / AV_TIME_BASE;
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::configure_resampler(
+    const AVCodecContext* codec_ctx, int output_sample_rate) {
+  // Some demuxers leave the layout unset, assume the default for the count
+  int64_t input_layout = codec_ctx->channel_layout;
+  if (input_layout == 0 ||
+      av_get_channel_layout_nb_channels(input_layout) != codec_ctx->channels) {
+    input_layout = av_get_default_channel_layout(codec_ctx->channels);
+  }
 
-  // Clean up
-  avformat_close_input(&format_ctx);
+  // Per channel, the layout is kept and the output is deinterleaved into
+  // one float plane per channel; mono float has a single plane either way
+  swr_close(this->resampler);
+  swr_alloc_set_opts(this->resampler,
+                     this->channel_images ? input_layout : AV_CH_LAYOUT_MONO,
+                     AV_SAMPLE_FMT_FLTP, output_sample_rate, input_layout,
+                     codec_ctx->sample_fmt, codec_ctx->sample_rate, 0,
+                     nullptr);
+
+  // Plain mean of the channels like MappedPCMFile::read_mono, instead of the
+  // default -3 dB center mix
+  std::vector<double> downmix(codec_ctx->channels, 1.0 / codec_ctx->channels);
+  if ((!this->channel_images &&
+       swr_set_matrix(this->resampler, downmix.data(), codec_ctx->channels) <
+           0) ||
+      swr_init(this->resampler) < 0) {
+    LOG_ERROR("FFMPEG CANNOT INIT RESAMPLER");
+    return AUDIO2IMAGE_RET_T::FFMPEG_CANNOT_INIT_RESAMPLER;
+  }
 
-  return duration;
+  return AUDIO2IMAGE_RET_T::GOOD_IMPORT;
 }
 
-std::string Audio2Image::generateClippedFilename(const std::string& filename,
-                                                 double new_duration) {
-  size_t lastDot = filename.find_last_of(".");
-  if (lastDot == std::string::npos) {
-    return filename + "-" + std::to_string((int)new_duration) +
-           "sec";  // No extension case
+template <typename Config>
+int BasicAudio2Image<Config>::resample(const uint8_t** input_planes,
+                                       int num_samples) {
+  // A null input flushes the samples held back by the resampler
+  const int max_output = swr_get_out_samples(this->resampler, num_samples);
+  if (max_output > static_cast<int>(this->output_samples.plane_size()) ||
+      this->output_samples.num_planes() != this->num_output_channels) {
+    this->output_samples.reserve(this->num_output_channels, max_output);
   }
 
-  std::string namePart = filename.substr(0, lastDot);  // Without extension
-  std::string extPart = filename.substr(lastDot);  // Extension (including dot)
+  StageClock clock(this->stats);
+  const int num_output_samples =
+      swr_convert(this->resampler, this->output_samples.planes(), max_output,
+                  input_planes, num_samples);
+  clock.lap(&ConversionStats::resample);
+  return num_output_samples;
+}
 
-  return namePart + "-" + std::to_string((int)new_duration) + "sec" + extPart;
+template <typename Config>
+bool BasicAudio2Image<Config>::read_packet(AVFormatContext* format_ctx,
+                                           AVPacket* packet) {
+  StageClock clock(this->stats);
+  const bool read = av_read_frame(format_ctx, packet) >= 0;
+  clock.lap(&ConversionStats::demux);
+  if (read) {
+    this->count_stat(&ConversionStats::packets, 1);
+  }
+  return read;
 }
 
-bool Audio2Image::clip_audio_file(const std::string filename,
-                                  const std::string new_filename,
-                                  double new_duration) {
-  if (new_duration <= 0) {
-    LOG_ERROR("Invalid file duration. Duration must be >= 10.0 seconds.");
-    return false;
+template <typename Config>
+void BasicAudio2Image<Config>::begin_image(int input_channels,
+                                           cv::Mat& result_image) {
+  this->num_output_channels = this->channel_images ? input_channels : 1;
+
+  // Every pixel is written by a frame or by finish_image, no need to clear
+  if (this->channel_images) {
+    this->channel_images->resize(this->num_output_channels);
+    for (cv::Mat& image : *this->channel_images) {
+      image.create(this->IMAGE_SIZE_Y_PIXELS, this->IMAGE_SIZE_X_PIXELS,
+                   CV_8UC3);
+    }
+  } else if (!this->tile_sink) {
+    result_image.create(this->IMAGE_SIZE_Y_PIXELS, this->IMAGE_SIZE_X_PIXELS,
+                        CV_8UC3);
   }
 
-  std::ostringstream command;
-  command << "ffmpeg -i \"" << filename << "\" -t " << new_duration
-          << " -c copy \"" << new_filename << "\" -y 2>&1";
+  // Room for a whole frame plus the largest overlap, in every channel
+  while (static_cast<int>(this->sample_rings.size()) <
+         this->num_output_channels) {
+    this->sample_rings.emplace_back();
+    this->sample_rings.back().reserve(2 * this->SAMPLES_PER_FRAME);
+  }
+  this->clear_sample_rings();
+
+  // Every frame is one pyramid block, merged pairwise down to a single cell
+  static_assert(SEGMENTS_PER_FRAME >= 2 &&
+                    (SEGMENTS_PER_FRAME & (SEGMENTS_PER_FRAME - 1)) == 0,
+                "SEGMENTS_PER_FRAME must be a power of two, at least 2");
+  if (this->pyramid) {
+    this->pyramid->reset(
+        static_cast<double>(this->hop_size) / this->SAMPLE_RATE_HZ,
+        this->SEGMENTS_PER_FRAME, this->BIN_WIDTH_HZ);
+  }
+  if (this->stats) {
+    *this->stats = {};
+  }
+}
 
-  FILE* pipe = popen(command.str().c_str(), "r");
-  if (!pipe) {
-    LOG_ERROR("Failed to run FFmpeg command.");
-    return false;
+template <typename Config>
+std::optional<uint64_t> BasicAudio2Image<Config>::cache_key(
+    const std::string& filename, double clip_start_sec) const {
+  // Nothing else comes out of a hit
+  if (!this->cache || this->tile_sink || this->pyramid) {
+    return std::nullopt;
   }
 
-  char buffer[128];
-  std::string result = "";
-  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-    result += buffer;
+  // Everything the pixels depend on besides the file
+  std::string parameters = std::format(
+      "{} {} {} {} {} {} {} {} {}", this->SAMPLE_RATE_HZ,
+      this->NUM_SAMPLES_PER_SEGMENT, this->SEGMENTS_PER_FRAME,
+      this->IMAGE_SIZE_X_PIXELS, this->IMAGE_SIZE_Y_PIXELS,
+      this->AUDIO_DURATION_SEC, this->RESAMPLE_TO_SAMPLE_RATE, this->hop_size,
+      clip_start_sec);
+  for (double w : this->window) {
+    parameters += std::format(" {}", w);
   }
-  int exit_code = pclose(pipe);
+  return ConversionCache::make_key(filename, parameters);
+}
 
-  if (exit_code == 0) {
-    LOG_INFO(std::format("Audio clipped to {}", new_duration));
-    return true;
-  } else {
-    LOG_ERROR("Error occurred during audio clipping.");
-    return false;
+template <typename Config>
+int64_t BasicAudio2Image<Config>::clip_num_samples(int sample_rate) const {
+  if (std::isinf(this->clip_duration_sec)) {
+    return std::numeric_limits<int64_t>::max();
   }
+  return std::llround(this->clip_duration_sec * sample_rate);
 }
 
-std::tuple<double, double> Audio2Image::compute_average_frequency_and_amplitude(
-    fftw_complex* out, int num_samples) {
-  double sum_frequency = 0;
-  double sum_magnitude = 0;
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::finish_image(
+    int pixel_count, bool clip_complete, cv::Mat& result_image) {
+  if (this->data_matrix && !this->data_matrix->good()) {
+    LOG_ERROR("ERROR WRITING DATA MATRIX");
+    return AUDIO2IMAGE_RET_T::ERROR_WRITING_DATA_MATRIX;
+  }
 
-  // Loop through the first half of the FFT output (symmetric for real signals)
-  for (int i = 0; i < num_samples / 2; ++i) {
-    // Compute magnitude of the complex frequency component
-    double magnitude = sqrt(out[i][0] * out[i][0] + out[i][1] * out[i][1]);
-    sum_magnitude += magnitude;
-    sum_frequency += i * magnitude;  // Weight frequency bins by their magnitude
+  if (this->pyramid) {
+    this->pyramid->finish(pixel_count);
   }
 
-  double average_frequency =
-      (sum_magnitude > 0) ? (sum_frequency / sum_magnitude) : 0;
-  double average_amplitude =
-      (num_samples > 0) ? (sum_magnitude / (num_samples / 2)) : 0;
+  if (this->tile_sink) {
+    this->tile_sink->finish(pixel_count);
+    return AUDIO2IMAGE_RET_T::GOOD_CONVERSION;
+  }
 
-  return {average_frequency, average_amplitude};
-}
+  // The image holds more than AUDIO_DURATION_SEC, so the cells after a whole
+  // clip are padding too; only a clip cut short by the end of the file is
+  // reported as unfilled
+  if (pixel_count < this->TOTAL_PIXELS) {
+    LOG_INFO("Filling matrix with valid values");
 
-/*==========================================
-=                  PUBLIC                  =
-==========================================*/
+    for (int channel = 0; channel < this->num_output_channels; ++channel) {
+      cv::Mat& image = this->target_image(channel, result_image);
+      for (int pixel = pixel_count; pixel < this->TOTAL_PIXELS; ++pixel) {
+        int y_pixel = pixel / this->IMAGE_SIZE_X_PIXELS;
+        int x_pixel = pixel % this->IMAGE_SIZE_X_PIXELS;
+        cv::Vec3b& value = image.at<cv::Vec3b>(y_pixel, x_pixel);
+        value[0] = 0;  // Blue channel
+        value[1] = 0;  // Green channel
+        value[2] = 0;  // Red channel
+      }
+    }
+  }
 
-std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> Audio2Image::audio_file_to_image(
-    std::string filename) {
-  cv::Mat result_image(this->IMAGE_SIZE_X_PIXELS, this->IMAGE_SIZE_Y_PIXELS,
-                       CV_8UC3, cv::Scalar(0, 0, 0));
+  return clip_complete ? AUDIO2IMAGE_RET_T::GOOD_CONVERSION
+                       : AUDIO2IMAGE_RET_T::UNFILLED_MATRIX;
+}
+
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::convert_session(
+    MediaSession& session, double clip_start_sec, cv::Mat& result_image) {
   int pixel_count = 0;
 
-  // Initialize FFmpeg
-  avformat_network_init();
-
-  AVFormatContext* format_ctx = nullptr;
-  if (avformat_open_input(&format_ctx, filename.c_str(), nullptr, nullptr) !=
-      0) {
-    LOG_ERROR("FFMPEG ERROR OPENING AUDIO FILE");
-    return {AUDIO2IMAGE_RET_T::FFMPEG_ERROR_OPENING_AUDIO_FILE, cv::Mat()};
-  }
-
-  if (avformat_find_stream_info(format_ctx, nullptr) < 0) {
-    LOG_ERROR("FFMPEG ERROR FINDING AUDIO STREAM INFO");
-    return {AUDIO2IMAGE_RET_T::FFMPEG_ERROR_FINDING_AUDIO_STREAM_INFO,
-            cv::Mat()};
-  }
-
-  AVCodec* codec = nullptr;
-  AVCodecContext* codec_ctx = nullptr;
-  AVStream* audio_stream = nullptr;
-  for (int i = 0; i < format_ctx->nb_streams; ++i) {
-    audio_stream = format_ctx->streams[i];
-    codec = avcodec_find_decoder(audio_stream->codecpar->codec_id);
-    if (codec) {
-      codec_ctx = avcodec_alloc_context3(codec);
-      if (avcodec_parameters_to_context(codec_ctx, audio_stream->codecpar) <
-          0) {
-        LOG_ERROR("FFMPEG ERROR COPY CODEC PARAM TO CONTEXT");
-        return {AUDIO2IMAGE_RET_T::FFMPEG_ERROR_COPY_CODEC_PARAM_TO_CONTEXT,
-                cv::Mat()};
-      }
-      if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
-        LOG_ERROR("FFMPEG CANNOT OPEN CODED");
-        return {AUDIO2IMAGE_RET_T::FFMPEG_CANNOT_OPEN_CODEC, cv::Mat()};
-      }
-      break;
+  AVFormatContext* format_ctx = session.format_context();
+  AVCodecContext* codec_ctx = session.codec_context();
+  AVStream* audio_stream = session.stream();
+  this->begin_image(codec_ctx->channels, result_image);
+
+  const int output_sample_rate = this->RESAMPLE_TO_SAMPLE_RATE
+                                     ? this->SAMPLE_RATE_HZ
+                                     : codec_ctx->sample_rate;
+  if (output_sample_rate != this->SAMPLE_RATE_HZ) {
+    LOG_WARNING(std::format("Input is {} Hz, converter is configured for {} Hz",
+                            codec_ctx->sample_rate, this->SAMPLE_RATE_HZ));
+  }
+
+  // Clip in the decode loop: seek to the start, stop after the duration
+  const AVRational sample_time_base = {1, codec_ctx->sample_rate};
+  const int64_t clip_start_sample =
+      std::llround(clip_start_sec * codec_ctx->sample_rate);
+  const int64_t clip_num_samples =
+      this->clip_num_samples(codec_ctx->sample_rate);
+  int64_t clipped_samples = 0;
+
+  if (clip_start_sample > 0) {
+    AUDIO2IMAGE_RET_T seek_status = session.seek(clip_start_sec);
+    if (seek_status != AUDIO2IMAGE_RET_T::GOOD_IMPORT) {
+      result_image.release();
+      return seek_status;
     }
   }
 
-  if (!audio_stream) {
-    std::cerr << "No audio stream found." << std::endl;
-    LOG_ERROR("FFMPEG AUDIO STREAM NOT FOUND");
-    return {AUDIO2IMAGE_RET_T::FFMPEG_AUDIO_STREAM_NOT_FOUND, cv::Mat()};
+  // Every frame goes through swresample, whatever its layout and format
+  AUDIO2IMAGE_RET_T resampler_status =
+      this->configure_resampler(codec_ctx, output_sample_rate);
+  if (resampler_status != AUDIO2IMAGE_RET_T::GOOD_IMPORT) {
+    result_image.release();
+    return resampler_status;
   }
 
-  SwrContext* swr_ctx = swr_alloc();
-  swr_alloc_set_opts(swr_ctx, AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_FLT,
-                     codec_ctx->sample_rate, codec_ctx->channel_layout,
-                     codec_ctx->sample_fmt, codec_ctx->sample_rate, 0, nullptr);
-  swr_init(swr_ctx);
+  // Pointers to the clipped part of every plane of a frame
+  const bool planar = av_sample_fmt_is_planar(codec_ctx->sample_fmt);
+  const int bytes_per_sample = av_get_bytes_per_sample(codec_ctx->sample_fmt);
+  const int sample_stride = planar ? 1 : codec_ctx->channels;
+  std::vector<const uint8_t*> input_planes(planar ? codec_ctx->channels : 1);
+
+  // Packet and frame are owned by the converter and reused across files
+  AVPacket* packet = this->packet;
+  AVFrame* frame = this->decoded_frame;
 
-  // Allocate frame for reading data
-  AVFrame* frame = av_frame_alloc();
-  AVPacket packet;
-  std::vector<float> audio_data;
+  // Each frame fills SEGMENTS_PER_FRAME consecutive pixels, so its place in
+  // the image is known at decode time and workers can run out of order
+  int frame_index = 0;
+  bool decoding_done = false;
+  uint64_t loop_start_allocations = allocation_count();
+
+  FramePipeline pipeline(this->BLOCK_QUEUE_CAPACITY);
+  this->start_fft_workers(pipeline, result_image);
 
   // Read frames and process audio
-  while (av_read_frame(format_ctx, &packet) >= 0) {
-    if (packet.stream_index == audio_stream->index) {
-      int ret = avcodec_send_packet(codec_ctx, &packet);
+  // Decode is timed call by call, a single worker runs the FFT in between
+  StageClock clock(this->stats);
+  while (!decoding_done && this->read_packet(format_ctx, packet)) {
+    if (packet->stream_index == audio_stream->index) {
+      clock.restart();
+      int ret = avcodec_send_packet(codec_ctx, packet);
+      clock.lap(&ConversionStats::decode);
       if (ret < 0) {
+        av_packet_unref(packet);
+        this->clear_sample_rings();
+        this->join_fft_workers(pipeline);
+        result_image.release();
         LOG_ERROR("FFMPEG ERROR SENDING PACKET TO CODEC");
-        return {AUDIO2IMAGE_RET_T::FFMPEG_ERROR_SENDING_PACKET_TO_CODEC,
-                cv::Mat()};
+        return AUDIO2IMAGE_RET_T::FFMPEG_ERROR_SENDING_PACKET_TO_CODEC;
       }
 
       while (ret >= 0) {
+        clock.restart();
         ret = avcodec_receive_frame(codec_ctx, frame);
+        clock.lap(&ConversionStats::decode);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
           break;
         }
         if (ret < 0) {
+          av_packet_unref(packet);
+          this->clear_sample_rings();
+          this->join_fft_workers(pipeline);
+          result_image.release();
           LOG_ERROR("FFMPEG ERROR RECEIVING FRAME FROM CODEC");
-          return {AUDIO2IMAGE_RET_T::FFMPEG_ERROR_RECEIVING_FRAME_FROM_CODEC,
-                  cv::Mat()};
+          return AUDIO2IMAGE_RET_T::FFMPEG_ERROR_RECEIVING_FRAME_FROM_CODEC;
+        }
+        this->count_stat(&ConversionStats::frames, 1);
+
+        if (!this->frame_fits(frame_index) ||
+            clipped_samples >= clip_num_samples) {
+          decoding_done = true;
+          break;
+        }
+
+        // The seek lands on or before the start, drop the samples before it
+        int first_sample = 0;
+        if (frame->pts != AV_NOPTS_VALUE) {
+          int64_t frame_start_sample = av_rescale_q(
+              frame->pts, audio_stream->time_base, sample_time_base);
+          first_sample = static_cast<int>(std::clamp<int64_t>(
+              clip_start_sample - frame_start_sample, 0, frame->nb_samples));
         }
 
-        // Convert audio samples to float
-        int num_samples = frame->nb_samples;
-        audio_data.resize(num_samples);
-        for (int i = 0; i < num_samples; ++i) {
-          audio_data[i] =
-              frame->data[0][i] / 32768.0f;  // Assuming 16-bit PCM data
+        // Keep no more than the remainder of the clip
+        int num_samples = static_cast<int>(
+            std::min<int64_t>(frame->nb_samples - first_sample,
+                              clip_num_samples - clipped_samples));
+        if (num_samples <= 0) {
+          continue;
+        }
+        clipped_samples += num_samples;
+
+        // Downmix or deinterleave to float, resampling if asked to
+        for (size_t plane = 0; plane < input_planes.size(); ++plane) {
+          input_planes[plane] =
+              frame->extended_data[plane] +
+              static_cast<size_t>(first_sample) * sample_stride *
+                  bytes_per_sample;
+        }
+        int num_output_samples =
+            this->resample(input_planes.data(), num_samples);
+        if (num_output_samples < 0) {
+          av_packet_unref(packet);
+          this->clear_sample_rings();
+          this->join_fft_workers(pipeline);
+          result_image.release();
+          LOG_ERROR("FFMPEG ERROR RESAMPLING FRAME");
+          return AUDIO2IMAGE_RET_T::FFMPEG_ERROR_RESAMPLING_FRAME;
         }
 
-        this->insert_codec_frame_to_image(pixel_count, audio_data,
-                                          result_image);
+        const bool first_block = frame_index == 0;
+        frame_index = this->dispatch_output_samples(
+            pipeline, num_output_samples, frame_index, result_image);
+        if (first_block && frame_index > 0) {
+          loop_start_allocations = allocation_count();
+        }
       }
     }
 
-    av_packet_unref(&packet);
+    av_packet_unref(packet);
+  }
+  this->steady_state_allocations =
+      allocation_count() - loop_start_allocations;
+
+  // Drain the resampler, then the last partial frame
+  if (this->frame_fits(frame_index)) {
+    int num_output_samples = this->resample(nullptr, 0);
+    if (num_output_samples > 0) {
+      frame_index = this->dispatch_output_samples(
+          pipeline, num_output_samples, frame_index, result_image);
+    }
   }
+  frame_index = this->flush_samples(pipeline, frame_index, result_image);
 
-  // Clean up
-  av_frame_free(&frame);
-  avcodec_free_context(&codec_ctx);
-  avformat_close_input(&format_ctx);
-  swr_free(&swr_ctx);
+  // Wait for the queued frames to reach the image
+  this->join_fft_workers(pipeline);
+  pixel_count =
+      static_cast<int>(std::min<int64_t>(
+      static_cast<int64_t>(frame_index) * this->SEGMENTS_PER_FRAME,
+      this->cell_limit));
 
-  // Fill empty matrix cells if necessary
-  if (pixel_count <= this->IMAGE_SIZE_X_PIXELS * IMAGE_SIZE_Y_PIXELS) {
-    LOG_INFO("Filling matrix with valid values");
+  // Clean up, the session owns the demuxer and decoder
+  av_frame_unref(frame);
+
+  const bool clip_complete =
+      clipped_samples >= clip_num_samples || !this->frame_fits(frame_index);
+  return this->finish_image(pixel_count, clip_complete, result_image);
+}
+
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::convert_pcm_file(
+    const MappedPCMFile& pcm_file, double clip_start_sec,
+    cv::Mat& result_image) {
+  const PCMView& pcm = pcm_file.view();
+  this->begin_image(pcm.channels, result_image);
+  if (pcm.sample_rate != this->SAMPLE_RATE_HZ) {
+    LOG_WARNING(std::format("Input is {} Hz, converter is configured for {} Hz",
+                            pcm.sample_rate, this->SAMPLE_RATE_HZ));
+  }
+
+  // Clipping is just a range of the mapping
+  const int64_t clip_start_sample =
+      std::llround(clip_start_sec * pcm.sample_rate);
+  const int64_t clip_end_sample =
+      clip_start_sample +
+      std::min(pcm.num_frames - clip_start_sample,
+               this->clip_num_samples(pcm.sample_rate));
+  if (clip_start_sample < 0 || clip_start_sample > pcm.num_frames) {
+    result_image.release();
+    LOG_ERROR("CANNOT CLIP AUDIO FILE");
+    return AUDIO2IMAGE_RET_T::CANNOT_CLIP_AUDIO_FILE;
+  }
+
+  FramePipeline pipeline(this->BLOCK_QUEUE_CAPACITY);
+  this->start_fft_workers(pipeline, result_image);
+
+  // Blocks only carry offsets, the workers read and convert the samples, a
+  // channel each when converting per channel. A frame holding nothing but
+  // the overlap of the previous one is not needed.
+  const int overlap = this->frame_length() - this->frame_hop();
+  int frame_index = 0;
+  uint64_t loop_start_allocations = allocation_count();
+  for (int64_t sample = clip_start_sample;
+       sample + (frame_index > 0 ? overlap : 0) < clip_end_sample &&
+       this->frame_fits(frame_index);
+       sample += this->frame_hop()) {
+    for (int channel = 0; channel < this->num_output_channels; ++channel) {
+      SampleBlock block{frame_index};
+      block.pcm_file = &pcm_file;
+      block.pcm_first_frame = sample;
+      block.pcm_num_frames =
+          static_cast<int>(std::min<int64_t>(this->frame_length(),
+                                             clip_end_sample - sample));
+      block.channel = channel;
+      this->dispatch_block(pipeline, std::move(block), result_image);
+    }
+    if (++frame_index == 1) {
+      loop_start_allocations = allocation_count();
+    }
+  }
+  this->steady_state_allocations =
+      allocation_count() - loop_start_allocations;
+
+  this->join_fft_workers(pipeline);
+  int pixel_count =
+      static_cast<int>(std::min<int64_t>(
+      static_cast<int64_t>(frame_index) * this->SEGMENTS_PER_FRAME,
+      this->cell_limit));
+
+  // Everything after the last analyzed sample is left out of the image
+  const int64_t analyzed_end_sample =
+      frame_index > 0 ? std::min(clip_start_sample +
+                                     static_cast<int64_t>(frame_index - 1) *
+                                         this->frame_hop() +
+                                     this->frame_length(),
+                                 clip_end_sample)
+                      : clip_start_sample;
+  this->count_stat(&ConversionStats::samples,
+                   (clip_end_sample - clip_start_sample) *
+                       this->num_output_channels);
+  this->count_stat(&ConversionStats::dropped_samples,
+                   (clip_end_sample - analyzed_end_sample) *
+                       this->num_output_channels);
+
+  const bool clip_complete =
+      clip_end_sample - clip_start_sample >=
+          this->clip_num_samples(pcm.sample_rate) ||
+      !this->frame_fits(frame_index);
+  return this->finish_image(pixel_count, clip_complete, result_image);
+}
+
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::convert_file(
+    const std::string& filename, double clip_start_sec,
+    cv::Mat& result_image) {
+  // Plain PCM skips the demuxer unless it has to be resampled, anything else
+  // goes through FFmpeg
+  if (std::regex_match(filename, audio_file_regex.WAV) ||
+      std::regex_match(filename, audio_file_regex.AIFF)) {
+    MappedPCMFile pcm_file;
+    if (pcm_file.open(filename) && !this->needs_resampling(pcm_file)) {
+      return this->convert_pcm_file(pcm_file, clip_start_sec, result_image);
+    }
+  }
+
+  MediaSession session;
+  AUDIO2IMAGE_RET_T open_status = session.open(filename);
+  if (open_status != AUDIO2IMAGE_RET_T::GOOD_IMPORT) {
+    result_image.release();
+    return open_status;
+  }
+
+  return this->convert_session(session, clip_start_sec, result_image);
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+template <typename Config>
+BasicAudio2Image<Config>::BasicAudio2Image(int num_fft_workers,
+                                           bool resample_to_sample_rate)
+    : RESAMPLE_TO_SAMPLE_RATE(resample_to_sample_rate) {
+  for (int i = 0; i < std::max(1, num_fft_workers); ++i) {
+    this->fft_engines.push_back(std::make_unique<FFTEngine>(
+        this->NUM_SAMPLES_PER_SEGMENT, this->SEGMENTS_PER_FRAME));
+  }
+
+  // Everything the conversion loop touches is allocated here, once
+  this->frame_scratches.resize(this->fft_engines.size());
+  for (FrameScratch& scratch : this->frame_scratches) {
+    scratch.pcm_samples.resize(this->SAMPLES_PER_FRAME);
+    scratch.average_frequency.resize(this->SEGMENTS_PER_FRAME);
+    scratch.average_amplitude.resize(this->SEGMENTS_PER_FRAME);
+    scratch.blue.resize(this->SEGMENTS_PER_FRAME);
+    scratch.red.resize(this->SEGMENTS_PER_FRAME);
+  }
+
+  this->sample_pool.reserve(
+      this->BLOCK_QUEUE_CAPACITY + this->fft_engines.size() + 1,
+      [this](std::vector<float>& samples) {
+        samples.reserve(this->SAMPLES_PER_FRAME);
+      });
+
+  // Mono conversions frame a single channel
+  this->sample_rings.resize(1);
+  this->sample_rings.front().reserve(2 * this->SAMPLES_PER_FRAME);
+
+  this->packet = av_packet_alloc();
+  this->decoded_frame = av_frame_alloc();
+  this->resampler = swr_alloc();
+}
+
+template <typename Config>
+BasicAudio2Image<Config>::~BasicAudio2Image() {
+  av_packet_free(&this->packet);
+  av_frame_free(&this->decoded_frame);
+  swr_free(&this->resampler);
+}
 
-    while (pixel_count <= this->IMAGE_SIZE_X_PIXELS * IMAGE_SIZE_Y_PIXELS) {
-      int y_pixel = pixel_count / this->IMAGE_SIZE_Y_PIXELS;
-      int x_pixel = pixel_count % this->IMAGE_SIZE_X_PIXELS;
+template <typename Config>
+bool BasicAudio2Image<Config>::set_stft(STFT_WINDOW_T window_type,
+                                        int hop_size) {
+  if (hop_size < 1 || hop_size > this->NUM_SAMPLES_PER_SEGMENT) {
+    LOG_ERROR("INVALID STFT HOP SIZE");
+    return false;
+  }
+  this->hop_size = hop_size;
 
-      cv::Vec3b& pixel = result_image.at<cv::Vec3b>(y_pixel, x_pixel);
-      pixel[0] = 0;  // Blue channel
-      pixel[1] = 0;  // Green channel
-      pixel[2] = 0;  // Red channel
-      pixel_count++;
+  // Periodic windows, the usual choice for analysis
+  const int n = this->NUM_SAMPLES_PER_SEGMENT;
+  this->window.clear();
+  if (window_type == STFT_WINDOW_T::RECTANGULAR) {
+    return true;
+  }
+  // Cosine terms whose magnitudes sum to 1: the main lobe of a tone then
+  // holds the magnitude the rectangular window gives it in one bin, so the
+  // mean bin magnitude, and red, keep the tone's level whatever the window
+  for (int i = 0; i < n; ++i) {
+    const double phase = 2.0 * M_PI * i / n;
+    this->window.push_back(
+        window_type == STFT_WINDOW_T::HANN
+            ? 0.5 - 0.5 * std::cos(phase)
+            : 0.42 - 0.5 * std::cos(phase) + 0.08 * std::cos(2.0 * phase));
+  }
+  return true;
+}
+
+template <typename Config>
+std::tuple<AUDIO2IMAGE_RET_T, cv::Mat>
+BasicAudio2Image<Config>::audio_file_to_image(
+    std::string filename, double clip_start_sec) {
+  cv::Mat result_image;
+  AUDIO2IMAGE_RET_T conversion_status =
+      this->audio_file_to_image(filename, result_image, clip_start_sec);
+  return {conversion_status, result_image};
+}
+
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::audio_file_to_image(
+    std::string filename, cv::Mat& result_image, double clip_start_sec) {
+  std::optional<uint64_t> cache_key = this->cache_key(filename, clip_start_sec);
+  if (cache_key) {
+    std::optional<AUDIO2IMAGE_RET_T> cached_status =
+        this->cache->load(*cache_key, result_image, this->data_matrix);
+    if (cached_status) {
+      if (this->stats) {
+        *this->stats = {};
+      }
+      return *cached_status;
     }
   }
 
-  // Return result depending on whether the matrix was filled
-  return (pixel_count == this->IMAGE_SIZE_X_PIXELS * this->IMAGE_SIZE_Y_PIXELS)
-             ? std::make_tuple(AUDIO2IMAGE_RET_T::GOOD_CONVERSION, result_image)
-             : std::make_tuple(AUDIO2IMAGE_RET_T::UNFILLED_MATRIX,
-                               result_image);
+  AUDIO2IMAGE_RET_T conversion_status =
+      this->convert_file(filename, clip_start_sec, result_image);
+
+  // Only images are cached, whole or padded
+  if (cache_key && (conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION ||
+                    conversion_status == AUDIO2IMAGE_RET_T::UNFILLED_MATRIX)) {
+    this->cache->store(*cache_key, result_image, conversion_status,
+                       this->data_matrix);
+  }
+  return conversion_status;
+}
+
+template <typename Config>
+std::tuple<AUDIO2IMAGE_RET_T, cv::Mat>
+BasicAudio2Image<Config>::audio_file_to_image(
+    MediaSession& session, double clip_start_sec) {
+  cv::Mat result_image;
+  AUDIO2IMAGE_RET_T conversion_status =
+      this->convert_session(session, clip_start_sec, result_image);
+  return {conversion_status, result_image};
+}
+
+template <typename Config>
+std::tuple<AUDIO2IMAGE_RET_T, cv::Mat>
+BasicAudio2Image<Config>::audio_file_to_image(
+    const MappedPCMFile& pcm_file, double clip_start_sec) {
+  cv::Mat result_image;
+  AUDIO2IMAGE_RET_T conversion_status =
+      this->convert_pcm_file(pcm_file, clip_start_sec, result_image);
+  return {conversion_status, result_image};
 }
 
-std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> Audio2Image::audio2image(
+template <typename Config>
+std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> BasicAudio2Image<Config>::audio2image(
     std::string filename) {
   // Verify audio type is valid
   if (!(std::regex_match(filename, audio_file_regex.WAV) ||
         std::regex_match(filename, audio_file_regex.AIFF) ||
-        std::regex_match(filename, audio_file_regex.FLAC))) {
+        std::regex_match(filename, audio_file_regex.FLAC) ||
+        std::regex_match(filename, audio_file_regex.VIDEO))) {
     LOG_ERROR("INVALID AUDIO FILE TYPE");
     return {AUDIO2IMAGE_RET_T::INVALID_AUDIO_FILE_TYPE,
             cv::Mat::zeros(0, 0, CV_8UC3)};
   }
 
-  if (this->get_audio_duration(filename) < 10.0) {
+  // A whole cached image skips the probe too, a padded one was too short
+  std::optional<uint64_t> cache_key = this->cache_key(filename, 0.0);
+  if (cache_key) {
+    cv::Mat cached_image;
+    if (this->cache->load(*cache_key, cached_image, this->data_matrix) ==
+        AUDIO2IMAGE_RET_T::GOOD_CONVERSION) {
+      if (this->stats) {
+        *this->stats = {};
+      }
+      LOG_INFO("GOOD AUDIO TO IMAGE CONVERSION (CACHED)");
+      return {AUDIO2IMAGE_RET_T::GOOD_AUDIO2IMAGE, cached_image};
+    }
+  }
+
+  // Uncompressed files are mapped instead of demuxed, everything else is
+  // probed once and the duration check and conversion share the session
+  MappedPCMFile pcm_file;
+  MediaSession session;
+  const bool mapped = (std::regex_match(filename, audio_file_regex.WAV) ||
+                       std::regex_match(filename, audio_file_regex.AIFF)) &&
+                      pcm_file.open(filename) &&
+                      !this->needs_resampling(pcm_file);
+  if (!mapped) {
+    AUDIO2IMAGE_RET_T open_status = session.open(filename);
+    if (open_status != AUDIO2IMAGE_RET_T::GOOD_IMPORT) {
+      return {open_status, cv::Mat::zeros(0, 0, CV_8UC3)};
+    }
+  }
+
+  double duration = mapped ? pcm_file.duration() : session.duration();
+  if (duration < this->AUDIO_DURATION_SEC) {
     LOG_ERROR("AUDIO FILE DURATION TOO SHORT");
     return {AUDIO2IMAGE_RET_T::AUDIO_FILE_DURATION_TOO_SHORT,
             cv::Mat::zeros(0, 0, CV_8UC3)};
-
-  } else if (this->get_audio_duration(filename) > 10.0) {
-    std::string new_filename = this->generateClippedFilename(
-        filename, this->AUDIO_DURATION_SEC);  // filename-10sec.format
-    if (!this->clip_audio_file(filename, new_filename,
-                               this->AUDIO_DURATION_SEC)) {
-      LOG_ERROR("CANNOT CLIP AUDIO FILE");
-      return {AUDIO2IMAGE_RET_T::CANNOT_CLIP_AUDIO_FILE,
-              cv::Mat::zeros(0, 0, CV_8UC3)};
-    }
-    filename = new_filename;
   }
 
-  // TODO add call to audio_file_to_image()
+  // Longer files are clipped to AUDIO_DURATION_SEC while decoding. Only a
+  // whole image is stored, the one status the lookup above accepts
+  auto [conversion_status, audio_image] =
+      mapped ? this->audio_file_to_image(pcm_file)
+             : this->audio_file_to_image(session);
+  if (conversion_status != AUDIO2IMAGE_RET_T::GOOD_CONVERSION) {
+    return {conversion_status, audio_image};
+  }
+  if (cache_key) {
+    this->cache->store(*cache_key, audio_image, conversion_status,
+                       this->data_matrix);
+  }
 
   LOG_INFO("GOOD AUDIO TO IMAGE CONVERSION");
-  return {AUDIO2IMAGE_RET_T::GOOD_AUDIO2IMAGE, cv::Mat::zeros(0, 0, CV_8UC3)};
+  return {AUDIO2IMAGE_RET_T::GOOD_AUDIO2IMAGE, audio_image};
+}
+
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::audio_file_to_tiles(
+    std::string filename, TiledAudioImage& tiles, double clip_start_sec) {
+  tiles.reset(this->IMAGE_SIZE_X_PIXELS, this->IMAGE_SIZE_Y_PIXELS,
+              static_cast<double>(this->hop_size) / this->SAMPLE_RATE_HZ);
+  this->tile_sink = &tiles;
+  this->cell_limit = std::numeric_limits<int>::max();
+  this->clip_duration_sec = std::numeric_limits<double>::infinity();
+
+  cv::Mat unused_image;
+  AUDIO2IMAGE_RET_T conversion_status =
+      this->audio_file_to_image(filename, unused_image, clip_start_sec);
+
+  this->tile_sink = nullptr;
+  this->cell_limit = this->TOTAL_PIXELS;
+  this->clip_duration_sec = this->AUDIO_DURATION_SEC;
+  return conversion_status;
+}
+
+template <typename Config>
+AUDIO2IMAGE_RET_T BasicAudio2Image<Config>::audio_file_to_channel_images(
+    std::string filename, std::vector<cv::Mat>& channel_images,
+    double clip_start_sec) {
+  // Spectra and overview levels hold a single channel
+  SpectralMatrixWriter* data_matrix = this->data_matrix;
+  AudioImagePyramid* pyramid = this->pyramid;
+  this->data_matrix = nullptr;
+  this->pyramid = nullptr;
+  this->channel_images = &channel_images;
+
+  cv::Mat unused_image;
+  AUDIO2IMAGE_RET_T conversion_status =
+      this->convert_file(filename, clip_start_sec, unused_image);
+
+  this->channel_images = nullptr;
+  this->num_output_channels = 1;
+  this->data_matrix = data_matrix;
+  this->pyramid = pyramid;
+  if (conversion_status != AUDIO2IMAGE_RET_T::GOOD_CONVERSION &&
+      conversion_status != AUDIO2IMAGE_RET_T::UNFILLED_MATRIX) {
+    channel_images.clear();
+  }
+  return conversion_status;
+}
+
+template class BasicAudio2Image<Audio2ImageConfig<44100>>;
+template class BasicAudio2Image<Audio2ImageConfig<48000>>;
+template class BasicAudio2Image<Audio2ImageConfig<96000>>;
+
+/* Converters are planned on first use and kept for the rest of the process,
+ * calls at the same rate take turns on theirs */
+template <typename Converter>
+static std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> audio2image_with_shared(
+    const std::string& filename) {
+  static Converter converter;
+  static std::mutex converter_mutex;
+  std::lock_guard<std::mutex> lock(converter_mutex);
+  return converter.audio2image(filename);
+}
+
+std::tuple<AUDIO2IMAGE_RET_T, cv::Mat> audio2image_at_sample_rate(
+    int sample_rate_hz, std::string filename) {
+  switch (sample_rate_hz) {
+    case 44100:
+      return audio2image_with_shared<Audio2Image>(filename);
+    case 48000:
+      return audio2image_with_shared<Audio2Image48kHz>(filename);
+    case 96000:
+      return audio2image_with_shared<Audio2Image96kHz>(filename);
+    default:
+      LOG_ERROR("UNSUPPORTED SAMPLE RATE");
+      return {AUDIO2IMAGE_RET_T::UNSUPPORTED_SAMPLE_RATE,
+              cv::Mat::zeros(0, 0, CV_8UC3)};
+  }
+}
+
+cv::Mat stack_channel_images(const std::vector<cv::Mat>& channel_images) {
+  cv::Mat combined_image;
+  if (!channel_images.empty()) {
+    cv::vconcat(channel_images, combined_image);
+  }
+  return combined_image;
 }
@@ -0,0 +1,212 @@
+#include "AudioFileEncoder.h"
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+IMAGE2AUDIO_RET_T AudioFileEncoder::encode_frame(const AVFrame* input_frame) {
+  // A null frame flushes the encoder
+  if (avcodec_send_frame(this->codec_ctx, input_frame) < 0) {
+    LOG_ERROR("FFMPEG ERROR ENCODING FRAME");
+    return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_ENCODING_FRAME;
+  }
+
+  while (true) {
+    int ret = avcodec_receive_packet(this->codec_ctx, this->packet);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      break;
+    }
+    if (ret < 0) {
+      LOG_ERROR("FFMPEG ERROR ENCODING FRAME");
+      return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_ENCODING_FRAME;
+    }
+
+    av_packet_rescale_ts(this->packet, this->codec_ctx->time_base,
+                         this->audio_stream->time_base);
+    this->packet->stream_index = this->audio_stream->index;
+    if (av_interleaved_write_frame(this->format_ctx, this->packet) < 0) {
+      LOG_ERROR("FFMPEG ERROR WRITING PACKET");
+      return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_WRITING_PACKET;
+    }
+  }
+
+  return IMAGE2AUDIO_RET_T::GOOD_EXPORT;
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+AudioFileEncoder::~AudioFileEncoder() { this->close(); }
+
+IMAGE2AUDIO_RET_T AudioFileEncoder::open(const std::string& filename,
+                                         int sample_rate_hz) {
+  this->close();
+
+  // The muxer is guessed from the extension, the codec follows it
+  if (avformat_alloc_output_context2(&this->format_ctx, nullptr, nullptr,
+                                     filename.c_str()) < 0) {
+    LOG_ERROR("FFMPEG ERROR CREATING OUTPUT");
+    return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_CREATING_OUTPUT;
+  }
+  const AVCodecID codec_id = std::regex_match(filename, audio_file_regex.FLAC)
+                                 ? AV_CODEC_ID_FLAC
+                                 : AV_CODEC_ID_PCM_S16LE;
+
+  const AVCodec* codec = avcodec_find_encoder(codec_id);
+  if (!codec) {
+    LOG_ERROR("FFMPEG ENCODER NOT FOUND");
+    this->close();
+    return IMAGE2AUDIO_RET_T::FFMPEG_ENCODER_NOT_FOUND;
+  }
+
+  this->audio_stream = avformat_new_stream(this->format_ctx, nullptr);
+  this->codec_ctx = avcodec_alloc_context3(codec);
+  if (!this->audio_stream || !this->codec_ctx) {
+    LOG_ERROR("FFMPEG CANNOT OPEN ENCODER");
+    this->close();
+    return IMAGE2AUDIO_RET_T::FFMPEG_CANNOT_OPEN_ENCODER;
+  }
+
+  this->codec_ctx->sample_fmt = AV_SAMPLE_FMT_S16;
+  this->codec_ctx->sample_rate = sample_rate_hz;
+  this->codec_ctx->channels = 1;
+  this->codec_ctx->channel_layout = AV_CH_LAYOUT_MONO;
+  this->codec_ctx->time_base = {1, sample_rate_hz};
+  if (this->format_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+    this->codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  if (avcodec_open2(this->codec_ctx, codec, nullptr) < 0 ||
+      avcodec_parameters_from_context(this->audio_stream->codecpar,
+                                      this->codec_ctx) < 0) {
+    LOG_ERROR("FFMPEG CANNOT OPEN ENCODER");
+    this->close();
+    return IMAGE2AUDIO_RET_T::FFMPEG_CANNOT_OPEN_ENCODER;
+  }
+  this->audio_stream->time_base = this->codec_ctx->time_base;
+
+  if (!(this->format_ctx->oformat->flags & AVFMT_NOFILE) &&
+      avio_open(&this->format_ctx->pb, filename.c_str(), AVIO_FLAG_WRITE) <
+          0) {
+    LOG_ERROR("FFMPEG ERROR OPENING OUTPUT FILE");
+    this->close();
+    return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_OPENING_OUTPUT_FILE;
+  }
+
+  if (avformat_write_header(this->format_ctx, nullptr) < 0) {
+    LOG_ERROR("FFMPEG ERROR WRITING HEADER");
+    this->close();
+    return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_WRITING_HEADER;
+  }
+
+  // FLAC wants its own frame size, PCM takes any
+  const bool variable_frame_size =
+      codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE;
+  this->frame_capacity =
+      (this->codec_ctx->frame_size > 0 && !variable_frame_size)
+          ? this->codec_ctx->frame_size
+          : this->DEFAULT_FRAME_SIZE;
+
+  this->frame = av_frame_alloc();
+  this->packet = av_packet_alloc();
+  if (!this->frame || !this->packet) {
+    LOG_ERROR("FFMPEG ERROR ENCODING FRAME");
+    this->close();
+    return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_ENCODING_FRAME;
+  }
+  this->frame->nb_samples = this->frame_capacity;
+  this->frame->format = this->codec_ctx->sample_fmt;
+  this->frame->channel_layout = this->codec_ctx->channel_layout;
+  this->frame->sample_rate = sample_rate_hz;
+  if (av_frame_get_buffer(this->frame, 0) < 0) {
+    LOG_ERROR("FFMPEG ERROR ENCODING FRAME");
+    this->close();
+    return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_ENCODING_FRAME;
+  }
+
+  return IMAGE2AUDIO_RET_T::GOOD_EXPORT;
+}
+
+IMAGE2AUDIO_RET_T AudioFileEncoder::write(const float* samples,
+                                          int num_samples) {
+  while (num_samples > 0) {
+    // The encoder may still reference the previous frame's buffer
+    if (this->frame_fill == 0 && av_frame_make_writable(this->frame) < 0) {
+      LOG_ERROR("FFMPEG ERROR ENCODING FRAME");
+      return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_ENCODING_FRAME;
+    }
+
+    const int count =
+        std::min(num_samples, this->frame_capacity - this->frame_fill);
+    int16_t* out =
+        reinterpret_cast<int16_t*>(this->frame->data[0]) + this->frame_fill;
+    for (int i = 0; i < count; ++i) {
+      out[i] = to_pcm_s16(samples[i]);
+    }
+    this->frame_fill += count;
+    samples += count;
+    num_samples -= count;
+
+    if (this->frame_fill == this->frame_capacity) {
+      this->frame->pts = this->next_pts;
+      this->next_pts += this->frame_fill;
+      this->frame_fill = 0;
+      IMAGE2AUDIO_RET_T status = this->encode_frame(this->frame);
+      if (status != IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+        return status;
+      }
+    }
+  }
+
+  return IMAGE2AUDIO_RET_T::GOOD_EXPORT;
+}
+
+IMAGE2AUDIO_RET_T AudioFileEncoder::finish() {
+  if (this->frame_fill > 0) {
+    this->frame->nb_samples = this->frame_fill;
+    this->frame->pts = this->next_pts;
+    this->next_pts += this->frame_fill;
+    this->frame_fill = 0;
+    IMAGE2AUDIO_RET_T status = this->encode_frame(this->frame);
+    if (status != IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+      return status;
+    }
+  }
+
+  IMAGE2AUDIO_RET_T status = this->encode_frame(nullptr);
+  if (status != IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+    return status;
+  }
+
+  if (av_write_trailer(this->format_ctx) < 0) {
+    LOG_ERROR("FFMPEG ERROR WRITING TRAILER");
+    return IMAGE2AUDIO_RET_T::FFMPEG_ERROR_WRITING_TRAILER;
+  }
+
+  return IMAGE2AUDIO_RET_T::GOOD_EXPORT;
+}
+
+void AudioFileEncoder::close() {
+  if (this->frame) {
+    av_frame_free(&this->frame);
+  }
+  if (this->packet) {
+    av_packet_free(&this->packet);
+  }
+  if (this->codec_ctx) {
+    avcodec_free_context(&this->codec_ctx);
+  }
+  if (this->format_ctx) {
+    if (this->format_ctx->pb &&
+        !(this->format_ctx->oformat->flags & AVFMT_NOFILE)) {
+      avio_closep(&this->format_ctx->pb);
+    }
+    avformat_free_context(this->format_ctx);
+    this->format_ctx = nullptr;
+  }
+  this->audio_stream = nullptr;
+  this->frame_capacity = 0;
+  this->frame_fill = 0;
+  this->next_pts = 0;
+}
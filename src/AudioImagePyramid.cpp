@@ -0,0 +1,211 @@
+#include "AudioImagePyramid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SpectralKernels.h"
+
+static constexpr float AMPLITUDE_EPSILON = 1e-10f;  // prevent log(0)
+
+static PyramidCell merge_cells(const PyramidCell& a, const PyramidCell& b) {
+  const float sum_amplitude = a.amplitude + b.amplitude;
+  const float frequency_hz =
+      (sum_amplitude > 0)
+          ? (a.frequency_hz * a.amplitude + b.frequency_hz * b.amplitude) /
+                sum_amplitude
+          : 0;
+  return {frequency_hz, sum_amplitude / 2};
+}
+
+/* Same mapping as normalize_to_pixel_values_batch */
+static cv::Vec3b cell_to_pixel(const PyramidCell& cell) {
+  cv::Vec3b pixel;
+  pixel[0] = 0;  // Blue channel (normalized frequency)
+  pixel[1] = 0;  // Green channel (unused)
+  pixel[2] = 0;  // Red channel (normalized amplitude)
+  if (cell.amplitude < -1.0f || cell.amplitude > 1.0f) {
+    return pixel;
+  }
+
+  const int frequency_value = static_cast<int>(
+      cell.frequency_hz * MAX_PIXEL_VALUE / MAX_FREQUENCY_IN_AUDIO_SIGNAL_HZ);
+  const int amplitude_value = static_cast<int>(
+      (std::log2(std::abs(cell.amplitude) + AMPLITUDE_EPSILON) +
+       RED_AMPLITUDE_OCTAVES) *
+      RED_LEVELS_PER_OCTAVE);
+  pixel[0] = static_cast<uint8_t>(std::clamp(frequency_value, 0, 255));
+  pixel[2] = static_cast<uint8_t>(std::clamp(amplitude_value, 0, 255));
+  return pixel;
+}
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+void AudioImagePyramid::extend_levels(bool finished) {
+  for (int level = this->block_levels + 1;; ++level) {
+    const int64_t child_size = this->level_sizes[level - 2];
+    if (child_size < 2) {
+      return;
+    }
+    if (static_cast<int>(this->levels.size()) < level) {
+      this->levels.emplace_back();
+      this->level_sizes.push_back(0);
+    }
+
+    // Only pairs until the end is known, then the odd cell alone
+    const std::vector<PyramidCell>& children = this->levels[level - 2];
+    std::vector<PyramidCell>& cells = this->levels[level - 1];
+    const int64_t size = finished ? (child_size + 1) / 2 : child_size / 2;
+    cells.resize(std::max<int64_t>(cells.size(), size));
+    for (int64_t i = this->level_sizes[level - 1]; i < size; ++i) {
+      cells[i] = (2 * i + 1 < child_size)
+                     ? merge_cells(children[2 * i], children[2 * i + 1])
+                     : children[2 * i];
+    }
+    this->level_sizes[level - 1] = size;
+  }
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+void AudioImagePyramid::reset(double seconds_per_cell, int cells_per_block,
+                              double bin_width_hz) {
+  std::lock_guard<std::mutex> lock(this->levels_mutex);
+  this->block_levels = 0;
+  while ((1 << this->block_levels) < cells_per_block) {
+    ++this->block_levels;
+  }
+  this->cells_per_block = cells_per_block;
+  this->seconds_per_cell = seconds_per_cell;
+  this->bin_width_hz = bin_width_hz;
+
+  this->levels.assign(this->block_levels, {});
+  this->level_sizes.assign(this->block_levels, 0);
+  this->finished_blocks.clear();
+  this->finished_prefix = 0;
+}
+
+void AudioImagePyramid::add_block(int64_t first_cell, int count,
+                                  const double* frequency,
+                                  const double* amplitude,
+                                  std::vector<PyramidCell>& scratch) {
+  if (count <= 0) {
+    return;
+  }
+
+  // Level l of the block, ceil(count / 2^l) cells, follows level l - 1
+  scratch.resize(this->cells_per_block);
+  PyramidCell* children = scratch.data();
+  PyramidCell* cells = children;
+  int child_count = count;
+  for (int i = 0; i < count; i += 2) {
+    PyramidCell a{static_cast<float>(frequency[i] * this->bin_width_hz),
+                  static_cast<float>(amplitude[i])};
+    if (i + 1 < count) {
+      PyramidCell b{static_cast<float>(frequency[i + 1] * this->bin_width_hz),
+                    static_cast<float>(amplitude[i + 1])};
+      a = merge_cells(a, b);
+    }
+    cells[i / 2] = a;
+  }
+  for (int level = 2; level <= this->block_levels; ++level) {
+    children = cells;
+    child_count = (child_count + 1) / 2;
+    cells = children + child_count;
+    for (int i = 0; i < child_count; i += 2) {
+      cells[i / 2] = (i + 1 < child_count)
+                         ? merge_cells(children[i], children[i + 1])
+                         : children[i];
+    }
+  }
+
+  const int64_t block = first_cell / this->cells_per_block;
+  std::lock_guard<std::mutex> lock(this->levels_mutex);
+  const PyramidCell* level_cells = scratch.data();
+  for (int level = 1; level <= this->block_levels; ++level) {
+    const int block_cells = this->cells_per_block >> level;
+    std::vector<PyramidCell>& stored = this->levels[level - 1];
+    stored.resize(std::max<size_t>(stored.size(), (block + 1) * block_cells));
+
+    const int num_cells = ((count - 1) >> level) + 1;
+    std::copy_n(level_cells, num_cells, stored.begin() + block * block_cells);
+    level_cells += num_cells;
+  }
+
+  if (static_cast<int64_t>(this->finished_blocks.size()) <= block) {
+    this->finished_blocks.resize(block + 1);
+  }
+  this->finished_blocks[block] = true;
+  if (block != this->finished_prefix) {
+    return;
+  }
+
+  while (this->finished_prefix <
+             static_cast<int64_t>(this->finished_blocks.size()) &&
+         this->finished_blocks[this->finished_prefix]) {
+    ++this->finished_prefix;
+  }
+  for (int level = 1; level <= this->block_levels; ++level) {
+    this->level_sizes[level - 1] =
+        this->finished_prefix << (this->block_levels - level);
+  }
+  this->extend_levels(false);
+}
+
+void AudioImagePyramid::finish(int64_t num_cells) {
+  std::lock_guard<std::mutex> lock(this->levels_mutex);
+  for (int level = 1; level <= this->block_levels; ++level) {
+    const int64_t size = ((num_cells - 1) >> level) + 1;
+    this->levels[level - 1].resize(size);
+    this->level_sizes[level - 1] = std::max<int64_t>(0, size);
+  }
+  this->extend_levels(true);
+}
+
+int AudioImagePyramid::num_levels() const {
+  std::lock_guard<std::mutex> lock(this->levels_mutex);
+  return static_cast<int>(this->levels.size());
+}
+
+int64_t AudioImagePyramid::num_cells(int level) const {
+  std::lock_guard<std::mutex> lock(this->levels_mutex);
+  if (level < 1 || level > static_cast<int>(this->levels.size())) {
+    return 0;
+  }
+  return this->level_sizes[level - 1];
+}
+
+std::tuple<int, std::vector<cv::Vec3b>> AudioImagePyramid::query(
+    double start_sec, double end_sec, int max_cells) const {
+  std::lock_guard<std::mutex> lock(this->levels_mutex);
+  const int top_level = static_cast<int>(this->levels.size());
+  if (top_level == 0 || !(end_sec > start_sec)) {
+    return {0, {}};
+  }
+
+  const int64_t first_cell = static_cast<int64_t>(
+      std::floor(std::max(0.0, start_sec) / this->seconds_per_cell));
+  const int64_t end_cell = static_cast<int64_t>(
+      std::ceil(std::max(0.0, end_sec) / this->seconds_per_cell));
+
+  int level = 1;
+  int64_t first = first_cell >> level;
+  int64_t end = ((end_cell - 1) >> level) + 1;
+  while (end - first > max_cells && level < top_level) {
+    ++level;
+    first = first_cell >> level;
+    end = ((end_cell - 1) >> level) + 1;
+  }
+
+  // Nothing past the cells built so far
+  end = std::min(end, this->level_sizes[level - 1]);
+  std::vector<cv::Vec3b> pixels;
+  const std::vector<PyramidCell>& cells = this->levels[level - 1];
+  for (int64_t i = first; i < end; ++i) {
+    pixels.push_back(cell_to_pixel(cells[i]));
+  }
+  return {level, pixels};
+}
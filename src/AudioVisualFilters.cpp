@@ -0,0 +1,300 @@
+#include "AudioVisualFilters.h"
+
+#include <algorithm>
+#include <cmath>
+
+/* Red offset of a LUT entry past which every red value saturates */
+static constexpr int MAX_RED_OFFSET = 255;
+static constexpr uint32_t KEEP_PIXEL = 1u << 16;
+
+/*==========================================
+=                 FILTERS                  =
+==========================================*/
+
+ImageFilter low_pass_filter(double cutoff_hz, double start_sec, double end_sec,
+                            FILTER_EDGE_T edge, double gradient_value) {
+  return {FILTER_T::LOW_PASS, cutoff_hz, start_sec, end_sec, edge,
+          gradient_value};
+}
+
+ImageFilter high_pass_filter(double cutoff_hz, double start_sec,
+                             double end_sec, FILTER_EDGE_T edge,
+                             double gradient_value) {
+  return {FILTER_T::HIGH_PASS, cutoff_hz, start_sec, end_sec, edge,
+          gradient_value};
+}
+
+ImageFilter scale_amplitude_filter(double factor, double start_sec,
+                                   double end_sec) {
+  return {FILTER_T::SCALE_AMPLITUDE, factor, start_sec, end_sec,
+          FILTER_EDGE_T::BINARY, 1.0};
+}
+
+/* Adds the filter's gain at frequency_hz, in red units, or marks it cut */
+static void accumulate_filter(const ImageFilter& filter, double frequency_hz,
+                              double& red_offset, bool& cut) {
+  if (filter.type == FILTER_T::SCALE_AMPLITUDE) {
+    if (filter.value <= 0.0) {
+      cut = true;
+    } else {
+      red_offset += RED_LEVELS_PER_OCTAVE * std::log2(filter.value);
+    }
+    return;
+  }
+
+  // Octaves past the cutoff, on the side the filter removes; 0 Hz is
+  // infinitely far below any high-pass cutoff
+  double octaves = 0.0;
+  if (filter.type == FILTER_T::LOW_PASS && frequency_hz > filter.value) {
+    octaves = std::log2(frequency_hz / filter.value);
+  } else if (filter.type == FILTER_T::HIGH_PASS &&
+             frequency_hz < filter.value) {
+    octaves = std::log2(filter.value / frequency_hz);
+  } else {
+    return;
+  }
+
+  if (filter.edge == FILTER_EDGE_T::BINARY || std::isinf(octaves)) {
+    cut = true;
+  } else {
+    red_offset -= RED_LEVELS_PER_OCTAVE * octaves / filter.gradient_value;
+  }
+}
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+template <typename Config>
+int BasicFilterChain<Config>::to_cell(double seconds) const {
+  const double cell = std::ceil(seconds / this->SECONDS_PER_CELL);
+  if (cell >= this->TOTAL_PIXELS) {
+    return this->TOTAL_PIXELS;
+  }
+  return std::max(0, static_cast<int>(cell));
+}
+
+template <typename Config>
+void BasicFilterChain<Config>::compile() {
+  this->fused_spans.clear();
+
+  // The set of overlapping filters only changes on a filter boundary
+  std::vector<int> boundaries;
+  for (const ImageFilter& filter : this->filters) {
+    boundaries.push_back(this->to_cell(filter.start_sec));
+    boundaries.push_back(this->to_cell(filter.end_sec));
+  }
+  std::sort(boundaries.begin(), boundaries.end());
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()),
+                   boundaries.end());
+
+  for (size_t i = 0; i + 1 < boundaries.size(); ++i) {
+    const int first_cell = boundaries[i];
+    const int end_cell = boundaries[i + 1];
+
+    std::vector<const ImageFilter*> active_filters;
+    for (const ImageFilter& filter : this->filters) {
+      if (this->to_cell(filter.start_sec) <= first_cell &&
+          end_cell <= this->to_cell(filter.end_sec)) {
+        active_filters.push_back(&filter);
+      }
+    }
+    if (active_filters.empty()) {
+      continue;
+    }
+
+    FusedSpan span{first_cell, end_cell, {}, {}};
+    bool identity = true;
+    for (int blue = 0; blue < 256; ++blue) {
+      double red_offset = 0.0;
+      bool cut = false;
+      const double frequency_hz =
+          blue * MAX_FREQUENCY_IN_AUDIO_SIGNAL_HZ / MAX_PIXEL_VALUE;
+      for (const ImageFilter* filter : active_filters) {
+        accumulate_filter(*filter, frequency_hz, red_offset, cut);
+      }
+
+      const int offset = std::clamp(static_cast<int>(std::lround(red_offset)),
+                                    -MAX_RED_OFFSET, MAX_RED_OFFSET);
+      span.lut[blue] = (cut ? 0u : KEEP_PIXEL) |
+                       static_cast<uint32_t>(std::max(offset, 0)) |
+                       static_cast<uint32_t>(std::max(-offset, 0)) << 8;
+      identity = identity && span.lut[blue] == KEEP_PIXEL;
+    }
+
+    // Spectra are not saturated like red is
+    for (int bin = 0; bin < this->NUM_BINS; ++bin) {
+      double red_offset = 0.0;
+      bool cut = false;
+      for (const ImageFilter* filter : active_filters) {
+        accumulate_filter(*filter, bin * this->BIN_WIDTH_HZ, red_offset, cut);
+      }
+
+      span.bin_gain[bin] =
+          cut ? 0.0f
+              : static_cast<float>(
+                    std::exp2(red_offset / RED_LEVELS_PER_OCTAVE));
+      identity = identity && span.bin_gain[bin] == 1.0f;
+    }
+
+    // Filters that cancel out, e.g. a factor of 1, cost no pass
+    if (!identity) {
+      this->fused_spans.push_back(span);
+    }
+  }
+
+}
+
+template <typename Config>
+void BasicFilterChain<Config>::apply_rows(const cv::Range& rows,
+                                          cv::Mat& image) const {
+  for (int y = rows.start; y < rows.end; ++y) {
+    const int row_first_cell = y * this->IMAGE_SIZE_X_PIXELS;
+    const int row_end_cell = row_first_cell + this->IMAGE_SIZE_X_PIXELS;
+    uint8_t* row = image.ptr<uint8_t>(y);
+
+    auto span = std::upper_bound(
+        this->fused_spans.begin(), this->fused_spans.end(), row_first_cell,
+        [](int cell, const FusedSpan& s) { return cell < s.end_cell; });
+    for (; span != this->fused_spans.end() && span->first_cell < row_end_cell;
+         ++span) {
+      const int first_cell = std::max(span->first_cell, row_first_cell);
+      const int end_cell = std::min(span->end_cell, row_end_cell);
+      apply_filter_lut_span(row + 3 * (first_cell - row_first_cell),
+                            end_cell - first_cell, span->lut.data());
+    }
+  }
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+template <typename Config>
+FILTERS_RET_T BasicFilterChain<Config>::add(const ImageFilter& filter) {
+  const bool is_pass = filter.type != FILTER_T::SCALE_AMPLITUDE;
+  if ((is_pass && !(filter.value > 0.0 && std::isfinite(filter.value))) ||
+      (is_pass && filter.edge == FILTER_EDGE_T::GRADIENT &&
+       !(filter.gradient_value > 0.0 && filter.gradient_value <= 1.0)) ||
+      std::isnan(filter.value) || !(filter.start_sec >= 0.0) ||
+      !(filter.end_sec > filter.start_sec)) {
+    LOG_ERROR("INVALID FILTER PARAMETER");
+    return FILTERS_RET_T::INVALID_FILTER_PARAMETER;
+  }
+
+  this->filters.push_back(filter);
+  this->compile();
+  return FILTERS_RET_T::GOOD_FILTERING;
+}
+
+template <typename Config>
+void BasicFilterChain<Config>::clear() {
+  this->filters.clear();
+  this->fused_spans.clear();
+}
+
+template <typename Config>
+FILTERS_RET_T BasicFilterChain<Config>::apply(cv::Mat& image) {
+  if (image.type() != CV_8UC3 || image.rows != this->IMAGE_SIZE_Y_PIXELS ||
+      image.cols != this->IMAGE_SIZE_X_PIXELS) {
+    LOG_ERROR("INVALID IMAGE");
+    return FILTERS_RET_T::INVALID_IMAGE;
+  }
+
+  if (this->fused_spans.empty()) {
+    return FILTERS_RET_T::GOOD_FILTERING;
+  }
+
+  // Only the rows some span touches, every pixel once
+  const int first_row =
+      this->fused_spans.front().first_cell / this->IMAGE_SIZE_X_PIXELS;
+  const int end_row =
+      (this->fused_spans.back().end_cell - 1) / this->IMAGE_SIZE_X_PIXELS + 1;
+  cv::parallel_for_(cv::Range(first_row, end_row), [&](const cv::Range& rows) {
+    this->apply_rows(rows, image);
+  });
+
+  return FILTERS_RET_T::GOOD_FILTERING;
+}
+
+template <typename Config>
+FILTERS_RET_T BasicFilterChain<Config>::apply(cv::Mat& image,
+                                              DirtyRegions& dirty) {
+  FILTERS_RET_T filter_status = this->apply(image);
+  if (filter_status != FILTERS_RET_T::GOOD_FILTERING) {
+    return filter_status;
+  }
+
+  for (const FusedSpan& span : this->fused_spans) {
+    dirty.mark(span.first_cell, span.end_cell);
+  }
+  return FILTERS_RET_T::GOOD_FILTERING;
+}
+
+template <typename Config>
+void BasicFilterChain<Config>::apply_to_spectra(int64_t first_segment,
+                                                int num_segments,
+                                                float* spectra) const {
+  const int64_t end_segment = first_segment + num_segments;
+  auto span = std::upper_bound(
+      this->fused_spans.begin(), this->fused_spans.end(), first_segment,
+      [](int64_t segment, const FusedSpan& s) { return segment < s.end_cell; });
+
+  for (; span != this->fused_spans.end() && span->first_cell < end_segment;
+       ++span) {
+    const int64_t first = std::max<int64_t>(span->first_cell, first_segment);
+    const int64_t end = std::min<int64_t>(span->end_cell, end_segment);
+    for (int64_t segment = first; segment < end; ++segment) {
+      float* spectrum =
+          spectra + (segment - first_segment) * 2 * this->NUM_BINS;
+      for (int bin = 0; bin < this->NUM_BINS; ++bin) {
+        spectrum[2 * bin] *= span->bin_gain[bin];
+        spectrum[2 * bin + 1] *= span->bin_gain[bin];
+      }
+    }
+  }
+}
+
+template class BasicFilterChain<Audio2ImageConfig<44100>>;
+template class BasicFilterChain<Audio2ImageConfig<48000>>;
+template class BasicFilterChain<Audio2ImageConfig<96000>>;
+
+/*==========================================
+=             SINGLE FILTERS               =
+==========================================*/
+
+static FILTERS_RET_T apply_single_filter(const ImageFilter& filter,
+                                         cv::Mat& image) {
+  FilterChain chain;
+  FILTERS_RET_T filter_status = chain.add(filter);
+  if (filter_status != FILTERS_RET_T::GOOD_FILTERING) {
+    return filter_status;
+  }
+  return chain.apply(image);
+}
+
+FILTERS_RET_T low_pass(double cutoff_hz, cv::Mat& image, double start_sec,
+                       double end_sec, FILTER_EDGE_T edge,
+                       double gradient_value) {
+  return apply_single_filter(
+      low_pass_filter(cutoff_hz, start_sec, end_sec, edge, gradient_value),
+      image);
+}
+
+FILTERS_RET_T high_pass(double cutoff_hz, cv::Mat& image, double start_sec,
+                        double end_sec, FILTER_EDGE_T edge,
+                        double gradient_value) {
+  return apply_single_filter(
+      high_pass_filter(cutoff_hz, start_sec, end_sec, edge, gradient_value),
+      image);
+}
+
+FILTERS_RET_T scale_amplitude(double factor, cv::Mat& image) {
+  return apply_single_filter(scale_amplitude_filter(factor), image);
+}
+
+FILTERS_RET_T scale_amplitude(double factor, cv::Mat& image, double start_sec,
+                              double end_sec) {
+  return apply_single_filter(
+      scale_amplitude_filter(factor, start_sec, end_sec), image);
+}
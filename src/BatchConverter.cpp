@@ -0,0 +1,155 @@
+#include "BatchConverter.h"
+
+#include <glob.h>
+
+#include <filesystem>
+#include <map>
+
+/* Formats the converter is known to read, including the soundtrack of
+ * video containers */
+static bool is_audio_file(const std::string& filename) {
+  return std::regex_match(filename, audio_file_regex.WAV) ||
+         std::regex_match(filename, audio_file_regex.AIFF) ||
+         std::regex_match(filename, audio_file_regex.FLAC) ||
+         std::regex_match(filename, audio_file_regex.VIDEO);
+}
+
+std::vector<std::string> expand_batch_inputs(
+    const std::vector<std::string>& inputs) {
+  std::vector<std::string> filenames;
+  for (const std::string& input : inputs) {
+    std::error_code error;
+    if (std::filesystem::is_directory(input, error)) {
+      std::vector<std::string> directory_files;
+      for (const auto& entry :
+           std::filesystem::directory_iterator(input, error)) {
+        if (entry.is_regular_file(error) &&
+            is_audio_file(entry.path().string())) {
+          directory_files.push_back(entry.path().string());
+        }
+      }
+      std::sort(directory_files.begin(), directory_files.end());
+      filenames.insert(filenames.end(), directory_files.begin(),
+                       directory_files.end());
+      continue;
+    }
+
+    if (input.find_first_of("*?[") == std::string::npos) {
+      filenames.push_back(input);
+      continue;
+    }
+
+    // glob() sorts its matches
+    glob_t matches;
+    if (glob(input.c_str(), 0, nullptr, &matches) == 0) {
+      for (size_t i = 0; i < matches.gl_pathc; ++i) {
+        filenames.push_back(matches.gl_pathv[i]);
+      }
+    } else {
+      LOG_WARNING(std::format("No file matches {}", input));
+    }
+    globfree(&matches);
+  }
+
+  return filenames;
+}
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+template <typename Config>
+void BasicBatchConverter<Config>::run_worker(
+    size_t worker, WorkStealingQueues<size_t>& jobs,
+    std::vector<BatchResult>& results, double clip_start_sec) {
+  BasicAudio2Image<Config>& converter = *this->converters[worker];
+  cv::Mat audio_image;  // reused, every image has the same size
+
+  while (std::optional<size_t> job = jobs.pop(worker)) {
+    BatchResult& result = results[*job];
+    converter.set_stats(&result.stats);
+    result.status = converter.audio_file_to_image(result.input_filename,
+                                                  audio_image, clip_start_sec);
+
+    // A short file still makes an image, the status tells it apart
+    if (result.status != AUDIO2IMAGE_RET_T::GOOD_CONVERSION &&
+        result.status != AUDIO2IMAGE_RET_T::UNFILLED_MATRIX) {
+      result.output_filename.clear();
+      continue;
+    }
+
+    if (!cv::imwrite(result.output_filename, audio_image)) {
+      LOG_ERROR("ERROR WRITING IMAGE");
+      result.status = AUDIO2IMAGE_RET_T::ERROR_WRITING_IMAGE;
+      result.output_filename.clear();
+    }
+  }
+  converter.set_stats(nullptr);
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+template <typename Config>
+BasicBatchConverter<Config>::BasicBatchConverter(
+    int num_threads, bool resample_to_sample_rate) {
+  // One FFT worker each, the parallelism is across files
+  for (int i = 0; i < std::max(1, num_threads); ++i) {
+    this->converters.push_back(std::make_unique<BasicAudio2Image<Config>>(
+        1, resample_to_sample_rate));
+  }
+}
+
+template <typename Config>
+std::vector<BatchResult> BasicBatchConverter<Config>::convert(
+    const std::vector<std::string>& input_filenames,
+    const std::string& output_directory, double clip_start_sec) {
+  std::vector<BatchResult> results(input_filenames.size());
+
+  // Generated names are counted too, so a suffixed stem never lands on
+  // another input's stem or on an earlier suffixed one
+  std::map<std::string, int> stem_counts;
+  for (const std::string& filename : input_filenames) {
+    ++stem_counts[std::filesystem::path(filename).stem().string()];
+  }
+
+  const size_t num_workers =
+      std::min(this->converters.size(),
+               std::max<size_t>(1, input_filenames.size()));
+  WorkStealingQueues<size_t> jobs(num_workers);
+  for (size_t i = 0; i < input_filenames.size(); ++i) {
+    std::string stem =
+        std::filesystem::path(input_filenames[i]).stem().string();
+    if (stem_counts[stem] > 1) {
+      const std::string indexed_stem = stem + "_" + std::to_string(i);
+      stem = indexed_stem;
+      for (int n = 1; stem_counts.count(stem) > 0; ++n) {
+        stem = indexed_stem + "_" + std::to_string(n);
+      }
+      ++stem_counts[stem];
+    }
+    results[i] = {input_filenames[i],
+                  (std::filesystem::path(output_directory) / (stem + ".png"))
+                      .string(),
+                  AUDIO2IMAGE_RET_T::GOOD_IMPORT, ConversionStats{}};
+
+    // Neighbouring files start on the same thread
+    jobs.push(i * num_workers / input_filenames.size(), i);
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t worker = 0; worker < num_workers; ++worker) {
+    workers.emplace_back(&BasicBatchConverter::run_worker, this, worker,
+                         std::ref(jobs), std::ref(results), clip_start_sec);
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  return results;
+}
+
+template class BasicBatchConverter<Audio2ImageConfig<44100>>;
+template class BasicBatchConverter<Audio2ImageConfig<48000>>;
+template class BasicBatchConverter<Audio2ImageConfig<96000>>;
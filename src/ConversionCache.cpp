@@ -0,0 +1,378 @@
+#include "ConversionCache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+
+static constexpr char CACHE_ENTRY_MAGIC[8] = {'A', 'V', 'C', 'A',
+                                              'C', 'H', 'E', '\0'};
+static constexpr uint32_t CACHE_ENTRY_VERSION = 1;
+
+// Left behind by a process that died while storing
+static constexpr auto STALE_TEMPORARY_AGE = std::chrono::hours(1);
+
+struct CacheImageHeader {
+  char magic[8];
+  uint32_t version;
+  int32_t status;  // AUDIO2IMAGE_RET_T of the conversion
+  int32_t rows;
+  int32_t cols;
+  int32_t type;
+  uint32_t reserved;
+};
+
+/*==========================================
+=                 HELPERS                  =
+==========================================*/
+
+static constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+/* Statuses of the conversions that are stored, the only ones an entry can
+ * hold */
+static bool is_cached_status(int32_t status) {
+  return status == static_cast<int32_t>(AUDIO2IMAGE_RET_T::GOOD_CONVERSION) ||
+         status == static_cast<int32_t>(AUDIO2IMAGE_RET_T::UNFILLED_MATRIX);
+}
+
+static uint64_t rotate_left(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read_u64(const uint8_t* data) {
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t read_u32(const uint8_t* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint64_t xxh64_round(uint64_t accumulator, uint64_t input) {
+  accumulator += input * XXH_PRIME64_2;
+  return rotate_left(accumulator, 31) * XXH_PRIME64_1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t hash, uint64_t accumulator) {
+  hash ^= xxh64_round(0, accumulator);
+  return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/* XXH64, four independent lanes over 32-byte stripes (little-endian) */
+static uint64_t xxh64(const uint8_t* data, size_t size, uint64_t seed) {
+  const uint8_t* end = data + size;
+  uint64_t hash;
+
+  if (size >= 32) {
+    uint64_t lanes[4] = {seed + XXH_PRIME64_1 + XXH_PRIME64_2,
+                         seed + XXH_PRIME64_2, seed, seed - XXH_PRIME64_1};
+    for (; end - data >= 32; data += 32) {
+      for (int lane = 0; lane < 4; ++lane) {
+        lanes[lane] = xxh64_round(lanes[lane], read_u64(data + 8 * lane));
+      }
+    }
+    hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) +
+           rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+    for (uint64_t lane : lanes) {
+      hash = xxh64_merge_round(hash, lane);
+    }
+  } else {
+    hash = seed + XXH_PRIME64_5;
+  }
+  hash += size;
+
+  for (; end - data >= 8; data += 8) {
+    hash ^= xxh64_round(0, read_u64(data));
+    hash = rotate_left(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+  if (end - data >= 4) {
+    hash ^= read_u32(data) * XXH_PRIME64_1;
+    hash = rotate_left(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    data += 4;
+  }
+  for (; data < end; ++data) {
+    hash ^= *data * XXH_PRIME64_5;
+    hash = rotate_left(hash, 11) * XXH_PRIME64_1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= XXH_PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= XXH_PRIME64_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    const ssize_t written = write(fd, bytes, size);
+    if (written <= 0) {
+      return false;
+    }
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+  uint8_t* bytes = static_cast<uint8_t*>(data);
+  while (size > 0) {
+    const ssize_t read_bytes = read(fd, bytes, size);
+    if (read_bytes <= 0) {
+      return false;
+    }
+    bytes += read_bytes;
+    size -= read_bytes;
+  }
+  return true;
+}
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+std::string ConversionCache::entry_filename(uint64_t key,
+                                            const char* extension) const {
+  return this->DIRECTORY + "/" + std::format("{:016x}", key) + extension;
+}
+
+std::string ConversionCache::temporary_filename(const std::string& filename) {
+  return filename + "." + std::to_string(getpid()) + "." +
+         std::to_string(this->temporary_count++) + ".tmp";
+}
+
+bool ConversionCache::write_image(const std::string& filename,
+                                  const cv::Mat& image,
+                                  AUDIO2IMAGE_RET_T status) const {
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  CacheImageHeader header{};
+  std::memcpy(header.magic, CACHE_ENTRY_MAGIC, sizeof(header.magic));
+  header.version = CACHE_ENTRY_VERSION;
+  header.status = static_cast<int32_t>(status);
+  header.rows = image.rows;
+  header.cols = image.cols;
+  header.type = image.type();
+
+  bool ok = write_all(fd, &header, sizeof(header));
+  const size_t row_bytes = image.cols * image.elemSize();
+  for (int y = 0; ok && y < image.rows; ++y) {
+    ok = write_all(fd, image.ptr<uint8_t>(y), row_bytes);
+  }
+  return ::close(fd) == 0 && ok;
+}
+
+std::optional<AUDIO2IMAGE_RET_T> ConversionCache::read_image(
+    const std::string& filename, cv::Mat& image) const {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+
+  // Nothing from the file is trusted: only the images that are stored, of
+  // exactly the size the header claims
+  CacheImageHeader header;
+  struct stat file_stat;
+  bool ok = read_all(fd, &header, sizeof(header)) &&
+            std::memcmp(header.magic, CACHE_ENTRY_MAGIC,
+                        sizeof(header.magic)) == 0 &&
+            header.version == CACHE_ENTRY_VERSION && header.rows > 0 &&
+            header.cols > 0 && header.type == CV_8UC3 &&
+            is_cached_status(header.status) && ::fstat(fd, &file_stat) == 0 &&
+            static_cast<uint64_t>(file_stat.st_size) ==
+                sizeof(header) + static_cast<uint64_t>(header.rows) *
+                                     header.cols * 3;
+  if (ok) {
+    // Reuses the caller's buffer when it already has the size
+    image.create(header.rows, header.cols, header.type);
+    const size_t row_bytes = image.cols * image.elemSize();
+    for (int y = 0; ok && y < image.rows; ++y) {
+      ok = read_all(fd, image.ptr<uint8_t>(y), row_bytes);
+    }
+  }
+  ::close(fd);
+
+  if (!ok) {
+    return std::nullopt;
+  }
+  return static_cast<AUDIO2IMAGE_RET_T>(header.status);
+}
+
+void ConversionCache::evict() {
+  // One process at a time, a concurrent one would count removed files
+  int lock_fd = ::open((this->DIRECTORY + "/.lock").c_str(),
+                       O_RDWR | O_CREAT, 0644);
+  if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) {
+    LOG_WARNING("Cannot lock the conversion cache");
+    if (lock_fd >= 0) {
+      ::close(lock_fd);
+    }
+    return;
+  }
+
+  struct CacheFile {
+    std::filesystem::path path;
+    std::filesystem::file_time_type last_use;
+    uint64_t bytes;
+  };
+  std::vector<CacheFile> files;
+  uint64_t total_bytes = 0;
+
+  std::error_code error;
+  const auto now = std::filesystem::file_time_type::clock::now();
+  for (const auto& entry :
+       std::filesystem::directory_iterator(this->DIRECTORY, error)) {
+    const std::filesystem::path& path = entry.path();
+    const std::string extension = path.extension().string();
+    const auto last_use = entry.last_write_time(error);
+    if (error) {
+      continue;
+    }
+
+    if (extension == ".tmp") {
+      if (now - last_use > STALE_TEMPORARY_AGE) {
+        std::filesystem::remove(path, error);
+      }
+    } else if (extension == ".image" || extension == ".matrix") {
+      const uint64_t bytes = entry.file_size(error);
+      if (!error) {
+        files.push_back({path, last_use, bytes});
+        total_bytes += bytes;
+      }
+    }
+  }
+
+  // Least recently used first; open readers keep their file until closed
+  std::sort(files.begin(), files.end(),
+            [](const CacheFile& a, const CacheFile& b) {
+              return a.last_use < b.last_use;
+            });
+  for (const CacheFile& file : files) {
+    if (total_bytes <= this->MAX_BYTES) {
+      break;
+    }
+    if (std::filesystem::remove(file.path, error)) {
+      total_bytes -= file.bytes;
+    }
+  }
+
+  flock(lock_fd, LOCK_UN);
+  ::close(lock_fd);
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+ConversionCache::ConversionCache(std::string directory, uint64_t max_bytes)
+    : DIRECTORY(std::move(directory)), MAX_BYTES(max_bytes) {
+  std::error_code error;
+  std::filesystem::create_directories(this->DIRECTORY, error);
+  if (error) {
+    LOG_ERROR("CANNOT CREATE CONVERSION CACHE DIRECTORY");
+  }
+}
+
+std::optional<uint64_t> ConversionCache::make_key(
+    const std::string& filename, const std::string& parameters) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    ::close(fd);
+    return std::nullopt;
+  }
+
+  const uint64_t seed = xxh64(
+      reinterpret_cast<const uint8_t*>(parameters.data()), parameters.size(),
+      CACHE_ENTRY_VERSION);
+  const size_t size = static_cast<size_t>(file_stat.st_size);
+  if (size == 0) {
+    ::close(fd);
+    return xxh64(nullptr, 0, seed);
+  }
+
+  // Mapped and read once front to back, far cheaper than decoding
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return std::nullopt;
+  }
+  madvise(mapping, size, MADV_SEQUENTIAL);
+  const uint64_t key = xxh64(static_cast<const uint8_t*>(mapping), size, seed);
+  munmap(mapping, size);
+  return key;
+}
+
+std::optional<AUDIO2IMAGE_RET_T> ConversionCache::load(
+    uint64_t key, cv::Mat& image, SpectralMatrixWriter* data_matrix) {
+  const std::string image_filename = this->entry_filename(key, ".image");
+  const std::string matrix_filename = this->entry_filename(key, ".matrix");
+
+  // Either file may have been evicted on its own, both are needed to hit
+  std::optional<AUDIO2IMAGE_RET_T> status =
+      this->read_image(image_filename, image);
+  if (!status ||
+      (data_matrix && !data_matrix->copy_segments_from(matrix_filename))) {
+    return std::nullopt;
+  }
+
+  // Refresh the entry for the LRU order, losing a race to eviction is fine
+  utimensat(AT_FDCWD, image_filename.c_str(), nullptr, 0);
+  if (data_matrix) {
+    utimensat(AT_FDCWD, matrix_filename.c_str(), nullptr, 0);
+  }
+  return status;
+}
+
+bool ConversionCache::store(uint64_t key, const cv::Mat& image,
+                            AUDIO2IMAGE_RET_T status,
+                            const SpectralMatrixWriter* data_matrix) {
+  if (image.type() != CV_8UC3 ||
+      !is_cached_status(static_cast<int32_t>(status))) {
+    return false;
+  }
+  const std::string image_filename = this->entry_filename(key, ".image");
+  const std::string matrix_filename = this->entry_filename(key, ".matrix");
+
+  // Spectra first, so that the entry is whole once its image appears
+  if (data_matrix) {
+    const std::string temporary = this->temporary_filename(matrix_filename);
+    if (!data_matrix->save_copy(temporary) ||
+        std::rename(temporary.c_str(), matrix_filename.c_str()) != 0) {
+      std::remove(temporary.c_str());
+      LOG_WARNING("Cannot store data matrix in the conversion cache");
+      return false;
+    }
+  }
+
+  const std::string temporary = this->temporary_filename(image_filename);
+  if (!this->write_image(temporary, image, status) ||
+      std::rename(temporary.c_str(), image_filename.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    LOG_WARNING("Cannot store image in the conversion cache");
+    return false;
+  }
+
+  this->evict();
+  return true;
+}
@@ -0,0 +1,333 @@
+#include "ConversionServer.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iomanip>
+
+// Longest request line, anything longer is dropped with the connection
+static constexpr size_t MAX_REQUEST_BYTES = 64 * 1024;
+
+/* Whole buffer or nothing, without SIGPIPE when the client is gone */
+static bool send_all(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+static bool send_line(int fd, const std::string& line) {
+  const std::string terminated = line + "\n";
+  return send_all(fd, terminated.data(), terminated.size());
+}
+
+static bool parse_number(const std::string& text, double& value) {
+  char* end = nullptr;
+  value = std::strtod(text.c_str(), &end);
+  return !text.empty() && end == text.c_str() + text.size();
+}
+
+/* <type>:<value>[:<start sec>:<end sec>] */
+static bool parse_filter(const std::string& spec, ImageFilter& filter) {
+  std::vector<std::string> parts;
+  std::stringstream stream(spec);
+  for (std::string part; std::getline(stream, part, ':');) {
+    parts.push_back(part);
+  }
+  if (parts.size() != 2 && parts.size() != 4) {
+    return false;
+  }
+
+  double value = 0.0;
+  double start_sec = 0.0;
+  double end_sec = std::numeric_limits<double>::infinity();
+  if (!parse_number(parts[1], value) ||
+      (parts.size() == 4 && (!parse_number(parts[2], start_sec) ||
+                             !parse_number(parts[3], end_sec)))) {
+    return false;
+  }
+
+  if (parts[0] == "low_pass") {
+    filter = low_pass_filter(value, start_sec, end_sec);
+  } else if (parts[0] == "high_pass") {
+    filter = high_pass_filter(value, start_sec, end_sec);
+  } else if (parts[0] == "scale") {
+    filter = scale_amplitude_filter(value, start_sec, end_sec);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+template <typename Config>
+void BasicConversionServer<Config>::serve_connection(int connection_fd) {
+  std::string pending;
+  char buffer[4096];
+
+  while (!this->stop_requested) {
+    const ssize_t received = recv(connection_fd, buffer, sizeof(buffer), 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return;
+    }
+    pending.append(buffer, static_cast<size_t>(received));
+
+    // Every complete line is a request, the rest waits for more bytes
+    size_t line_end;
+    while ((line_end = pending.find('\n')) != std::string::npos) {
+      std::istringstream line(pending.substr(0, line_end));
+      pending.erase(0, line_end + 1);
+
+      std::vector<std::string> fields;
+      for (std::string field; line >> std::quoted(field);) {
+        fields.push_back(field);
+      }
+      if (!fields.empty() && !this->handle_request(connection_fd, fields)) {
+        return;
+      }
+    }
+
+    if (pending.size() > MAX_REQUEST_BYTES) {
+      send_line(connection_fd, "ERROR request too long");
+      return;
+    }
+  }
+}
+
+template <typename Config>
+bool BasicConversionServer<Config>::handle_request(
+    int connection_fd, const std::vector<std::string>& fields) {
+  const std::string& command = fields.front();
+  if (command == "image") {
+    return this->convert_audio(connection_fd, fields);
+  }
+  if (command == "filter") {
+    return this->filter_image(connection_fd, fields);
+  }
+  if (command == "audio") {
+    return this->render_audio(connection_fd, fields);
+  }
+  if (command == "quit") {
+    return false;
+  }
+  if (command == "shutdown") {
+    send_line(connection_fd, "OK");
+    this->stop();
+    return false;
+  }
+
+  return send_line(connection_fd, "ERROR unknown command " + command);
+}
+
+template <typename Config>
+bool BasicConversionServer<Config>::reply_image(
+    int connection_fd, const std::string& output_filename,
+    const cv::Mat& image, int status) {
+  const std::string write_error = std::format(
+      "ERROR {}", static_cast<int>(AUDIO2IMAGE_RET_T::ERROR_WRITING_IMAGE));
+  if (output_filename != "-") {
+    if (!cv::imwrite(output_filename, image)) {
+      LOG_ERROR("ERROR WRITING IMAGE");
+      return send_line(connection_fd, write_error);
+    }
+    return send_line(connection_fd, std::format("OK {}", status));
+  }
+
+  // Streamed back, the length first so the client knows where it ends
+  std::vector<uchar> encoded;
+  if (!cv::imencode(".png", image, encoded)) {
+    LOG_ERROR("ERROR WRITING IMAGE");
+    return send_line(connection_fd, write_error);
+  }
+  return send_line(connection_fd,
+                   std::format("OK {} {}", status, encoded.size())) &&
+         send_all(connection_fd, encoded.data(), encoded.size());
+}
+
+template <typename Config>
+bool BasicConversionServer<Config>::convert_audio(
+    int connection_fd, const std::vector<std::string>& fields) {
+  double clip_start_sec = 0.0;
+  if (fields.size() < 3 || fields.size() > 4 ||
+      (fields.size() == 4 && !parse_number(fields[3], clip_start_sec))) {
+    return send_line(connection_fd,
+                     "ERROR usage: image <audio file> <output image> "
+                     "[clip start sec]");
+  }
+
+  cv::Mat image;
+  AUDIO2IMAGE_RET_T status =
+      this->audio2image->audio_file_to_image(fields[1], image, clip_start_sec);
+
+  // A short file still makes an image, the status tells it apart
+  if (status != AUDIO2IMAGE_RET_T::GOOD_CONVERSION &&
+      status != AUDIO2IMAGE_RET_T::UNFILLED_MATRIX) {
+    return send_line(connection_fd,
+                     std::format("ERROR {}", static_cast<int>(status)));
+  }
+  return this->reply_image(connection_fd, fields[2], image,
+                           static_cast<int>(status));
+}
+
+template <typename Config>
+bool BasicConversionServer<Config>::filter_image(
+    int connection_fd, const std::vector<std::string>& fields) {
+  if (fields.size() < 4) {
+    return send_line(connection_fd,
+                     "ERROR usage: filter <input image> <output image> "
+                     "<filter>...");
+  }
+
+  this->filter_chain.clear();
+  for (size_t i = 3; i < fields.size(); ++i) {
+    ImageFilter filter;
+    if (!parse_filter(fields[i], filter)) {
+      return send_line(connection_fd, "ERROR invalid filter " + fields[i]);
+    }
+    FILTERS_RET_T status = this->filter_chain.add(filter);
+    if (status != FILTERS_RET_T::GOOD_FILTERING) {
+      return send_line(connection_fd,
+                       std::format("ERROR {}", static_cast<int>(status)));
+    }
+  }
+
+  cv::Mat image = cv::imread(fields[1]);
+  FILTERS_RET_T status = this->filter_chain.apply(image);
+  if (status != FILTERS_RET_T::GOOD_FILTERING) {
+    return send_line(connection_fd,
+                     std::format("ERROR {}", static_cast<int>(status)));
+  }
+  return this->reply_image(connection_fd, fields[2], image,
+                           static_cast<int>(status));
+}
+
+template <typename Config>
+bool BasicConversionServer<Config>::render_audio(
+    int connection_fd, const std::vector<std::string>& fields) {
+  if (fields.size() != 3) {
+    return send_line(connection_fd,
+                     "ERROR usage: audio <input image> <output WAV or FLAC>");
+  }
+
+  cv::Mat image = cv::imread(fields[1]);
+  IMAGE2AUDIO_RET_T status =
+      this->image2audio->export_image_to_audio_file(image, fields[2]);
+  return send_line(connection_fd,
+                   std::format("{} {}",
+                               status == IMAGE2AUDIO_RET_T::GOOD_EXPORT
+                                   ? "OK"
+                                   : "ERROR",
+                               static_cast<int>(status)));
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+template <typename Config>
+BasicConversionServer<Config>::BasicConversionServer(
+    std::string socket_path, std::string wisdom_filename)
+    : SOCKET_PATH(std::move(socket_path)),
+      WISDOM_FILENAME(std::move(wisdom_filename)) {
+  // Plans made after the import come straight from the wisdom
+  if (!this->WISDOM_FILENAME.empty()) {
+    FFTEngine::import_wisdom(this->WISDOM_FILENAME);
+  }
+
+  this->audio2image = std::make_unique<BasicAudio2Image<Config>>();
+  this->image2audio = std::make_unique<BasicImage2Audio<Config>>();
+
+  if (!this->WISDOM_FILENAME.empty()) {
+    FFTEngine::export_wisdom(this->WISDOM_FILENAME);
+  }
+}
+
+template <typename Config>
+BasicConversionServer<Config>::~BasicConversionServer() {
+  if (this->listen_fd >= 0) {
+    close(this->listen_fd);
+    unlink(this->SOCKET_PATH.c_str());
+  }
+}
+
+template <typename Config>
+bool BasicConversionServer<Config>::start() {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (this->SOCKET_PATH.size() >= sizeof(address.sun_path)) {
+    LOG_ERROR("SOCKET PATH TOO LONG");
+    return false;
+  }
+  std::copy(this->SOCKET_PATH.begin(), this->SOCKET_PATH.end(),
+            address.sun_path);
+
+  this->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (this->listen_fd < 0) {
+    LOG_ERROR("CANNOT CREATE SOCKET");
+    return false;
+  }
+
+  // A socket file left by a server that did not exit cleanly
+  unlink(this->SOCKET_PATH.c_str());
+  if (bind(this->listen_fd, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) < 0 ||
+      listen(this->listen_fd, SOMAXCONN) < 0) {
+    LOG_ERROR(std::format("CANNOT LISTEN ON {}", this->SOCKET_PATH));
+    close(this->listen_fd);
+    this->listen_fd = -1;
+    return false;
+  }
+
+  LOG_INFO(std::format("Listening on {}", this->SOCKET_PATH));
+  return true;
+}
+
+template <typename Config>
+void BasicConversionServer<Config>::run() {
+  while (!this->stop_requested) {
+    const int connection_fd = accept4(this->listen_fd, nullptr, nullptr,
+                                      SOCK_CLOEXEC);
+    if (connection_fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      // stop() shuts the listening socket down, accept fails from then on
+      if (!this->stop_requested) {
+        LOG_ERROR("ERROR ACCEPTING CONNECTION");
+      }
+      return;
+    }
+
+    this->serve_connection(connection_fd);
+    close(connection_fd);
+  }
+}
+
+template <typename Config>
+void BasicConversionServer<Config>::stop() {
+  this->stop_requested = true;
+  if (this->listen_fd >= 0) {
+    shutdown(this->listen_fd, SHUT_RDWR);
+  }
+}
+
+template class BasicConversionServer<Audio2ImageConfig<44100>>;
+template class BasicConversionServer<Audio2ImageConfig<48000>>;
+template class BasicConversionServer<Audio2ImageConfig<96000>>;
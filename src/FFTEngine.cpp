@@ -0,0 +1,69 @@
+#include "FFTEngine.h"
+
+#include <mutex>
+
+/* FFTW planner calls are not thread-safe, only fftw_execute() is */
+static std::mutex fftw_planner_mutex;
+
+FFTEngine::FFTEngine(int segment_size, int num_segments,
+                     unsigned planner_flags)
+    : SEGMENT_SIZE(segment_size),
+      NUM_SEGMENTS(num_segments),
+      NUM_BINS(segment_size / 2 + 1) {
+  this->in = fftw_alloc_real(static_cast<size_t>(this->NUM_SEGMENTS) *
+                             this->SEGMENT_SIZE);
+  this->real_out = fftw_alloc_real(static_cast<size_t>(this->NUM_BINS) *
+                                   this->NUM_SEGMENTS);
+  this->imag_out = fftw_alloc_real(static_cast<size_t>(this->NUM_BINS) *
+                                   this->NUM_SEGMENTS);
+
+  // One r2c transform of SEGMENT_SIZE per segment, segments stored back to
+  // back on input, spectra written bin-major into split re/im arrays
+  const fftw_iodim transform = {this->SEGMENT_SIZE, 1, this->NUM_SEGMENTS};
+  const fftw_iodim batch = {this->NUM_SEGMENTS, this->SEGMENT_SIZE, 1};
+  {
+    std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+    this->plan = fftw_plan_guru_split_dft_r2c(1, &transform, 1, &batch,
+                                              this->in, this->real_out,
+                                              this->imag_out, planner_flags);
+  }
+
+  if (!this->plan) {
+    LOG_ERROR("FFTW could not create the batched split r2c plan.");
+  }
+
+  // FFTW_MEASURE scribbles over the buffers while planning
+  std::fill_n(this->in,
+              static_cast<size_t>(this->NUM_SEGMENTS) * this->SEGMENT_SIZE,
+              0.0);
+}
+
+FFTEngine::~FFTEngine() {
+  if (this->plan) {
+    std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+    fftw_destroy_plan(this->plan);
+  }
+  fftw_free(this->in);
+  fftw_free(this->real_out);
+  fftw_free(this->imag_out);
+}
+
+void FFTEngine::execute() { fftw_execute(this->plan); }
+
+bool FFTEngine::import_wisdom(const std::string& filename) {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  if (!fftw_import_wisdom_from_filename(filename.c_str())) {
+    LOG_WARNING(std::format("Could not import FFTW wisdom from {}", filename));
+    return false;
+  }
+  return true;
+}
+
+bool FFTEngine::export_wisdom(const std::string& filename) {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  if (!fftw_export_wisdom_to_filename(filename.c_str())) {
+    LOG_WARNING(std::format("Could not export FFTW wisdom to {}", filename));
+    return false;
+  }
+  return true;
+}
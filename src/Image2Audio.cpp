@@ -0,0 +1,452 @@
+#include "Image2Audio.h"
+
+#include <fstream>
+#include <thread>
+
+#include "MappedPCMFile.h"
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+template <typename Config>
+IMAGE2AUDIO_RET_T BasicImage2Audio<Config>::check_input(const cv::Mat& image,
+                                                        int quality) {
+  if (image.type() != CV_8UC3 || image.rows != this->IMAGE_SIZE_Y_PIXELS ||
+      image.cols != this->IMAGE_SIZE_X_PIXELS) {
+    LOG_ERROR("INVALID IMAGE");
+    return IMAGE2AUDIO_RET_T::INVALID_IMAGE;
+  }
+  if (quality < 1 || quality > this->MAX_QUALITY) {
+    LOG_ERROR("INVALID QUALITY");
+    return IMAGE2AUDIO_RET_T::INVALID_QUALITY;
+  }
+
+  return IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO;
+}
+
+template <typename Config>
+void BasicImage2Audio<Config>::decode_cell(const cv::Vec3b& pixel, int cell,
+                                           int output_sample_rate_hz) {
+  const float frequency_hz = this->blue_to_frequency_hz[pixel[0]];
+
+  // No frequency is a black (unfilled) cell, above Nyquist cannot be
+  // rendered, both are silent instead of DC or aliases
+  const bool silent =
+      pixel[0] == 0 || frequency_hz >= output_sample_rate_hz / 2.0f;
+  this->amplitude[cell] = silent ? 0.0f : this->red_to_amplitude[pixel[2]];
+  this->phase_increment[cell] = frequency_hz / output_sample_rate_hz;
+}
+
+template <typename Config>
+void BasicImage2Audio<Config>::decode_rows(const cv::Mat& image,
+                                           const cv::Range& rows,
+                                           int output_sample_rate_hz,
+                                           int samples_per_cell) {
+  for (int y = rows.start; y < rows.end; ++y) {
+    const cv::Vec3b* pixels = image.ptr<cv::Vec3b>(y);
+
+    // Phases relative to the start of the row, in [0, 1)
+    double phase = 0.0;
+    for (int x = 0; x < this->IMAGE_SIZE_X_PIXELS; ++x) {
+      const int cell = y * this->IMAGE_SIZE_X_PIXELS + x;
+      this->decode_cell(pixels[x], cell, output_sample_rate_hz);
+      this->start_phase[cell] = static_cast<float>(phase);
+
+      phase += static_cast<double>(this->phase_increment[cell]) *
+               samples_per_cell;
+      phase -= std::floor(phase);
+    }
+
+    this->row_start_phase[y] = phase;  // advance over the row for now
+  }
+}
+
+template <typename Config>
+void BasicImage2Audio<Config>::prepare_oscillators(const cv::Mat& image,
+                                                   int output_sample_rate_hz,
+                                                   int samples_per_cell) {
+  this->rendered_quality = 0;  // oscillators no longer match any render
+
+  cv::parallel_for_(cv::Range(0, this->IMAGE_SIZE_Y_PIXELS),
+                    [&](const cv::Range& rows) {
+                      this->decode_rows(image, rows, output_sample_rate_hz,
+                                        samples_per_cell);
+                    });
+
+  // Every row starts where the previous one ended
+  double phase = 0.0;
+  for (double& row_phase : this->row_start_phase) {
+    double row_advance = row_phase;
+    row_phase = phase;
+    phase += row_advance;
+    phase -= std::floor(phase);
+  }
+}
+
+template <typename Config>
+void BasicImage2Audio<Config>::render_rows(const cv::Range& rows,
+                                           int samples_per_cell, int first_row,
+                                           float* out) {
+  for (int y = rows.start; y < rows.end; ++y) {
+    const int first_cell = y * this->IMAGE_SIZE_X_PIXELS;
+
+    // Shift the row onto the phase where the previous row ended
+    for (int cell = first_cell; cell < first_cell + this->IMAGE_SIZE_X_PIXELS;
+         ++cell) {
+      double phase = this->start_phase[cell] + this->row_start_phase[y];
+      this->start_phase[cell] = static_cast<float>(phase - std::floor(phase));
+    }
+
+    float* row_samples = out + static_cast<size_t>(y - first_row) *
+                                   this->IMAGE_SIZE_X_PIXELS * samples_per_cell;
+    synthesize_sine_segments_batch(this->start_phase.data() + first_cell,
+                                   this->phase_increment.data() + first_cell,
+                                   this->amplitude.data() + first_cell,
+                                   this->IMAGE_SIZE_X_PIXELS, samples_per_cell,
+                                   row_samples);
+  }
+}
+
+template <typename Config>
+void BasicImage2Audio<Config>::resynthesize_cells(const cv::Mat& image,
+                                                  const CellRange& cells,
+                                                  int output_sample_rate_hz,
+                                                  int samples_per_cell,
+                                                  float* out) {
+  const int first_cell = cells.first_cell;
+  const int end_cell = std::min(cells.end_cell, this->TOTAL_PIXELS);
+  if (first_cell >= end_cell) {
+    return;
+  }
+
+  for (int cell = first_cell; cell < end_cell; ++cell) {
+    const int y = cell / this->IMAGE_SIZE_X_PIXELS;
+    const int x = cell % this->IMAGE_SIZE_X_PIXELS;
+    this->decode_cell(image.ptr<cv::Vec3b>(y)[x], cell, output_sample_rate_hz);
+  }
+
+  // The previous render keeps its phase at both ends of the range: spread
+  // the drift the new frequencies cause over the range, at most half a turn
+  const double range_start_phase = this->start_phase[first_cell];
+  if (end_cell < this->TOTAL_PIXELS) {
+    double phase = range_start_phase;
+    for (int cell = first_cell; cell < end_cell; ++cell) {
+      phase += static_cast<double>(this->phase_increment[cell]) *
+               samples_per_cell;
+    }
+    double drift = this->start_phase[end_cell] - phase;
+    drift -= std::round(drift);
+
+    const double range_samples =
+        static_cast<double>(end_cell - first_cell) * samples_per_cell;
+    const float correction = static_cast<float>(drift / range_samples);
+    for (int cell = first_cell; cell < end_cell; ++cell) {
+      this->phase_increment[cell] += correction;
+    }
+  }
+
+  double phase = range_start_phase;
+  for (int cell = first_cell; cell < end_cell; ++cell) {
+    this->start_phase[cell] = static_cast<float>(phase - std::floor(phase));
+    phase += static_cast<double>(this->phase_increment[cell]) *
+             samples_per_cell;
+  }
+
+  // Rendered a row's worth of cells per stripe
+  const int num_stripes =
+      (end_cell - first_cell + this->IMAGE_SIZE_X_PIXELS - 1) /
+      this->IMAGE_SIZE_X_PIXELS;
+  cv::parallel_for_(cv::Range(0, num_stripes), [&](const cv::Range& stripes) {
+    for (int stripe = stripes.start; stripe < stripes.end; ++stripe) {
+      const int cell = first_cell + stripe * this->IMAGE_SIZE_X_PIXELS;
+      const int num_cells =
+          std::min(this->IMAGE_SIZE_X_PIXELS, end_cell - cell);
+      synthesize_sine_segments_batch(
+          this->start_phase.data() + cell, this->phase_increment.data() + cell,
+          this->amplitude.data() + cell, num_cells, samples_per_cell,
+          out + static_cast<size_t>(cell) * samples_per_cell);
+    }
+  });
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+template <typename Config>
+BasicImage2Audio<Config>::BasicImage2Audio()
+    : start_phase(TOTAL_PIXELS),
+      phase_increment(TOTAL_PIXELS),
+      amplitude(TOTAL_PIXELS),
+      row_start_phase(IMAGE_SIZE_Y_PIXELS) {
+  // Inverse of blue = F * 255 / MAX_FREQUENCY and of the red level, see
+  // normalize_to_pixel_values_batch. Red 0 is the floor of the scale, silence
+  for (int value = 0; value < 256; ++value) {
+    this->blue_to_frequency_hz[value] =
+        value * MAX_FREQUENCY_IN_AUDIO_SIGNAL_HZ / MAX_PIXEL_VALUE;
+    this->red_to_amplitude[value] =
+        (value == 0) ? 0.0f
+                     : std::exp2(value / RED_LEVELS_PER_OCTAVE -
+                                 RED_AMPLITUDE_OCTAVES);
+  }
+
+  // Sized on the first export, then reused
+  this->chunk_pool.reserve(this->CHUNK_QUEUE_CAPACITY + 2,
+                           [](std::vector<float>&) {});
+}
+
+template <typename Config>
+IMAGE2AUDIO_RET_T BasicImage2Audio<Config>::image_to_audio(
+    const cv::Mat& image, AudioBuffer& audio, int quality) {
+  IMAGE2AUDIO_RET_T input_status = this->check_input(image, quality);
+  if (input_status != IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO) {
+    return input_status;
+  }
+
+  const int output_sample_rate_hz = this->SAMPLE_RATE_HZ * quality;
+  const int samples_per_cell = this->NUM_SAMPLES_PER_SEGMENT * quality;
+  audio.sample_rate_hz = output_sample_rate_hz;
+  audio.samples.resize(static_cast<size_t>(this->TOTAL_PIXELS) *
+                       samples_per_cell);
+
+  this->prepare_oscillators(image, output_sample_rate_hz, samples_per_cell);
+
+  cv::parallel_for_(cv::Range(0, this->IMAGE_SIZE_Y_PIXELS),
+                    [&](const cv::Range& rows) {
+                      this->render_rows(rows, samples_per_cell, 0,
+                                        audio.samples.data());
+                    });
+
+  this->rendered_quality = quality;
+  return IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO;
+}
+
+template <typename Config>
+IMAGE2AUDIO_RET_T BasicImage2Audio<Config>::export_image_to_audio_file(
+    const cv::Mat& image, std::string filename, int quality) {
+  if (!(std::regex_match(filename, audio_file_regex.WAV) ||
+        std::regex_match(filename, audio_file_regex.FLAC))) {
+    LOG_ERROR("INVALID AUDIO FILE TYPE");
+    return IMAGE2AUDIO_RET_T::INVALID_AUDIO_FILE_TYPE;
+  }
+
+  IMAGE2AUDIO_RET_T input_status = this->check_input(image, quality);
+  if (input_status != IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO) {
+    return input_status;
+  }
+
+  const int output_sample_rate_hz = this->SAMPLE_RATE_HZ * quality;
+  const int samples_per_cell = this->NUM_SAMPLES_PER_SEGMENT * quality;
+
+  AudioFileEncoder encoder;
+  IMAGE2AUDIO_RET_T export_status =
+      encoder.open(filename, output_sample_rate_hz);
+  if (export_status != IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+    return export_status;
+  }
+
+  this->prepare_oscillators(image, output_sample_rate_hz, samples_per_cell);
+
+  // The encoder thread compresses chunk k while chunk k + 1 is rendered; on
+  // an error it closes the queue, which stops the rendering
+  BoundedQueue<std::vector<float>*> chunk_queue(this->CHUNK_QUEUE_CAPACITY);
+  std::thread encoder_thread([&] {
+    while (std::optional<std::vector<float>*> chunk = chunk_queue.pop()) {
+      if (export_status == IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+        export_status = encoder.write((*chunk)->data(),
+                                      static_cast<int>((*chunk)->size()));
+        if (export_status != IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+          chunk_queue.close();
+        }
+      }
+      this->chunk_pool.release(*chunk);
+    }
+  });
+
+  for (int first_row = 0; first_row < this->IMAGE_SIZE_Y_PIXELS;
+       first_row += this->ROWS_PER_CHUNK) {
+    const int end_row =
+        std::min(first_row + this->ROWS_PER_CHUNK, this->IMAGE_SIZE_Y_PIXELS);
+    std::vector<float>* chunk = this->chunk_pool.acquire();
+    chunk->resize(static_cast<size_t>(end_row - first_row) *
+                  this->IMAGE_SIZE_X_PIXELS * samples_per_cell);
+
+    cv::parallel_for_(cv::Range(first_row, end_row),
+                      [&](const cv::Range& rows) {
+                        this->render_rows(rows, samples_per_cell, first_row,
+                                          chunk->data());
+                      });
+
+    if (!chunk_queue.push(chunk)) {
+      this->chunk_pool.release(chunk);
+      break;
+    }
+  }
+
+  chunk_queue.close();
+  encoder_thread.join();
+  if (export_status != IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+    return export_status;
+  }
+
+  export_status = encoder.finish();
+  if (export_status == IMAGE2AUDIO_RET_T::GOOD_EXPORT) {
+    this->rendered_quality = quality;
+  }
+  return export_status;
+}
+
+template <typename Config>
+IMAGE2AUDIO_RET_T BasicImage2Audio<Config>::data_matrix_to_audio(
+    const SpectralMatrix& data_matrix, AudioBuffer& audio,
+    const BasicFilterChain<Config>* filters) {
+  constexpr int N = NUM_SAMPLES_PER_SEGMENT;
+  constexpr int NUM_BINS = N / 2 + 1;
+  if (data_matrix.sample_rate_hz() != this->SAMPLE_RATE_HZ ||
+      data_matrix.samples_per_segment() != N) {
+    LOG_ERROR("INVALID DATA MATRIX");
+    return IMAGE2AUDIO_RET_T::INVALID_DATA_MATRIX;
+  }
+
+  // x[n] = 1/N * sum over the full spectrum, the mirrored bins folded into
+  // the weights of the half spectrum
+  std::array<float, N * NUM_BINS> cos_table;
+  std::array<float, N * NUM_BINS> sin_table;
+  for (int n = 0; n < N; ++n) {
+    for (int k = 0; k < NUM_BINS; ++k) {
+      const double weight = (k == 0 || 2 * k == N) ? 1.0 : 2.0;
+      const double angle = 2.0 * M_PI * k * n / N;
+      cos_table[n * NUM_BINS + k] =
+          static_cast<float>(weight * std::cos(angle) / N);
+      sin_table[n * NUM_BINS + k] =
+          static_cast<float>(-weight * std::sin(angle) / N);
+    }
+  }
+
+  const int64_t num_segments = data_matrix.num_segments();
+  const int segments_per_chunk = data_matrix.segments_per_chunk();
+  const int64_t num_chunks =
+      (num_segments + segments_per_chunk - 1) / segments_per_chunk;
+  audio.sample_rate_hz = this->SAMPLE_RATE_HZ;
+  audio.samples.resize(static_cast<size_t>(num_segments) * N);
+
+  cv::parallel_for_(cv::Range(0, static_cast<int>(num_chunks)),
+                    [&](const cv::Range& chunks) {
+    std::vector<float> spectra(
+        static_cast<size_t>(segments_per_chunk) * 2 * NUM_BINS);
+
+    for (int chunk = chunks.start; chunk < chunks.end; ++chunk) {
+      const int64_t first_segment =
+          static_cast<int64_t>(chunk) * segments_per_chunk;
+      const int count = static_cast<int>(std::min<int64_t>(
+          segments_per_chunk, num_segments - first_segment));
+      data_matrix.read_segments(first_segment, count, spectra.data());
+      if (filters) {
+        filters->apply_to_spectra(first_segment, count, spectra.data());
+      }
+
+      for (int s = 0; s < count; ++s) {
+        const float* spectrum = spectra.data() + s * 2 * NUM_BINS;
+        float* out = audio.samples.data() + (first_segment + s) * N;
+        for (int n = 0; n < N; ++n) {
+          float sample = 0.0f;
+          for (int k = 0; k < NUM_BINS; ++k) {
+            sample += spectrum[2 * k] * cos_table[n * NUM_BINS + k] +
+                      spectrum[2 * k + 1] * sin_table[n * NUM_BINS + k];
+          }
+          out[n] = sample;
+        }
+      }
+    }
+  });
+
+  return IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO;
+}
+
+template <typename Config>
+IMAGE2AUDIO_RET_T BasicImage2Audio<Config>::update_audio(
+    const cv::Mat& image, const DirtyRegions& dirty, AudioBuffer& audio,
+    int quality) {
+  IMAGE2AUDIO_RET_T input_status = this->check_input(image, quality);
+  if (input_status != IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO) {
+    return input_status;
+  }
+
+  const int output_sample_rate_hz = this->SAMPLE_RATE_HZ * quality;
+  const int samples_per_cell = this->NUM_SAMPLES_PER_SEGMENT * quality;
+  if (this->rendered_quality != quality ||
+      audio.sample_rate_hz != output_sample_rate_hz ||
+      audio.samples.size() !=
+          static_cast<size_t>(this->TOTAL_PIXELS) * samples_per_cell) {
+    return this->image_to_audio(image, audio, quality);
+  }
+
+  for (const CellRange& cells : dirty.ranges()) {
+    this->resynthesize_cells(image, cells, output_sample_rate_hz,
+                             samples_per_cell, audio.samples.data());
+  }
+
+  return IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO;
+}
+
+template <typename Config>
+IMAGE2AUDIO_RET_T BasicImage2Audio<Config>::patch_exported_file(
+    const std::string& filename, const AudioBuffer& audio,
+    const DirtyRegions& dirty) {
+  if (!std::regex_match(filename, audio_file_regex.WAV)) {
+    return IMAGE2AUDIO_RET_T::CANNOT_PATCH_AUDIO_FILE;
+  }
+
+  int64_t data_offset = 0;
+  {
+    MappedPCMFile pcm_file;
+    if (!pcm_file.open(filename)) {
+      return IMAGE2AUDIO_RET_T::CANNOT_PATCH_AUDIO_FILE;
+    }
+    const PCMView& pcm = pcm_file.view();
+    if (pcm.encoding != PCM_ENCODING_T::SIGNED_16 || pcm.channels != 1 ||
+        pcm.big_endian || pcm.sample_rate != audio.sample_rate_hz ||
+        pcm.num_frames != static_cast<int64_t>(audio.samples.size())) {
+      return IMAGE2AUDIO_RET_T::CANNOT_PATCH_AUDIO_FILE;
+    }
+    data_offset = pcm_file.data_offset();
+  }
+
+  std::fstream file(filename, std::ios::in | std::ios::out | std::ios::binary);
+  if (!file) {
+    LOG_ERROR("ERROR WRITING AUDIO FILE");
+    return IMAGE2AUDIO_RET_T::ERROR_WRITING_AUDIO_FILE;
+  }
+
+  const size_t samples_per_cell = audio.samples.size() / this->TOTAL_PIXELS;
+  std::vector<int16_t> pcm_samples;
+  for (const CellRange& cells : dirty.ranges()) {
+    const size_t first_sample = cells.first_cell * samples_per_cell;
+    const size_t end_sample =
+        std::min<size_t>(cells.end_cell, this->TOTAL_PIXELS) *
+        samples_per_cell;
+    if (first_sample >= end_sample) {
+      continue;
+    }
+
+    // WAV samples are little-endian, like every target we build for
+    pcm_samples.resize(end_sample - first_sample);
+    for (size_t i = first_sample; i < end_sample; ++i) {
+      pcm_samples[i - first_sample] = to_pcm_s16(audio.samples[i]);
+    }
+    file.seekp(data_offset + static_cast<int64_t>(first_sample) * 2);
+    file.write(reinterpret_cast<const char*>(pcm_samples.data()),
+               static_cast<std::streamsize>(pcm_samples.size() * 2));
+  }
+
+  if (!file.flush()) {
+    LOG_ERROR("ERROR WRITING AUDIO FILE");
+    return IMAGE2AUDIO_RET_T::ERROR_WRITING_AUDIO_FILE;
+  }
+  return IMAGE2AUDIO_RET_T::GOOD_EXPORT;
+}
+
+template class BasicImage2Audio<Audio2ImageConfig<44100>>;
+template class BasicImage2Audio<Audio2ImageConfig<48000>>;
+template class BasicImage2Audio<Audio2ImageConfig<96000>>;
@@ -0,0 +1,452 @@
+#include "MappedPCMFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*==========================================
+=                 HELPERS                  =
+==========================================*/
+
+static uint16_t read_le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+static uint32_t read_le32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static uint16_t read_be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+
+static uint32_t read_be32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* AIFF stores its sample rate as an 80-bit IEEE 754 extended float */
+static double read_be_extended80(const uint8_t* p) {
+  int exponent = ((p[0] & 0x7F) << 8) | p[1];
+  uint64_t mantissa = 0;
+  for (int i = 0; i < 8; ++i) {
+    mantissa = (mantissa << 8) | p[2 + i];
+  }
+  if (exponent == 0 && mantissa == 0) {
+    return 0.0;
+  }
+  double value = std::ldexp(static_cast<double>(mantissa), exponent - 16383 - 63);
+  return (p[0] & 0x80) ? -value : value;
+}
+
+/* Average the channels of each frame, decode() turns one sample into a float */
+template <typename Decode>
+static void downmix_frames(const uint8_t* src, int num_frames, int channels,
+                           int frame_stride, int bytes_per_sample, float* out,
+                           Decode decode) {
+  const float channel_scale = 1.0f / channels;
+  for (int i = 0; i < num_frames; ++i) {
+    const uint8_t* frame = src + static_cast<size_t>(i) * frame_stride;
+    float sum = 0.0f;
+    for (int c = 0; c < channels; ++c) {
+      sum += decode(frame + c * bytes_per_sample);
+    }
+    out[i] = sum * channel_scale;
+  }
+}
+
+/* Packed little-endian 16-bit mono, 8 samples per iteration */
+static void convert_s16_mono(const uint8_t* src, int num_frames, float* out) {
+  const float scale = 1.0f / 32768.0f;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 v_scale = _mm_set1_ps(scale);
+  for (; i + 8 <= num_frames; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+    // Sign-extend to 32 bits by shifting the duplicated halves back down
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), v_scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), v_scale));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    out[i] = static_cast<int16_t>(read_le16(src + 2 * i)) * scale;
+  }
+}
+
+/* Packed little-endian 16-bit stereo, downmixed 4 frames per iteration */
+static void convert_s16_stereo(const uint8_t* src, int num_frames, float* out) {
+  const float scale = 0.5f / 32768.0f;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 v_scale = _mm_set1_ps(scale);
+  const __m128i ones = _mm_set1_epi16(1);
+  for (; i + 4 <= num_frames; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+    // L * 1 + R * 1 for each frame, as 32-bit integers
+    __m128i sums = _mm_madd_epi16(v, ones);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(sums), v_scale));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    int left = static_cast<int16_t>(read_le16(src + 4 * i));
+    int right = static_cast<int16_t>(read_le16(src + 4 * i + 2));
+    out[i] = (left + right) * scale;
+  }
+}
+
+/* Packed little-endian 32-bit mono, 4 samples per iteration */
+static void convert_s32_mono(const uint8_t* src, int num_frames, float* out) {
+  const float scale = 1.0f / 2147483648.0f;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 v_scale = _mm_set1_ps(scale);
+  for (; i + 4 <= num_frames; i += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), v_scale));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    out[i] = static_cast<int32_t>(read_le32(src + 4 * i)) * scale;
+  }
+}
+
+/* Packed little-endian 32-bit stereo, downmixed 4 frames per iteration */
+static void convert_s32_stereo(const uint8_t* src, int num_frames,
+                               float* out) {
+  const float scale = 1.0f / 2147483648.0f;
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 v_scale = _mm_set1_ps(scale);
+  const __m128 half = _mm_set1_ps(0.5f);
+  for (; i + 4 <= num_frames; i += 4) {
+    const __m128i* frames = reinterpret_cast<const __m128i*>(src + 8 * i);
+    __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(frames)), v_scale);
+    __m128 b =
+        _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(frames + 1)), v_scale);
+    // Even lanes are left samples, odd lanes right samples
+    __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(left, right), half));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    float left = static_cast<int32_t>(read_le32(src + 8 * i)) * scale;
+    float right = static_cast<int32_t>(read_le32(src + 8 * i + 4)) * scale;
+    out[i] = (left + right) * 0.5f;
+  }
+}
+
+/* Packed little-endian float stereo, downmixed 4 frames per iteration. Mono
+ * float is a plain copy. */
+static void convert_f32_stereo(const uint8_t* src, int num_frames,
+                               float* out) {
+  int i = 0;
+#if defined(__SSE2__)
+  const __m128 half = _mm_set1_ps(0.5f);
+  for (; i + 4 <= num_frames; i += 4) {
+    const float* frames = reinterpret_cast<const float*>(src + 8 * i);
+    __m128 a = _mm_loadu_ps(frames);
+    __m128 b = _mm_loadu_ps(frames + 4);
+    __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(left, right), half));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    float left, right;
+    std::memcpy(&left, src + 8 * i, sizeof(left));
+    std::memcpy(&right, src + 8 * i + 4, sizeof(right));
+    out[i] = (left + right) * 0.5f;
+  }
+}
+
+static int bytes_per_sample(PCM_ENCODING_T encoding) {
+  switch (encoding) {
+    case PCM_ENCODING_T::UNSIGNED_8:
+    case PCM_ENCODING_T::SIGNED_8:
+      return 1;
+    case PCM_ENCODING_T::SIGNED_16:
+      return 2;
+    case PCM_ENCODING_T::SIGNED_24:
+      return 3;
+    case PCM_ENCODING_T::SIGNED_32:
+    case PCM_ENCODING_T::FLOAT_32:
+      return 4;
+  }
+  return 0;
+}
+
+/* Averages the first channels of each frame of src, any encoding */
+static void decode_frames(const PCMView& pcm, const uint8_t* src,
+                          int num_frames, int channels, float* out) {
+  const bool be = pcm.big_endian;
+  switch (pcm.encoding) {
+    case PCM_ENCODING_T::UNSIGNED_8:
+      downmix_frames(src, num_frames, channels, pcm.frame_stride, 1, out,
+                     [](const uint8_t* p) { return (p[0] - 128) / 128.0f; });
+      break;
+    case PCM_ENCODING_T::SIGNED_8:
+      downmix_frames(src, num_frames, channels, pcm.frame_stride, 1, out,
+                     [](const uint8_t* p) {
+                       return static_cast<int8_t>(p[0]) / 128.0f;
+                     });
+      break;
+    case PCM_ENCODING_T::SIGNED_16:
+      downmix_frames(src, num_frames, channels, pcm.frame_stride, 2, out,
+                     [be](const uint8_t* p) {
+                       uint16_t raw = be ? read_be16(p) : read_le16(p);
+                       return static_cast<int16_t>(raw) / 32768.0f;
+                     });
+      break;
+    case PCM_ENCODING_T::SIGNED_24:
+      downmix_frames(src, num_frames, channels, pcm.frame_stride, 3, out,
+                     [be](const uint8_t* p) {
+                       uint32_t raw = be ? (p[0] << 16) | (p[1] << 8) | p[2]
+                                         : (p[2] << 16) | (p[1] << 8) | p[0];
+                       // Move the sign bit to the top, then shift back down
+                       int32_t value = static_cast<int32_t>(raw << 8) >> 8;
+                       return value / 8388608.0f;
+                     });
+      break;
+    case PCM_ENCODING_T::SIGNED_32:
+      downmix_frames(src, num_frames, channels, pcm.frame_stride, 4, out,
+                     [be](const uint8_t* p) {
+                       uint32_t raw = be ? read_be32(p) : read_le32(p);
+                       return static_cast<int32_t>(raw) / 2147483648.0f;
+                     });
+      break;
+    case PCM_ENCODING_T::FLOAT_32:
+      downmix_frames(src, num_frames, channels, pcm.frame_stride, 4, out,
+                     [](const uint8_t* p) {
+                       float value;
+                       std::memcpy(&value, p, sizeof(value));
+                       return value;
+                     });
+      break;
+  }
+}
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+bool MappedPCMFile::parse_wav(const uint8_t* file, size_t size) {
+  if (size < 12 || std::memcmp(file, "RIFF", 4) != 0 ||
+      std::memcmp(file + 8, "WAVE", 4) != 0) {
+    return false;
+  }
+
+  int format = 0, bits = 0, block_align = 0;
+  bool have_fmt = false;
+  size_t offset = 12;
+  while (offset + 8 <= size) {
+    const uint8_t* chunk = file + offset;
+    size_t chunk_size = read_le32(chunk + 4);
+    const uint8_t* body = chunk + 8;
+
+    if (std::memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 &&
+        offset + 8 + chunk_size <= size) {
+      format = read_le16(body);
+      this->pcm.channels = read_le16(body + 2);
+      this->pcm.sample_rate = static_cast<int>(read_le32(body + 4));
+      block_align = read_le16(body + 12);
+      bits = read_le16(body + 14);
+      // WAVE_FORMAT_EXTENSIBLE, the real format leads the subformat GUID
+      if (format == 0xFFFE && chunk_size >= 26) {
+        format = read_le16(body + 24);
+      }
+      have_fmt = true;
+    } else if (std::memcmp(chunk, "data", 4) == 0 && have_fmt) {
+      chunk_size = std::min(chunk_size, size - offset - 8);
+      this->pcm.data = body;
+      this->pcm.frame_stride = block_align;
+      this->pcm.num_frames = block_align > 0 ? chunk_size / block_align : 0;
+      break;
+    }
+
+    offset += 8 + chunk_size + (chunk_size & 1);  // chunks are word aligned
+  }
+
+  if (!this->pcm.data || this->pcm.channels <= 0 || this->pcm.sample_rate <= 0 ||
+      block_align < this->pcm.channels * bits / 8) {
+    return false;
+  }
+
+  this->pcm.big_endian = false;
+  if (format == 1 && bits == 8) {
+    this->pcm.encoding = PCM_ENCODING_T::UNSIGNED_8;
+  } else if (format == 1 && bits == 16) {
+    this->pcm.encoding = PCM_ENCODING_T::SIGNED_16;
+  } else if (format == 1 && bits == 24) {
+    this->pcm.encoding = PCM_ENCODING_T::SIGNED_24;
+  } else if (format == 1 && bits == 32) {
+    this->pcm.encoding = PCM_ENCODING_T::SIGNED_32;
+  } else if (format == 3 && bits == 32) {
+    this->pcm.encoding = PCM_ENCODING_T::FLOAT_32;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool MappedPCMFile::parse_aiff(const uint8_t* file, size_t size) {
+  if (size < 12 || std::memcmp(file, "FORM", 4) != 0 ||
+      std::memcmp(file + 8, "AIFF", 4) != 0) {
+    return false;
+  }
+
+  int bits = 0;
+  int64_t comm_frames = 0;
+  bool have_comm = false;
+  size_t offset = 12;
+  while (offset + 8 <= size) {
+    const uint8_t* chunk = file + offset;
+    size_t chunk_size = read_be32(chunk + 4);
+    const uint8_t* body = chunk + 8;
+
+    if (std::memcmp(chunk, "COMM", 4) == 0 && chunk_size >= 18 &&
+        offset + 8 + chunk_size <= size) {
+      this->pcm.channels = read_be16(body);
+      comm_frames = read_be32(body + 2);
+      bits = read_be16(body + 6);
+      this->pcm.sample_rate =
+          static_cast<int>(std::lround(read_be_extended80(body + 8)));
+      have_comm = true;
+    } else if (std::memcmp(chunk, "SSND", 4) == 0 && chunk_size >= 8) {
+      size_t data_offset = read_be32(body);
+      this->pcm.data = body + 8 + data_offset;
+      size_t available = size - std::min(size, offset + 16 + data_offset);
+      this->pcm.num_frames = static_cast<int64_t>(
+          std::min(available, chunk_size - std::min(chunk_size, 8 + data_offset)));
+    }
+
+    offset += 8 + chunk_size + (chunk_size & 1);
+  }
+
+  if (!have_comm || !this->pcm.data || this->pcm.channels <= 0 ||
+      this->pcm.sample_rate <= 0) {
+    return false;
+  }
+
+  this->pcm.big_endian = true;
+  if (bits == 8) {
+    this->pcm.encoding = PCM_ENCODING_T::SIGNED_8;
+  } else if (bits == 16) {
+    this->pcm.encoding = PCM_ENCODING_T::SIGNED_16;
+  } else if (bits == 24) {
+    this->pcm.encoding = PCM_ENCODING_T::SIGNED_24;
+  } else if (bits == 32) {
+    this->pcm.encoding = PCM_ENCODING_T::SIGNED_32;
+  } else {
+    return false;
+  }
+
+  // SSND holds bytes until here, turn it into whole frames
+  this->pcm.frame_stride = this->pcm.channels * bits / 8;
+  this->pcm.num_frames =
+      std::min(comm_frames, this->pcm.num_frames / this->pcm.frame_stride);
+  return true;
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+MappedPCMFile::~MappedPCMFile() { this->close(); }
+
+bool MappedPCMFile::open(const std::string& filename) {
+  this->close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size < 12) {
+    ::close(fd);
+    return false;
+  }
+
+  this->mapping_size = static_cast<size_t>(file_stat.st_size);
+  this->mapping =
+      mmap(nullptr, this->mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);  // the mapping keeps the file alive
+  if (this->mapping == MAP_FAILED) {
+    this->mapping = nullptr;
+    return false;
+  }
+  madvise(this->mapping, this->mapping_size, MADV_SEQUENTIAL);
+
+  const uint8_t* file = static_cast<const uint8_t*>(this->mapping);
+  if (!this->parse_wav(file, this->mapping_size) &&
+      !this->parse_aiff(file, this->mapping_size)) {
+    this->close();
+    return false;
+  }
+
+  return true;
+}
+
+void MappedPCMFile::close() {
+  if (this->mapping) {
+    munmap(this->mapping, this->mapping_size);
+  }
+  this->mapping = nullptr;
+  this->mapping_size = 0;
+  this->pcm = PCMView();
+}
+
+void MappedPCMFile::read_mono(int64_t first_frame, int num_frames,
+                              float* out) const {
+  const int available = static_cast<int>(
+      std::clamp<int64_t>(this->pcm.num_frames - first_frame, 0, num_frames));
+  const uint8_t* src =
+      this->pcm.data + std::max<int64_t>(first_frame, 0) * this->pcm.frame_stride;
+  const int channels = this->pcm.channels;
+  const int stride = this->pcm.frame_stride;
+
+  // Packed little-endian mono and stereo in 16, 32-bit or float have SIMD
+  // paths, everything else goes through the generic decode
+  const bool packed = !this->pcm.big_endian && channels <= 2 &&
+                      stride == bytes_per_sample(this->pcm.encoding) * channels;
+  if (packed && this->pcm.encoding == PCM_ENCODING_T::SIGNED_16) {
+    if (channels == 1) {
+      convert_s16_mono(src, available, out);
+    } else {
+      convert_s16_stereo(src, available, out);
+    }
+  } else if (packed && this->pcm.encoding == PCM_ENCODING_T::SIGNED_32) {
+    if (channels == 1) {
+      convert_s32_mono(src, available, out);
+    } else {
+      convert_s32_stereo(src, available, out);
+    }
+  } else if (packed && this->pcm.encoding == PCM_ENCODING_T::FLOAT_32) {
+    if (channels == 1) {
+      std::memcpy(out, src, static_cast<size_t>(available) * sizeof(float));
+    } else {
+      convert_f32_stereo(src, available, out);
+    }
+  } else {
+    decode_frames(this->pcm, src, available, channels, out);
+  }
+
+  std::fill(out + available, out + num_frames, 0.0f);
+}
+
+void MappedPCMFile::read_channel(int64_t first_frame, int num_frames,
+                                 int channel, float* out) const {
+  const int available = static_cast<int>(
+      std::clamp<int64_t>(this->pcm.num_frames - first_frame, 0, num_frames));
+  const uint8_t* src =
+      this->pcm.data +
+      std::max<int64_t>(first_frame, 0) * this->pcm.frame_stride +
+      channel * bytes_per_sample(this->pcm.encoding);
+
+  // A single channel is its own mean
+  decode_frames(this->pcm, src, available, 1, out);
+  std::fill(out + available, out + num_frames, 0.0f);
+}
@@ -0,0 +1,120 @@
+#include "MediaSession.h"
+
+#include <mutex>
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+MediaSession::~MediaSession() { this->close(); }
+
+AUDIO2IMAGE_RET_T MediaSession::open(const std::string& filename) {
+  this->close();
+
+  // Initialize FFmpeg once per process, not per file
+  static std::once_flag network_init_flag;
+  std::call_once(network_init_flag, [] { avformat_network_init(); });
+
+  if (avformat_open_input(&this->format_ctx, filename.c_str(), nullptr,
+                          nullptr) != 0) {
+    LOG_ERROR("FFMPEG ERROR OPENING AUDIO FILE");
+    return AUDIO2IMAGE_RET_T::FFMPEG_ERROR_OPENING_AUDIO_FILE;
+  }
+
+  // Streams the header already declares as something else than audio are
+  // dropped before probing, so not even stream info reads their packets
+  for (unsigned i = 0; i < this->format_ctx->nb_streams; ++i) {
+    AVStream* stream = this->format_ctx->streams[i];
+    if (stream->codecpar->codec_type != AVMEDIA_TYPE_UNKNOWN &&
+        stream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+      stream->discard = AVDISCARD_ALL;
+    }
+  }
+
+  if (avformat_find_stream_info(this->format_ctx, nullptr) < 0) {
+    LOG_ERROR("FFMPEG ERROR FINDING AUDIO STREAM INFO");
+    this->close();
+    return AUDIO2IMAGE_RET_T::FFMPEG_ERROR_FINDING_AUDIO_STREAM_INFO;
+  }
+
+  // The stream FFmpeg itself would play, not the first one with a decoder
+  const int stream_index = av_find_best_stream(
+      this->format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+  if (stream_index < 0) {
+    LOG_ERROR("FFMPEG AUDIO STREAM NOT FOUND");
+    this->close();
+    return AUDIO2IMAGE_RET_T::FFMPEG_AUDIO_STREAM_NOT_FOUND;
+  }
+  AVStream* stream = this->format_ctx->streams[stream_index];
+
+  // Only its packets are demuxed from here on
+  for (unsigned i = 0; i < this->format_ctx->nb_streams; ++i) {
+    this->format_ctx->streams[i]->discard =
+        (static_cast<int>(i) == stream_index) ? AVDISCARD_DEFAULT
+                                              : AVDISCARD_ALL;
+  }
+
+  const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+  if (!codec) {
+    LOG_ERROR("FFMPEG CODEC NOT FOUND");
+    this->close();
+    return AUDIO2IMAGE_RET_T::FFMPEG_CODEC_NOT_FOUND;
+  }
+
+  this->codec_ctx = avcodec_alloc_context3(codec);
+  if (!this->codec_ctx) {
+    LOG_ERROR("FFMPEG ERROR ALLOCATING CODEC CONTEXT");
+    this->close();
+    return AUDIO2IMAGE_RET_T::FFMPEG_ERROR_ALLOCATING_CODEC_CONTEXT;
+  }
+  if (avcodec_parameters_to_context(this->codec_ctx, stream->codecpar) < 0) {
+    LOG_ERROR("FFMPEG ERROR COPY CODEC PARAM TO CONTEXT");
+    this->close();
+    return AUDIO2IMAGE_RET_T::FFMPEG_ERROR_COPY_CODEC_PARAM_TO_CONTEXT;
+  }
+  if (avcodec_open2(this->codec_ctx, codec, nullptr) < 0) {
+    LOG_ERROR("FFMPEG CANNOT OPEN CODEC");
+    this->close();
+    return AUDIO2IMAGE_RET_T::FFMPEG_CANNOT_OPEN_CODEC;
+  }
+  this->audio_stream = stream;
+
+  // Container duration, or the stream's own when the container has none
+  if (this->format_ctx->duration != AV_NOPTS_VALUE) {
+    this->duration_sec =
+        static_cast<double>(this->format_ctx->duration) / AV_TIME_BASE;
+  } else if (this->audio_stream->duration != AV_NOPTS_VALUE) {
+    this->duration_sec = static_cast<double>(this->audio_stream->duration) *
+                         this->audio_stream->time_base.num /
+                         this->audio_stream->time_base.den;
+  }
+
+  return AUDIO2IMAGE_RET_T::GOOD_IMPORT;
+}
+
+void MediaSession::close() {
+  if (this->codec_ctx) {
+    avcodec_free_context(&this->codec_ctx);
+  }
+  if (this->format_ctx) {
+    avformat_close_input(&this->format_ctx);
+  }
+  this->audio_stream = nullptr;
+  this->duration_sec = -1.0;
+}
+
+AUDIO2IMAGE_RET_T MediaSession::seek(double start_sec) {
+  const AVRational sample_time_base = {1, this->codec_ctx->sample_rate};
+  int64_t seek_target =
+      av_rescale_q(std::llround(start_sec * this->codec_ctx->sample_rate),
+                   sample_time_base, this->audio_stream->time_base);
+
+  if (av_seek_frame(this->format_ctx, this->audio_stream->index, seek_target,
+                    AVSEEK_FLAG_BACKWARD) < 0) {
+    LOG_ERROR("CANNOT CLIP AUDIO FILE");
+    return AUDIO2IMAGE_RET_T::CANNOT_CLIP_AUDIO_FILE;
+  }
+  avcodec_flush_buffers(this->codec_ctx);
+
+  return AUDIO2IMAGE_RET_T::GOOD_IMPORT;
+}
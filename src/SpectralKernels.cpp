@@ -0,0 +1,600 @@
+#include "SpectralKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SPECTRAL_KERNELS_X86 1
+#endif
+
+/* log2(1 + t) on t in [0, 1), Chebyshev fit, |error| < 1.7e-5 */
+static constexpr float LOG2_C0 = 1.65146709e-05f;
+static constexpr float LOG2_C1 = 1.44149241f;
+static constexpr float LOG2_C2 = -0.706486449f;
+static constexpr float LOG2_C3 = 0.409470299f;
+static constexpr float LOG2_C4 = -0.187488605f;
+static constexpr float LOG2_C5 = 0.0430049578f;
+
+static constexpr float AMPLITUDE_EPSILON = 1e-10f;  // prevent log(0)
+
+/* sin(y) on |y| <= pi/2, Taylor series to y^11, |error| < 6e-8 */
+static constexpr float TWO_PI = 6.28318531f;
+static constexpr float SIN_C3 = -1.0f / 6.0f;
+static constexpr float SIN_C5 = 1.0f / 120.0f;
+static constexpr float SIN_C7 = -1.0f / 5040.0f;
+static constexpr float SIN_C9 = 1.0f / 362880.0f;
+static constexpr float SIN_C11 = -1.0f / 39916800.0f;
+
+/*==========================================
+=                  SCALAR                  =
+==========================================*/
+
+static inline float fast_log2(float x) {
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  float exponent = static_cast<float>(static_cast<int>(bits >> 23) - 127);
+  bits = (bits & 0x007FFFFF) | 0x3F800000;  // mantissa in [1, 2)
+  float t;
+  std::memcpy(&t, &bits, sizeof(t));
+  t -= 1.0f;
+  float p = LOG2_C5;
+  p = p * t + LOG2_C4;
+  p = p * t + LOG2_C3;
+  p = p * t + LOG2_C2;
+  p = p * t + LOG2_C1;
+  p = p * t + LOG2_C0;
+  return exponent + p;
+}
+
+/* FIXED_BINS > 0 replaces num_bins with a constant so the bin loop unrolls */
+template <int FIXED_BINS>
+static void average_scalar(const double* real, const double* imag,
+                           int num_segments, int num_bins, int first_segment,
+                           double* average_frequency,
+                           double* average_amplitude) {
+  if constexpr (FIXED_BINS > 0) {
+    num_bins = FIXED_BINS;
+  }
+  for (int s = first_segment; s < num_segments; ++s) {
+    double sum_frequency = 0;
+    double sum_magnitude = 0;
+    for (int k = 0; k < num_bins; ++k) {
+      double re = real[k * num_segments + s];
+      double im = imag[k * num_segments + s];
+      double magnitude = std::sqrt(re * re + im * im);
+      sum_magnitude += magnitude;
+      sum_frequency += k * magnitude;  // Weight frequency bins by magnitude
+    }
+    average_frequency[s] =
+        (sum_magnitude > 0) ? (sum_frequency / sum_magnitude) : 0;
+    average_amplitude[s] = (num_bins > 0) ? (sum_magnitude / num_bins) : 0;
+  }
+}
+
+static int normalize_scalar(const double* frequency, const double* amplitude,
+                            int first, int count, double frequency_scale,
+                            uint8_t* blue, uint8_t* red) {
+  int invalid = 0;
+  for (int i = first; i < count; ++i) {
+    if (amplitude[i] < -1.0 || amplitude[i] > 1.0) {
+      blue[i] = 0;
+      red[i] = 0;
+      invalid++;
+      continue;
+    }
+    int frequency_value = static_cast<int>(frequency[i] * frequency_scale);
+    float log_amplitude =
+        fast_log2(std::abs(static_cast<float>(amplitude[i])) + AMPLITUDE_EPSILON);
+    int amplitude_value = static_cast<int>(
+        (log_amplitude + RED_AMPLITUDE_OCTAVES) * RED_LEVELS_PER_OCTAVE);
+    blue[i] = static_cast<uint8_t>(std::clamp(frequency_value, 0, 255));
+    red[i] = static_cast<uint8_t>(std::clamp(amplitude_value, 0, 255));
+  }
+  return invalid;
+}
+
+/* sin(2 pi x) for x >= 0 given in turns */
+static inline float fast_sin_turns(float x) {
+  x -= static_cast<float>(static_cast<int>(x + 0.5f));  // [-0.5, 0.5]
+  // sin(2 pi (0.5 - x)) = sin(2 pi x) folds x into [-0.25, 0.25]
+  float folded = std::min(std::abs(x), 0.5f - std::abs(x));
+  float y = TWO_PI * std::copysign(folded, x);
+  float y2 = y * y;
+  float p = SIN_C11;
+  p = p * y2 + SIN_C9;
+  p = p * y2 + SIN_C7;
+  p = p * y2 + SIN_C5;
+  p = p * y2 + SIN_C3;
+  return y + y * y2 * p;
+}
+
+static void synthesize_scalar(const float* start_phase,
+                              const float* phase_increment,
+                              const float* amplitude, int segment,
+                              int first_sample, int samples_per_segment,
+                              float* out) {
+  for (int n = first_sample; n < samples_per_segment; ++n) {
+    out[n] = amplitude[segment] *
+             fast_sin_turns(start_phase[segment] + n * phase_increment[segment]);
+  }
+}
+
+static void apply_filter_lut_scalar(uint8_t* bgr, int first, int count,
+                                    const uint32_t* lut) {
+  for (int i = first; i < count; ++i) {
+    uint8_t* pixel = bgr + 3 * i;
+    uint32_t entry = lut[pixel[0]];
+    if ((entry >> 16) == 0) {
+      pixel[0] = pixel[1] = pixel[2] = 0;
+      continue;
+    }
+    int red = pixel[2] + static_cast<int>(entry & 0xFF) -
+              static_cast<int>((entry >> 8) & 0xFF);
+    pixel[2] = static_cast<uint8_t>(std::clamp(red, 0, 255));
+  }
+}
+
+/*==========================================
+=                   SSE2                   =
+==========================================*/
+
+#if defined(SPECTRAL_KERNELS_X86)
+
+template <int FIXED_BINS>
+static void average_sse2(const double* real, const double* imag,
+                         int num_segments, int num_bins,
+                         double* average_frequency, double* average_amplitude) {
+  if constexpr (FIXED_BINS > 0) {
+    num_bins = FIXED_BINS;
+  }
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d inv_bins = _mm_set1_pd(num_bins > 0 ? 1.0 / num_bins : 0.0);
+
+  int s = 0;
+  for (; s + 2 <= num_segments; s += 2) {
+    __m128d sum_frequency = zero;
+    __m128d sum_magnitude = zero;
+    for (int k = 0; k < num_bins; ++k) {
+      __m128d re = _mm_loadu_pd(real + k * num_segments + s);
+      __m128d im = _mm_loadu_pd(imag + k * num_segments + s);
+      __m128d magnitude =
+          _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(re, re), _mm_mul_pd(im, im)));
+      sum_magnitude = _mm_add_pd(sum_magnitude, magnitude);
+      sum_frequency = _mm_add_pd(
+          sum_frequency, _mm_mul_pd(_mm_set1_pd(static_cast<double>(k)), magnitude));
+    }
+    // Zero where there is no energy instead of dividing by zero
+    __m128d has_energy = _mm_cmpgt_pd(sum_magnitude, zero);
+    __m128d mean_bin = _mm_div_pd(
+        sum_frequency, _mm_or_pd(_mm_and_pd(has_energy, sum_magnitude),
+                                 _mm_andnot_pd(has_energy, _mm_set1_pd(1.0))));
+    _mm_storeu_pd(average_frequency + s, _mm_and_pd(has_energy, mean_bin));
+    _mm_storeu_pd(average_amplitude + s, _mm_mul_pd(sum_magnitude, inv_bins));
+  }
+
+  average_scalar<FIXED_BINS>(real, imag, num_segments, num_bins, s,
+                             average_frequency, average_amplitude);
+}
+
+static inline __m128 fast_log2_sse2(__m128 x) {
+  __m128i bits = _mm_castps_si128(x);
+  __m128 exponent = _mm_cvtepi32_ps(
+      _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+  __m128 t = _mm_castsi128_ps(_mm_or_si128(
+      _mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+  t = _mm_sub_ps(t, _mm_set1_ps(1.0f));
+  __m128 p = _mm_set1_ps(LOG2_C5);
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C4));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C3));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C2));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C1));
+  p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C0));
+  return _mm_add_ps(exponent, p);
+}
+
+/* Saturate 4 int32 lanes to 0-255, packed into the low bytes */
+static inline uint32_t saturate_to_bytes_sse2(__m128i as_int) {
+  __m128i as_16 = _mm_packs_epi32(as_int, as_int);
+  __m128i as_8 = _mm_packus_epi16(as_16, as_16);
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(as_8));
+}
+
+static int normalize_sse2(const double* frequency, const double* amplitude,
+                          int count, double frequency_scale, uint8_t* blue,
+                          uint8_t* red) {
+  const __m128d scale = _mm_set1_pd(frequency_scale);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d abs_mask_pd = _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFF));
+  int invalid = 0;
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128d a_lo = _mm_loadu_pd(amplitude + i);
+    __m128d a_hi = _mm_loadu_pd(amplitude + i + 2);
+    // Validity is decided in double precision, like the scalar path
+    __m128d bad_lo = _mm_cmpgt_pd(_mm_and_pd(a_lo, abs_mask_pd), one);
+    __m128d bad_hi = _mm_cmpgt_pd(_mm_and_pd(a_hi, abs_mask_pd), one);
+    __m128 bad = _mm_movelh_ps(_mm_castsi128_ps(_mm_shuffle_epi32(
+                                   _mm_castpd_si128(bad_lo), 0x08)),
+                               _mm_castsi128_ps(_mm_shuffle_epi32(
+                                   _mm_castpd_si128(bad_hi), 0x08)));
+    invalid += __builtin_popcount(_mm_movemask_ps(bad));
+
+    __m128 a = _mm_movelh_ps(_mm_cvtpd_ps(a_lo), _mm_cvtpd_ps(a_hi));
+
+    // Blue stays in double up to the truncation, so it matches the scalar path
+    __m128i blue_int = _mm_unpacklo_epi64(
+        _mm_cvttpd_epi32(_mm_mul_pd(_mm_loadu_pd(frequency + i), scale)),
+        _mm_cvttpd_epi32(_mm_mul_pd(_mm_loadu_pd(frequency + i + 2), scale)));
+    blue_int = _mm_andnot_si128(_mm_castps_si128(bad), blue_int);
+
+    __m128 log_amplitude = fast_log2_sse2(
+        _mm_add_ps(_mm_and_ps(a, abs_mask), _mm_set1_ps(AMPLITUDE_EPSILON)));
+    __m128 red_value = _mm_andnot_ps(
+        bad, _mm_mul_ps(_mm_add_ps(log_amplitude,
+                                   _mm_set1_ps(RED_AMPLITUDE_OCTAVES)),
+                        _mm_set1_ps(RED_LEVELS_PER_OCTAVE)));
+
+    uint32_t blue_bytes = saturate_to_bytes_sse2(blue_int);
+    uint32_t red_bytes = saturate_to_bytes_sse2(_mm_cvttps_epi32(red_value));
+    std::memcpy(blue + i, &blue_bytes, 4);
+    std::memcpy(red + i, &red_bytes, 4);
+  }
+
+  return invalid + normalize_scalar(frequency, amplitude, i, count,
+                                    frequency_scale, blue, red);
+}
+
+static inline __m128 fast_sin_turns_sse2(__m128 x) {
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  x = _mm_sub_ps(x, _mm_cvtepi32_ps(_mm_cvttps_epi32(
+                        _mm_add_ps(x, _mm_set1_ps(0.5f)))));
+  __m128 abs_x = _mm_and_ps(x, abs_mask);
+  __m128 folded = _mm_min_ps(abs_x, _mm_sub_ps(_mm_set1_ps(0.5f), abs_x));
+  __m128 y = _mm_mul_ps(_mm_set1_ps(TWO_PI),
+                        _mm_or_ps(folded, _mm_andnot_ps(abs_mask, x)));
+  __m128 y2 = _mm_mul_ps(y, y);
+  __m128 p = _mm_set1_ps(SIN_C11);
+  p = _mm_add_ps(_mm_mul_ps(p, y2), _mm_set1_ps(SIN_C9));
+  p = _mm_add_ps(_mm_mul_ps(p, y2), _mm_set1_ps(SIN_C7));
+  p = _mm_add_ps(_mm_mul_ps(p, y2), _mm_set1_ps(SIN_C5));
+  p = _mm_add_ps(_mm_mul_ps(p, y2), _mm_set1_ps(SIN_C3));
+  return _mm_add_ps(y, _mm_mul_ps(_mm_mul_ps(y, y2), p));
+}
+
+static void synthesize_sse2(const float* start_phase,
+                            const float* phase_increment,
+                            const float* amplitude, int num_segments,
+                            int samples_per_segment, float* out) {
+  const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  for (int s = 0; s < num_segments; ++s) {
+    const __m128 start = _mm_set1_ps(start_phase[s]);
+    const __m128 increment = _mm_set1_ps(phase_increment[s]);
+    const __m128 gain = _mm_set1_ps(amplitude[s]);
+    float* segment_out = out + static_cast<size_t>(s) * samples_per_segment;
+
+    int n = 0;
+    for (; n + 4 <= samples_per_segment; n += 4) {
+      __m128 index = _mm_add_ps(_mm_set1_ps(static_cast<float>(n)), lane);
+      __m128 phase = _mm_add_ps(start, _mm_mul_ps(index, increment));
+      _mm_storeu_ps(segment_out + n,
+                    _mm_mul_ps(gain, fast_sin_turns_sse2(phase)));
+    }
+    synthesize_scalar(start_phase, phase_increment, amplitude, s, n,
+                      samples_per_segment, segment_out);
+  }
+}
+
+/*==========================================
+=                   AVX2                   =
+==========================================*/
+
+template <int FIXED_BINS>
+__attribute__((target("avx2,fma"))) static void average_avx2(
+    const double* real, const double* imag, int num_segments, int num_bins,
+    double* average_frequency, double* average_amplitude) {
+  if constexpr (FIXED_BINS > 0) {
+    num_bins = FIXED_BINS;
+  }
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d inv_bins = _mm256_set1_pd(num_bins > 0 ? 1.0 / num_bins : 0.0);
+
+  int s = 0;
+  for (; s + 4 <= num_segments; s += 4) {
+    __m256d sum_frequency = zero;
+    __m256d sum_magnitude = zero;
+    for (int k = 0; k < num_bins; ++k) {
+      __m256d re = _mm256_loadu_pd(real + k * num_segments + s);
+      __m256d im = _mm256_loadu_pd(imag + k * num_segments + s);
+      __m256d magnitude = _mm256_sqrt_pd(
+          _mm256_fmadd_pd(re, re, _mm256_mul_pd(im, im)));
+      sum_magnitude = _mm256_add_pd(sum_magnitude, magnitude);
+      sum_frequency = _mm256_fmadd_pd(_mm256_set1_pd(static_cast<double>(k)),
+                                      magnitude, sum_frequency);
+    }
+    __m256d has_energy = _mm256_cmp_pd(sum_magnitude, zero, _CMP_GT_OQ);
+    __m256d mean_bin = _mm256_div_pd(
+        sum_frequency,
+        _mm256_blendv_pd(_mm256_set1_pd(1.0), sum_magnitude, has_energy));
+    _mm256_storeu_pd(average_frequency + s, _mm256_and_pd(has_energy, mean_bin));
+    _mm256_storeu_pd(average_amplitude + s,
+                     _mm256_mul_pd(sum_magnitude, inv_bins));
+  }
+
+  average_scalar<FIXED_BINS>(real, imag, num_segments, num_bins, s,
+                             average_frequency, average_amplitude);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256 fast_log2_avx2(
+    __m256 x) {
+  __m256i bits = _mm256_castps_si256(x);
+  __m256 exponent = _mm256_cvtepi32_ps(
+      _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+  __m256 t = _mm256_castsi256_ps(
+      _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+                      _mm256_set1_epi32(0x3F800000)));
+  t = _mm256_sub_ps(t, _mm256_set1_ps(1.0f));
+  __m256 p = _mm256_set1_ps(LOG2_C5);
+  p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(LOG2_C4));
+  p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(LOG2_C3));
+  p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(LOG2_C2));
+  p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(LOG2_C1));
+  p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(LOG2_C0));
+  return _mm256_add_ps(exponent, p);
+}
+
+/* Saturate 8 int32 lanes to 0-255, packed into 8 bytes */
+__attribute__((target("avx2,fma"))) static inline uint64_t
+saturate_to_bytes_avx2(__m256i as_int) {
+  __m128i as_16 = _mm_packs_epi32(_mm256_castsi256_si128(as_int),
+                                  _mm256_extracti128_si256(as_int, 1));
+  __m128i as_8 = _mm_packus_epi16(as_16, as_16);
+  return static_cast<uint64_t>(_mm_cvtsi128_si64(as_8));
+}
+
+__attribute__((target("avx2,fma"))) static int normalize_avx2(
+    const double* frequency, const double* amplitude, int count,
+    double frequency_scale, uint8_t* blue, uint8_t* red) {
+  const __m256d scale = _mm256_set1_pd(frequency_scale);
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d abs_mask_pd =
+      _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFF));
+  int invalid = 0;
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256d a_lo = _mm256_loadu_pd(amplitude + i);
+    __m256d a_hi = _mm256_loadu_pd(amplitude + i + 4);
+    __m256d bad_lo =
+        _mm256_cmp_pd(_mm256_and_pd(a_lo, abs_mask_pd), one, _CMP_GT_OQ);
+    __m256d bad_hi =
+        _mm256_cmp_pd(_mm256_and_pd(a_hi, abs_mask_pd), one, _CMP_GT_OQ);
+    int bad_bits = _mm256_movemask_pd(bad_lo) | (_mm256_movemask_pd(bad_hi) << 4);
+    invalid += __builtin_popcount(bad_bits);
+    // Expand the 8 lane bits back into a float mask
+    __m256i lane_bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256 bad = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+        _mm256_and_si256(_mm256_set1_epi32(bad_bits), lane_bit), lane_bit));
+
+    __m256 a = _mm256_set_m128(_mm256_cvtpd_ps(a_hi), _mm256_cvtpd_ps(a_lo));
+
+    // Blue stays in double up to the truncation, so it matches the scalar path
+    __m256i blue_int = _mm256_setr_m128i(
+        _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_loadu_pd(frequency + i), scale)),
+        _mm256_cvttpd_epi32(
+            _mm256_mul_pd(_mm256_loadu_pd(frequency + i + 4), scale)));
+    blue_int = _mm256_andnot_si256(_mm256_castps_si256(bad), blue_int);
+
+    __m256 log_amplitude = fast_log2_avx2(_mm256_add_ps(
+        _mm256_and_ps(a, abs_mask), _mm256_set1_ps(AMPLITUDE_EPSILON)));
+    __m256 red_value = _mm256_andnot_ps(
+        bad, _mm256_mul_ps(_mm256_add_ps(log_amplitude,
+                                         _mm256_set1_ps(RED_AMPLITUDE_OCTAVES)),
+                           _mm256_set1_ps(RED_LEVELS_PER_OCTAVE)));
+
+    uint64_t blue_bytes = saturate_to_bytes_avx2(blue_int);
+    uint64_t red_bytes = saturate_to_bytes_avx2(_mm256_cvttps_epi32(red_value));
+    std::memcpy(blue + i, &blue_bytes, 8);
+    std::memcpy(red + i, &red_bytes, 8);
+  }
+
+  return invalid + normalize_scalar(frequency, amplitude, i, count,
+                                    frequency_scale, blue, red);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256 fast_sin_turns_avx2(
+    __m256 x) {
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  x = _mm256_sub_ps(x, _mm256_floor_ps(_mm256_add_ps(x, _mm256_set1_ps(0.5f))));
+  __m256 abs_x = _mm256_and_ps(x, abs_mask);
+  __m256 folded =
+      _mm256_min_ps(abs_x, _mm256_sub_ps(_mm256_set1_ps(0.5f), abs_x));
+  __m256 y = _mm256_mul_ps(_mm256_set1_ps(TWO_PI),
+                           _mm256_or_ps(folded, _mm256_andnot_ps(abs_mask, x)));
+  __m256 y2 = _mm256_mul_ps(y, y);
+  __m256 p = _mm256_set1_ps(SIN_C11);
+  p = _mm256_fmadd_ps(p, y2, _mm256_set1_ps(SIN_C9));
+  p = _mm256_fmadd_ps(p, y2, _mm256_set1_ps(SIN_C7));
+  p = _mm256_fmadd_ps(p, y2, _mm256_set1_ps(SIN_C5));
+  p = _mm256_fmadd_ps(p, y2, _mm256_set1_ps(SIN_C3));
+  return _mm256_fmadd_ps(_mm256_mul_ps(y, y2), p, y);
+}
+
+__attribute__((target("avx2,fma"))) static void synthesize_avx2(
+    const float* start_phase, const float* phase_increment,
+    const float* amplitude, int num_segments, int samples_per_segment,
+    float* out) {
+  const __m256 lane =
+      _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+  for (int s = 0; s < num_segments; ++s) {
+    const __m256 start = _mm256_set1_ps(start_phase[s]);
+    const __m256 increment = _mm256_set1_ps(phase_increment[s]);
+    const __m256 gain = _mm256_set1_ps(amplitude[s]);
+    float* segment_out = out + static_cast<size_t>(s) * samples_per_segment;
+
+    int n = 0;
+    for (; n + 8 <= samples_per_segment; n += 8) {
+      __m256 index =
+          _mm256_add_ps(_mm256_set1_ps(static_cast<float>(n)), lane);
+      __m256 phase = _mm256_fmadd_ps(index, increment, start);
+      _mm256_storeu_ps(segment_out + n,
+                       _mm256_mul_ps(gain, fast_sin_turns_avx2(phase)));
+    }
+    synthesize_scalar(start_phase, phase_increment, amplitude, s, n,
+                      samples_per_segment, segment_out);
+  }
+}
+
+__attribute__((target("avx2,fma"))) static void apply_filter_lut_avx2(
+    uint8_t* bgr, int count, const uint32_t* lut) {
+  const __m256i pixel_offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+  const __m256i blue_green_mask = _mm256_set1_epi32(0xFFFF);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1);
+  // Low 3 bytes of every word, 12 bytes per 128-bit lane
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                        -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9,
+                                        10, 12, 13, 14, -1, -1, -1, -1);
+
+  // Every gathered word is one pixel plus the next blue, so the last pixel of
+  // the span is left to the scalar tail and the span is never overread
+  int i = 0;
+  for (; i + 9 <= count; i += 8) {
+    uint8_t* pixels = bgr + 3 * i;
+    __m256i words = _mm256_i32gather_epi32(
+        reinterpret_cast<const int*>(pixels), pixel_offsets, 1);
+    __m256i blue = _mm256_and_si256(words, byte_mask);
+    __m256i entry =
+        _mm256_i32gather_epi32(reinterpret_cast<const int*>(lut), blue, 4);
+
+    __m256i red = _mm256_and_si256(_mm256_srli_epi32(words, 16), byte_mask);
+    red = _mm256_add_epi32(red, _mm256_and_si256(entry, byte_mask));
+    red = _mm256_sub_epi32(
+        red, _mm256_and_si256(_mm256_srli_epi32(entry, 8), byte_mask));
+    red = _mm256_min_epi32(_mm256_max_epi32(red, zero), byte_mask);
+
+    __m256i keep = _mm256_cmpeq_epi32(_mm256_srli_epi32(entry, 16), one);
+    __m256i filtered = _mm256_or_si256(_mm256_and_si256(words, blue_green_mask),
+                                       _mm256_slli_epi32(red, 16));
+    filtered = _mm256_shuffle_epi8(_mm256_and_si256(filtered, keep), pack);
+
+    alignas(32) uint8_t packed[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(packed), filtered);
+    std::memcpy(pixels, packed, 12);
+    std::memcpy(pixels + 12, packed + 16, 12);
+  }
+
+  apply_filter_lut_scalar(bgr, i, count, lut);
+}
+
+static bool cpu_has_avx2() {
+  static const bool has_avx2 =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return has_avx2;
+}
+
+#endif  // SPECTRAL_KERNELS_X86
+
+template <int FIXED_BINS>
+static void average_dispatch(const double* real, const double* imag,
+                             int num_segments, int num_bins,
+                             double* average_frequency,
+                             double* average_amplitude) {
+#if defined(SPECTRAL_KERNELS_X86)
+  if (cpu_has_avx2()) {
+    average_avx2<FIXED_BINS>(real, imag, num_segments, num_bins,
+                             average_frequency, average_amplitude);
+  } else {
+    average_sse2<FIXED_BINS>(real, imag, num_segments, num_bins,
+                             average_frequency, average_amplitude);
+  }
+#else
+  average_scalar<FIXED_BINS>(real, imag, num_segments, num_bins, 0,
+                             average_frequency, average_amplitude);
+#endif
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+void compute_average_frequency_and_amplitude_batch(const double* real,
+                                                   const double* imag,
+                                                   int num_segments,
+                                                   int num_bins,
+                                                   double* average_frequency,
+                                                   double* average_amplitude) {
+  // Common segment sizes get a fully unrolled bin loop
+  switch (num_bins) {
+    case 8:
+      average_dispatch<8>(real, imag, num_segments, num_bins,
+                          average_frequency, average_amplitude);
+      break;
+    case 16:
+      average_dispatch<16>(real, imag, num_segments, num_bins,
+                           average_frequency, average_amplitude);
+      break;
+    case 32:
+      average_dispatch<32>(real, imag, num_segments, num_bins,
+                           average_frequency, average_amplitude);
+      break;
+    default:
+      average_dispatch<0>(real, imag, num_segments, num_bins,
+                          average_frequency, average_amplitude);
+      break;
+  }
+}
+
+int normalize_to_pixel_values_batch(const double* frequency,
+                                    const double* amplitude, int count,
+                                    double frequency_scale, uint8_t* blue,
+                                    uint8_t* red) {
+#if defined(SPECTRAL_KERNELS_X86)
+  if (cpu_has_avx2()) {
+    return normalize_avx2(frequency, amplitude, count, frequency_scale, blue,
+                          red);
+  }
+  return normalize_sse2(frequency, amplitude, count, frequency_scale, blue,
+                        red);
+#else
+  return normalize_scalar(frequency, amplitude, 0, count, frequency_scale, blue,
+                          red);
+#endif
+}
+
+void synthesize_sine_segments_batch(const float* start_phase,
+                                    const float* phase_increment,
+                                    const float* amplitude, int num_segments,
+                                    int samples_per_segment, float* out) {
+#if defined(SPECTRAL_KERNELS_X86)
+  if (cpu_has_avx2()) {
+    synthesize_avx2(start_phase, phase_increment, amplitude, num_segments,
+                    samples_per_segment, out);
+    return;
+  }
+  synthesize_sse2(start_phase, phase_increment, amplitude, num_segments,
+                  samples_per_segment, out);
+#else
+  for (int s = 0; s < num_segments; ++s) {
+    synthesize_scalar(start_phase, phase_increment, amplitude, s, 0,
+                      samples_per_segment,
+                      out + static_cast<size_t>(s) * samples_per_segment);
+  }
+#endif
+}
+
+void apply_filter_lut_span(uint8_t* bgr, int count, const uint32_t* lut) {
+#if defined(SPECTRAL_KERNELS_X86)
+  // SSE2 has no gather, the scalar table walk is as fast there
+  if (cpu_has_avx2()) {
+    apply_filter_lut_avx2(bgr, count, lut);
+    return;
+  }
+#endif
+  apply_filter_lut_scalar(bgr, 0, count, lut);
+}
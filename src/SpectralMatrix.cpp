@@ -0,0 +1,544 @@
+#include "SpectralMatrix.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static constexpr char SPECTRAL_MATRIX_MAGIC[8] = {'A', 'V', 'S', 'P',
+                                                  'E', 'C', 'D', '\0'};
+static constexpr uint32_t SPECTRAL_MATRIX_VERSION = 1;
+
+// Chunks start on a page boundary, for mmap and madvise
+static constexpr uint64_t DATA_ALIGNMENT = 4096;
+
+/*==========================================
+=                 HELPERS                  =
+==========================================*/
+
+static uint64_t align_up(uint64_t bytes) {
+  return (bytes + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+}
+
+static uint32_t segment_bytes_for(SPECTRUM_ENCODING_T encoding, int num_bins) {
+  switch (encoding) {
+    case SPECTRUM_ENCODING_T::FLOAT_32:
+      return num_bins * 2 * sizeof(float);
+    case SPECTRUM_ENCODING_T::FLOAT_16:
+      return num_bins * 2 * sizeof(uint16_t);
+    case SPECTRUM_ENCODING_T::QUANTIZED:
+      return sizeof(float) + num_bins * 2 * sizeof(int8_t);
+  }
+  return 0;
+}
+
+/* Round to nearest even, overflow to infinity, subnormals kept */
+static uint16_t float_to_half(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const int32_t float_exponent = (bits >> 23) & 0xFF;
+  uint32_t mantissa = bits & 0x7FFFFF;
+
+  if (float_exponent == 0xFF) {  // infinity or NaN
+    return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+  }
+
+  const int32_t exponent = float_exponent - 127 + 15;
+  if (exponent >= 31) {
+    return sign | 0x7C00;
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1))) {
+      ++half;
+    }
+    return sign | half;
+  }
+
+  // A carry out of the mantissa correctly bumps the exponent
+  uint32_t half = (exponent << 10) | (mantissa >> 13);
+  const uint32_t remainder = mantissa & 0x1FFF;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | half;
+}
+
+static float half_to_float(uint16_t half) {
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1F;
+  const uint32_t mantissa = half & 0x3FF;
+
+  uint32_t bits;
+  if (exponent == 0) {
+    const float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -value : value;
+  } else if (exponent == 31) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/* Sets the counts and offsets of a header written up to end_segment */
+static void complete_header(SpectralMatrixHeader& h, int64_t end_segment) {
+  h.num_segments = end_segment;
+  h.num_chunks =
+      (h.num_segments + h.segments_per_chunk - 1) / h.segments_per_chunk;
+  h.index_offset = h.data_offset + h.num_chunks * h.chunk_stride;
+}
+
+/* Index after the last chunk, then the header, of a completed header */
+static bool write_index_and_header(int fd, const SpectralMatrixHeader& h) {
+  std::vector<SpectralChunkEntry> index(h.num_chunks);
+  for (uint64_t chunk = 0; chunk < h.num_chunks; ++chunk) {
+    SpectralChunkEntry& entry = index[chunk];
+    entry.first_segment = chunk * h.segments_per_chunk;
+    entry.offset = h.data_offset + chunk * h.chunk_stride;
+    entry.num_segments = static_cast<uint32_t>(std::min<uint64_t>(
+        h.segments_per_chunk, h.num_segments - entry.first_segment));
+    entry.bytes = entry.num_segments * h.segment_bytes;
+  }
+
+  const size_t index_bytes = index.size() * sizeof(SpectralChunkEntry);
+  return pwrite(fd, index.data(), index_bytes, h.index_offset) ==
+             static_cast<ssize_t>(index_bytes) &&
+         ftruncate(fd, h.index_offset + index_bytes) == 0 &&
+         pwrite(fd, &h, sizeof(h), 0) == static_cast<ssize_t>(sizeof(h));
+}
+
+/* Bytes [offset, offset + size) of input_fd to the same place in output_fd,
+ * false if input_fd ends before them */
+static bool copy_bytes_at(int input_fd, int output_fd, uint64_t offset,
+                          uint64_t size) {
+  std::vector<uint8_t> buffer(1 << 20);
+  while (size > 0) {
+    const ssize_t read_bytes = pread(
+        input_fd, buffer.data(), std::min<uint64_t>(size, buffer.size()),
+        offset);
+    if (read_bytes <= 0) {
+      return false;
+    }
+    if (pwrite(output_fd, buffer.data(), read_bytes, offset) != read_bytes) {
+      return false;
+    }
+    offset += read_bytes;
+    size -= read_bytes;
+  }
+  return true;
+}
+
+/* Header of the finished file at fd, if it and its index describe the chunks
+ * a writer of layout would have written, checked like SpectralMatrix::open
+ * checks a file */
+static bool read_matching_header(int fd, const SpectralMatrixHeader& layout,
+                                 SpectralMatrixHeader& h) {
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      pread(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h))) {
+    return false;
+  }
+
+  // Counts are bounded by the file size before they are multiplied
+  const uint64_t file_size = static_cast<uint64_t>(file_stat.st_size);
+  const uint64_t segments_per_chunk = layout.segments_per_chunk;
+  bool valid =
+      std::memcmp(h.magic, layout.magic, sizeof(h.magic)) == 0 &&
+      h.version == layout.version && h.encoding == layout.encoding &&
+      h.sample_rate_hz == layout.sample_rate_hz &&
+      h.samples_per_segment == layout.samples_per_segment &&
+      h.num_bins == layout.num_bins &&
+      h.segment_bytes == layout.segment_bytes &&
+      h.segments_per_chunk == layout.segments_per_chunk &&
+      h.chunk_stride == layout.chunk_stride &&
+      h.data_offset == layout.data_offset && h.data_offset <= h.index_offset &&
+      h.index_offset <= file_size &&
+      h.num_chunks <=
+          (file_size - h.index_offset) / sizeof(SpectralChunkEntry) &&
+      h.num_chunks == h.num_segments / segments_per_chunk +
+                          (h.num_segments % segments_per_chunk != 0) &&
+      h.index_offset == h.data_offset + h.num_chunks * h.chunk_stride;
+  if (!valid) {
+    return false;
+  }
+
+  std::vector<SpectralChunkEntry> index(h.num_chunks);
+  const size_t index_bytes = index.size() * sizeof(SpectralChunkEntry);
+  valid = pread(fd, index.data(), index_bytes, h.index_offset) ==
+          static_cast<ssize_t>(index_bytes);
+  for (uint64_t chunk = 0; valid && chunk < h.num_chunks; ++chunk) {
+    const SpectralChunkEntry& entry = index[chunk];
+    valid = entry.first_segment == chunk * segments_per_chunk &&
+            entry.offset == h.data_offset + chunk * h.chunk_stride &&
+            entry.num_segments ==
+                std::min(segments_per_chunk,
+                         h.num_segments - entry.first_segment) &&
+            entry.bytes ==
+                static_cast<uint64_t>(entry.num_segments) * h.segment_bytes;
+  }
+  return valid;
+}
+
+/*==========================================
+=                  WRITER                  =
+==========================================*/
+
+SpectralMatrixWriter::~SpectralMatrixWriter() { this->close(); }
+
+uint64_t SpectralMatrixWriter::segment_offset(int64_t segment) const {
+  const uint64_t chunk = segment / this->header.segments_per_chunk;
+  const uint64_t index = segment % this->header.segments_per_chunk;
+  return this->header.data_offset + chunk * this->header.chunk_stride +
+         index * this->header.segment_bytes;
+}
+
+bool SpectralMatrixWriter::open(const std::string& filename,
+                                int sample_rate_hz, int samples_per_segment,
+                                SPECTRUM_ENCODING_T encoding,
+                                int segments_per_chunk) {
+  this->close();
+  if (sample_rate_hz <= 0 || samples_per_segment <= 0 ||
+      segments_per_chunk <= 0) {
+    return false;
+  }
+
+  this->fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (this->fd < 0) {
+    LOG_ERROR("CANNOT CREATE DATA MATRIX FILE");
+    return false;
+  }
+
+  SpectralMatrixHeader& h = this->header;
+  h = SpectralMatrixHeader{};
+  std::memcpy(h.magic, SPECTRAL_MATRIX_MAGIC, sizeof(h.magic));
+  h.version = SPECTRAL_MATRIX_VERSION;
+  h.encoding = encoding;
+  h.sample_rate_hz = sample_rate_hz;
+  h.samples_per_segment = samples_per_segment;
+  h.num_bins = samples_per_segment / 2 + 1;
+  h.segment_bytes = segment_bytes_for(encoding, h.num_bins);
+  h.segments_per_chunk = segments_per_chunk;
+  h.chunk_stride =
+      align_up(static_cast<uint64_t>(segments_per_chunk) * h.segment_bytes);
+  h.data_offset = align_up(sizeof(SpectralMatrixHeader));
+
+  this->end_segment = 0;
+  this->write_failed = false;
+  return true;
+}
+
+void SpectralMatrixWriter::write_segments(int64_t first_segment,
+                                          int num_segments, const double* real,
+                                          const double* imag, int stride,
+                                          std::vector<uint8_t>& encoded) {
+  if (this->fd < 0 || num_segments <= 0) {
+    return;
+  }
+
+  const int num_bins = this->header.num_bins;
+  const uint32_t segment_bytes = this->header.segment_bytes;
+  encoded.resize(static_cast<size_t>(num_segments) * segment_bytes);
+
+  for (int s = 0; s < num_segments; ++s) {
+    uint8_t* out = encoded.data() + static_cast<size_t>(s) * segment_bytes;
+
+    switch (this->header.encoding) {
+      case SPECTRUM_ENCODING_T::FLOAT_32:
+        for (int k = 0; k < num_bins; ++k) {
+          const float pair[2] = {static_cast<float>(real[k * stride + s]),
+                                 static_cast<float>(imag[k * stride + s])};
+          std::memcpy(out + k * sizeof(pair), pair, sizeof(pair));
+        }
+        break;
+
+      case SPECTRUM_ENCODING_T::FLOAT_16:
+        for (int k = 0; k < num_bins; ++k) {
+          const uint16_t pair[2] = {
+              float_to_half(static_cast<float>(real[k * stride + s])),
+              float_to_half(static_cast<float>(imag[k * stride + s]))};
+          std::memcpy(out + k * sizeof(pair), pair, sizeof(pair));
+        }
+        break;
+
+      case SPECTRUM_ENCODING_T::QUANTIZED: {
+        float scale = 0.0f;
+        for (int k = 0; k < num_bins; ++k) {
+          const float re = static_cast<float>(real[k * stride + s]);
+          const float im = static_cast<float>(imag[k * stride + s]);
+          scale = std::max({scale, std::fabs(re), std::fabs(im)});
+        }
+        std::memcpy(out, &scale, sizeof(scale));
+
+        const float to_level = scale > 0.0f ? 127.0f / scale : 0.0f;
+        int8_t* levels = reinterpret_cast<int8_t*>(out + sizeof(scale));
+        for (int k = 0; k < num_bins; ++k) {
+          levels[2 * k] = static_cast<int8_t>(
+              std::lrint(static_cast<float>(real[k * stride + s]) * to_level));
+          levels[2 * k + 1] = static_cast<int8_t>(
+              std::lrint(static_cast<float>(imag[k * stride + s]) * to_level));
+        }
+        break;
+      }
+    }
+  }
+
+  // One pwrite per chunk the segments fall in
+  const int segments_per_chunk = this->header.segments_per_chunk;
+  for (int s = 0; s < num_segments;) {
+    const int64_t segment = first_segment + s;
+    const int run = std::min<int64_t>(
+        num_segments - s, segments_per_chunk - segment % segments_per_chunk);
+    const size_t bytes = static_cast<size_t>(run) * segment_bytes;
+    const uint8_t* data =
+        encoded.data() + static_cast<size_t>(s) * segment_bytes;
+    if (pwrite(this->fd, data, bytes, this->segment_offset(segment)) !=
+        static_cast<ssize_t>(bytes)) {
+      this->write_failed = true;
+    }
+    s += run;
+  }
+
+  const int64_t end = first_segment + num_segments;
+  int64_t previous_end = this->end_segment.load();
+  while (previous_end < end &&
+         !this->end_segment.compare_exchange_weak(previous_end, end)) {
+  }
+}
+
+bool SpectralMatrixWriter::finish() {
+  if (this->fd < 0) {
+    return false;
+  }
+
+  complete_header(this->header, this->end_segment.load());
+  bool ok = !this->write_failed &&
+            write_index_and_header(this->fd, this->header);
+  if (!ok) {
+    LOG_ERROR("ERROR WRITING DATA MATRIX FILE");
+  }
+
+  ::close(this->fd);
+  this->fd = -1;
+  return ok;
+}
+
+bool SpectralMatrixWriter::save_copy(const std::string& filename) const {
+  if (!this->good()) {
+    return false;
+  }
+
+  int output_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (output_fd < 0) {
+    return false;
+  }
+
+  // This file ends with the last segment written, the rest of its chunk is
+  // left as a hole before the index of the copy
+  const int64_t end_segment = this->end_segment.load();
+  SpectralMatrixHeader h = this->header;
+  complete_header(h, end_segment);
+  const uint64_t end_offset =
+      end_segment > 0 ? this->segment_offset(end_segment - 1) + h.segment_bytes
+                      : h.data_offset;
+  bool ok = copy_bytes_at(this->fd, output_fd, h.data_offset,
+                          end_offset - h.data_offset) &&
+            write_index_and_header(output_fd, h);
+  ::close(output_fd);
+  return ok;
+}
+
+bool SpectralMatrixWriter::copy_segments_from(const std::string& filename) {
+  if (!this->good()) {
+    return false;
+  }
+
+  int input_fd = ::open(filename.c_str(), O_RDONLY);
+  if (input_fd < 0) {
+    return false;
+  }
+
+  // Same layout, so every chunk lands at the offset it had in the source
+  SpectralMatrixHeader source;
+  bool ok = read_matching_header(input_fd, this->header, source) &&
+            copy_bytes_at(input_fd, this->fd, source.data_offset,
+                          source.index_offset - source.data_offset);
+  ::close(input_fd);
+  if (!ok) {
+    return false;
+  }
+
+  const int64_t end = static_cast<int64_t>(source.num_segments);
+  int64_t previous_end = this->end_segment.load();
+  while (previous_end < end &&
+         !this->end_segment.compare_exchange_weak(previous_end, end)) {
+  }
+  return true;
+}
+
+void SpectralMatrixWriter::close() {
+  if (this->fd >= 0) {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+}
+
+/*==========================================
+=                  READER                  =
+==========================================*/
+
+SpectralMatrix::~SpectralMatrix() { this->close(); }
+
+void SpectralMatrix::close() {
+  if (this->mapping) {
+    munmap(this->mapping, this->mapping_size);
+    this->mapping = nullptr;
+    this->mapping_size = 0;
+  }
+  this->header = SpectralMatrixHeader{};
+  this->chunk_index = nullptr;
+}
+
+bool SpectralMatrix::open(const std::string& filename) {
+  this->close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(SpectralMatrixHeader)) {
+    ::close(fd);
+    return false;
+  }
+
+  this->mapping_size = static_cast<size_t>(file_stat.st_size);
+  this->mapping =
+      mmap(nullptr, this->mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);  // the mapping keeps the file alive
+  if (this->mapping == MAP_FAILED) {
+    this->mapping = nullptr;
+    return false;
+  }
+
+  const uint8_t* file = static_cast<const uint8_t*>(this->mapping);
+  SpectralMatrixHeader& h = this->header;
+  std::memcpy(&h, file, sizeof(h));
+
+  // Unfinished files have no index yet
+  bool valid =
+      std::memcmp(h.magic, SPECTRAL_MATRIX_MAGIC, sizeof(h.magic)) == 0 &&
+      h.version == SPECTRAL_MATRIX_VERSION && h.samples_per_segment > 0 &&
+      h.num_bins == h.samples_per_segment / 2 + 1 &&
+      h.segment_bytes == segment_bytes_for(h.encoding, h.num_bins) &&
+      h.segment_bytes > 0 && h.segments_per_chunk > 0 &&
+      h.index_offset % alignof(SpectralChunkEntry) == 0 &&
+      h.num_chunks ==
+          (h.num_segments + h.segments_per_chunk - 1) / h.segments_per_chunk &&
+      h.index_offset >= h.data_offset &&
+      h.index_offset + h.num_chunks * sizeof(SpectralChunkEntry) <=
+          this->mapping_size;
+
+  if (valid) {
+    this->chunk_index =
+        reinterpret_cast<const SpectralChunkEntry*>(file + h.index_offset);
+    for (uint64_t chunk = 0; valid && chunk < h.num_chunks; ++chunk) {
+      const SpectralChunkEntry& entry = this->chunk_index[chunk];
+      valid = entry.first_segment == chunk * h.segments_per_chunk &&
+              entry.bytes ==
+                  static_cast<uint64_t>(entry.num_segments) * h.segment_bytes &&
+              entry.offset + entry.bytes <= this->mapping_size;
+    }
+  }
+
+  if (!valid) {
+    LOG_ERROR("INVALID DATA MATRIX FILE");
+    this->close();
+    return false;
+  }
+
+  return true;
+}
+
+const uint8_t* SpectralMatrix::segment_data(int64_t segment) const {
+  const SpectralChunkEntry& entry =
+      this->chunk_index[segment / this->header.segments_per_chunk];
+  return static_cast<const uint8_t*>(this->mapping) + entry.offset +
+         (segment - entry.first_segment) * this->header.segment_bytes;
+}
+
+void SpectralMatrix::read_segments(int64_t first_segment, int num_segments,
+                                   float* out) const {
+  const int num_bins = this->header.num_bins;
+
+  for (int s = 0; s < num_segments; ++s, out += 2 * num_bins) {
+    const int64_t segment = first_segment + s;
+    if (segment < 0 ||
+        segment >= static_cast<int64_t>(this->header.num_segments)) {
+      std::fill(out, out + 2 * num_bins, 0.0f);
+      continue;
+    }
+
+    const uint8_t* data = this->segment_data(segment);
+    switch (this->header.encoding) {
+      case SPECTRUM_ENCODING_T::FLOAT_32:
+        std::memcpy(out, data, 2 * num_bins * sizeof(float));
+        break;
+
+      case SPECTRUM_ENCODING_T::FLOAT_16:
+        for (int i = 0; i < 2 * num_bins; ++i) {
+          uint16_t half;
+          std::memcpy(&half, data + i * sizeof(half), sizeof(half));
+          out[i] = half_to_float(half);
+        }
+        break;
+
+      case SPECTRUM_ENCODING_T::QUANTIZED: {
+        float scale;
+        std::memcpy(&scale, data, sizeof(scale));
+        const float to_value = scale / 127.0f;
+        const int8_t* levels =
+            reinterpret_cast<const int8_t*>(data + sizeof(scale));
+        for (int i = 0; i < 2 * num_bins; ++i) {
+          out[i] = levels[i] * to_value;
+        }
+        break;
+      }
+    }
+  }
+}
+
+void SpectralMatrix::prefetch(int64_t first_segment,
+                              int64_t num_segments) const {
+  const int64_t end_segment = std::min<int64_t>(
+      first_segment + num_segments, this->header.num_segments);
+  first_segment = std::max<int64_t>(first_segment, 0);
+  if (first_segment >= end_segment) {
+    return;
+  }
+
+  // Chunks are page aligned, so their range is too
+  const SpectralChunkEntry& first =
+      this->chunk_index[first_segment / this->header.segments_per_chunk];
+  const SpectralChunkEntry& last =
+      this->chunk_index[(end_segment - 1) / this->header.segments_per_chunk];
+  uint8_t* start = static_cast<uint8_t*>(this->mapping) + first.offset;
+  madvise(start, last.offset + last.bytes - first.offset, MADV_WILLNEED);
+}
@@ -0,0 +1,201 @@
+#include "TiledAudioImage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+/*==========================================
+=                 PRIVATE                  =
+==========================================*/
+
+std::string TiledAudioImage::spill_filename(int64_t tile_index) const {
+  return this->SPILL_DIRECTORY + "/tile_" + std::to_string(tile_index) +
+         ".bgr";
+}
+
+TiledAudioImage::Tile& TiledAudioImage::acquire_tile(int64_t tile_index) {
+  std::unique_lock<std::mutex> lock(this->tiles_mutex);
+
+  // Tiles are created in order, each one waiting for room
+  while (static_cast<int64_t>(this->tiles.size()) <= tile_index) {
+    this->tile_spilled.wait(lock, [this] {
+      return this->SPILL_DIRECTORY.empty() || this->spill_failed ||
+             this->resident_tiles < this->MAX_RESIDENT_TILES;
+    });
+    if (static_cast<int64_t>(this->tiles.size()) > tile_index) {
+      break;  // created by another writer while waiting
+    }
+
+    Tile& tile = this->tiles.emplace_back();
+    tile.image = cv::Mat::zeros(this->tile_rows, this->tile_cols, CV_8UC3);
+    ++this->resident_tiles;
+  }
+
+  return this->tiles[tile_index];
+}
+
+void TiledAudioImage::complete_tile(int64_t tile_index) {
+  std::unique_lock<std::mutex> lock(this->tiles_mutex);
+  this->tiles[tile_index].complete = true;
+  this->spill_complete_tiles(lock);
+}
+
+void TiledAudioImage::spill_complete_tiles(
+    std::unique_lock<std::mutex>& lock) {
+  if (this->SPILL_DIRECTORY.empty()) {
+    return;
+  }
+
+  // Oldest first, keeping a free slot for the tile being filled next
+  for (size_t i = 0; i < this->tiles.size() &&
+                     this->resident_tiles >= this->MAX_RESIDENT_TILES;
+       ++i) {
+    Tile& tile = this->tiles[i];
+    if (!tile.complete || tile.spilling || tile.image.empty()) {
+      continue;
+    }
+
+    // The file is written unlocked, complete tiles are no longer written to
+    tile.spilling = true;
+    cv::Mat image = tile.image;
+    lock.unlock();
+
+    std::ofstream file(this->spill_filename(i), std::ios::binary);
+    file.write(reinterpret_cast<const char*>(image.data),
+               static_cast<std::streamsize>(image.total() * image.elemSize()));
+    const bool written = static_cast<bool>(file);
+    file.close();
+
+    lock.lock();
+    tile.spilling = false;
+    if (!written) {
+      LOG_WARNING("Cannot spill audio image tiles, keeping them in memory");
+      this->spill_failed = true;
+      this->tile_spilled.notify_all();
+      return;
+    }
+    tile.spilled = true;
+    tile.image.release();
+    --this->resident_tiles;
+    this->tile_spilled.notify_all();
+  }
+}
+
+void TiledAudioImage::remove_spill_files() {
+  for (size_t i = 0; i < this->tiles.size(); ++i) {
+    if (this->tiles[i].spilled) {
+      std::remove(this->spill_filename(i).c_str());
+    }
+  }
+}
+
+/*==========================================
+=                  PUBLIC                  =
+==========================================*/
+
+TiledAudioImage::TiledAudioImage(std::string spill_directory,
+                                 size_t max_resident_tiles)
+    : SPILL_DIRECTORY(std::move(spill_directory)),
+      MAX_RESIDENT_TILES(std::max<size_t>(2, max_resident_tiles)) {}
+
+TiledAudioImage::~TiledAudioImage() { this->remove_spill_files(); }
+
+void TiledAudioImage::reset(int tile_cols, int tile_rows,
+                            double seconds_per_cell) {
+  std::lock_guard<std::mutex> lock(this->tiles_mutex);
+  this->remove_spill_files();
+  this->tiles.clear();
+  this->resident_tiles = 0;
+  this->spill_failed = false;
+  this->total_cells = 0;
+
+  this->tile_cols = tile_cols;
+  this->tile_rows = tile_rows;
+  this->tile_cells = tile_cols * tile_rows;
+  this->seconds_per_cell = seconds_per_cell;
+}
+
+void TiledAudioImage::write_cells(int64_t first_cell, int count,
+                                  const uint8_t* blue, const uint8_t* red) {
+  while (count > 0) {
+    const int64_t tile_index = first_cell / this->tile_cells;
+    const int cell = static_cast<int>(first_cell % this->tile_cells);
+    const int num_cells = std::min(count, this->tile_cells - cell);
+
+    // Tiles are continuous, cell i is pixel i of the buffer
+    Tile& tile = this->acquire_tile(tile_index);
+    cv::Vec3b* pixels = tile.image.ptr<cv::Vec3b>(0) + cell;
+    for (int i = 0; i < num_cells; ++i) {
+      pixels[i][0] = blue[i];  // Blue channel (normalized frequency)
+      pixels[i][1] = 0;        // Green channel (unused)
+      pixels[i][2] = red[i];   // Red channel (normalized amplitude)
+    }
+
+    if (tile.written_cells.fetch_add(num_cells) + num_cells ==
+        this->tile_cells) {
+      this->complete_tile(tile_index);
+    }
+
+    first_cell += num_cells;
+    count -= num_cells;
+    blue += num_cells;
+    red += num_cells;
+  }
+}
+
+void TiledAudioImage::finish(int64_t num_cells) {
+  std::unique_lock<std::mutex> lock(this->tiles_mutex);
+  this->total_cells = num_cells;
+
+  // The last tile is short, its remaining cells stay black
+  for (Tile& tile : this->tiles) {
+    tile.complete = true;
+  }
+  this->spill_complete_tiles(lock);
+}
+
+std::tuple<int64_t, int> TiledAudioImage::locate(double seconds) const {
+  const int64_t cell = static_cast<int64_t>(
+      std::floor(std::max(0.0, seconds) / this->seconds_per_cell));
+  return {cell / this->tile_cells, static_cast<int>(cell % this->tile_cells)};
+}
+
+std::tuple<int64_t, int64_t> TiledAudioImage::tiles_in_range(
+    double start_sec, double end_sec) const {
+  const int64_t num_tiles = this->num_tiles();
+  if (end_sec <= start_sec) {
+    return {0, 0};
+  }
+
+  const int64_t first_tile = std::get<0>(this->locate(start_sec));
+  const int64_t end_cell = static_cast<int64_t>(
+      std::ceil(std::max(0.0, end_sec) / this->seconds_per_cell));
+  const int64_t end_tile =
+      (end_cell + this->tile_cells - 1) / this->tile_cells;
+  return {std::min(first_tile, num_tiles), std::min(end_tile, num_tiles)};
+}
+
+cv::Mat TiledAudioImage::tile(int64_t tile_index) {
+  std::unique_lock<std::mutex> lock(this->tiles_mutex);
+  if (tile_index < 0 ||
+      tile_index >= static_cast<int64_t>(this->tiles.size())) {
+    return cv::Mat();
+  }
+
+  const Tile& tile = this->tiles[tile_index];
+  if (!tile.spilled) {
+    return tile.image;
+  }
+  lock.unlock();
+
+  cv::Mat image(this->tile_rows, this->tile_cols, CV_8UC3);
+  std::ifstream file(this->spill_filename(tile_index), std::ios::binary);
+  file.read(reinterpret_cast<char*>(image.data),
+            static_cast<std::streamsize>(image.total() * image.elemSize()));
+  if (!file) {
+    LOG_ERROR("CANNOT READ SPILLED AUDIO IMAGE TILE");
+    return cv::Mat();
+  }
+  return image;
+}
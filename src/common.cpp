@@ -1 +1,177 @@
-#include "common.h"
\ No newline at end of file
+#include "common.h"
+
+#include <atomic>
+#include <thread>
+
+/* Bounded multi-producer ring of log lines with a single writer thread.
+ *
+ * Producers claim a slot with a CAS on enqueue_pos and publish it through the
+ * slot's sequence number, so logging from FFT workers never takes a lock or
+ * touches stdout. The writer formats the timestamps and flushes stdout once
+ * per drained batch instead of once per line. */
+class AsyncLogger {
+ private:
+  struct LogRecord {
+    std::atomic<size_t> sequence;
+
+    // All of these point to string literals from the LOG_* macros
+    const char* level;
+    const char* color;
+    const char* file;
+    const char* func;
+    int line;
+
+    std::time_t time;
+    size_t length;
+    char msg[LOG_MESSAGE_MAX_LENGTH];
+  };
+
+  static constexpr size_t CAPACITY = LOG_RING_CAPACITY;
+  static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+                "LOG_RING_CAPACITY must be a power of two");
+
+  LogRecord records[CAPACITY];
+
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) size_t dequeue_pos = 0;  // writer thread only
+
+  std::atomic<uint32_t> published{0};  // wakes the writer
+  std::atomic<size_t> written{0};      // wakes flush()
+  std::atomic<size_t> dropped{0};
+  std::atomic<bool> stopping{false};
+
+  std::thread writer;
+
+  bool write_pending(size_t& reported_drops) {
+    bool wrote = false;
+    while (true) {
+      LogRecord& record = this->records[this->dequeue_pos & (CAPACITY - 1)];
+      if (record.sequence.load(std::memory_order_acquire) !=
+          this->dequeue_pos + 1) {
+        break;
+      }
+
+      std::tm tm_info;
+      localtime_r(&record.time, &tm_info);
+      char timestamp[20];
+      std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S",
+                    &tm_info);
+
+      // Print the log message with context and color
+      std::cout << "[" << timestamp << "] [" << record.color << record.level
+                << RESET << "] "
+                << "[" << record.file << ":" << record.line << "] "
+                << "[" << record.func << "] "
+                << std::string_view(record.msg, record.length) << '\n';
+
+      record.sequence.store(this->dequeue_pos + CAPACITY,
+                            std::memory_order_release);
+      ++this->dequeue_pos;
+      wrote = true;
+    }
+
+    size_t drops = this->dropped.load(std::memory_order_relaxed);
+    if (drops != reported_drops) {
+      std::cout << "[" << YELLOW << "WARNING" << RESET << "] "
+                << drops - reported_drops
+                << " log messages dropped, the log ring was full\n";
+      reported_drops = drops;
+      wrote = true;
+    }
+
+    return wrote;
+  }
+
+  void run_writer() {
+    size_t reported_drops = 0;
+    while (true) {
+      uint32_t seen = this->published.load(std::memory_order_acquire);
+      bool stop = this->stopping.load(std::memory_order_acquire);
+
+      if (this->write_pending(reported_drops)) {
+        std::cout.flush();
+        this->written.store(this->dequeue_pos, std::memory_order_release);
+        this->written.notify_all();
+      }
+
+      if (stop) {
+        break;
+      }
+      this->published.wait(seen, std::memory_order_acquire);
+    }
+  }
+
+ public:
+  AsyncLogger() {
+    for (size_t i = 0; i < CAPACITY; ++i) {
+      this->records[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    this->writer = std::thread(&AsyncLogger::run_writer, this);
+  }
+
+  ~AsyncLogger() {
+    this->stopping.store(true, std::memory_order_release);
+    this->published.fetch_add(1, std::memory_order_release);
+    this->published.notify_one();
+    this->writer.join();
+  }
+
+  void push(const char* level, const char* color, const char* file, int line,
+            const char* func, std::string_view msg) {
+    size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+    LogRecord* record;
+    while (true) {
+      record = &this->records[pos & (CAPACITY - 1)];
+      size_t sequence = record->sequence.load(std::memory_order_acquire);
+      intptr_t difference =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (difference == 0) {
+        if (this->enqueue_pos.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        // Full, the writer cannot keep up: drop rather than stall the caller
+        this->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        pos = this->enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    record->level = level;
+    record->color = color;
+    record->file = file;
+    record->func = func;
+    record->line = line;
+    record->time = std::time(nullptr);
+    record->length = std::min(msg.size(), sizeof(record->msg));
+    std::memcpy(record->msg, msg.data(), record->length);
+    record->sequence.store(pos + 1, std::memory_order_release);
+
+    this->published.fetch_add(1, std::memory_order_release);
+    this->published.notify_one();
+  }
+
+  void flush() {
+    const size_t target = this->enqueue_pos.load(std::memory_order_acquire);
+    size_t current = this->written.load(std::memory_order_acquire);
+    while (current < target) {
+      this->written.wait(current, std::memory_order_acquire);
+      current = this->written.load(std::memory_order_acquire);
+    }
+  }
+};
+
+/* Started on the first log line, drained and joined at exit */
+static AsyncLogger& async_logger() {
+  static AsyncLogger logger;
+  return logger;
+}
+
+void log_message(const char* level, const char* color, const char* file,
+                 int line, const char* func, std::string_view msg) {
+  async_logger().push(level, color, file, line, func, msg);
+}
+
+void flush_log() { async_logger().flush(); }
@@ -1,8 +1,99 @@
+#include <signal.h>
+
 #include "Audio2Image.h"
+#include "BatchConverter.h"
+#include "ConversionServer.h"
 #include "common.h"
 #include "testing.h"
 
-int main() {
+/* Audiovisual batch <output directory> <files, directories or globs>... */
+static int run_batch(int argc, char** argv) {
+  std::vector<std::string> inputs(argv + 3, argv + argc);
+  std::vector<std::string> filenames = expand_batch_inputs(inputs);
+
+  BatchConverter batch_converter;
+  std::vector<BatchResult> results =
+      batch_converter.convert(filenames, argv[2]);
+
+  int failed = 0;
+  for (const BatchResult& result : results) {
+    const bool converted = !result.output_filename.empty();
+    failed += converted ? 0 : 1;
+    std::cout << result.input_filename << " -> "
+              << (converted ? result.output_filename : "(none)")
+              << " status " << static_cast<int>(result.status) << std::endl;
+  }
+  std::cout << results.size() - failed << " of " << results.size()
+            << " files converted" << std::endl;
+
+  return failed > 0 ? 1 : 0;
+}
+
+static ConversionServer* running_server = nullptr;
+
+static void stop_server(int) {
+  if (running_server) {
+    running_server->stop();
+  }
+}
+
+/* Audiovisual serve <socket path> [FFTW wisdom file] */
+static int run_server(int argc, char** argv) {
+  ConversionServer server(argv[2], argc > 3 ? argv[3] : "");
+  if (!server.start()) {
+    return 1;
+  }
+
+  // No SA_RESTART, a blocked read returns so the server sees the stop
+  struct sigaction action = {};
+  action.sa_handler = stop_server;
+  running_server = &server;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  server.run();
+  running_server = nullptr;
+
+  return 0;
+}
+
+/* Audiovisual test, run from a directory next to data/ */
+static int run_tests() {
+  TEST_audio2image();
+  TEST_parallel_matches_serial();
+  TEST_steady_state_allocations();
+  TEST_image_to_audio();
+  TEST_export_image_to_audio_file();
+  TEST_filter_chain();
+  TEST_incremental_update();
+  TEST_data_matrix();
+  TEST_tiled_audio_image();
+  TEST_image_pyramid();
+  TEST_stft_settings();
+  TEST_batch_conversion();
+  TEST_video_soundtrack();
+  TEST_conversion_stats();
+  TEST_conversion_server();
+  TEST_conversion_cache();
+  TEST_channel_images();
+
+  std::cout << (test_failures == 0 ? "All tests passed"
+                                   : std::format("{} checks failed",
+                                                 test_failures))
+            << std::endl;
+  return test_failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 4 && std::string(argv[1]) == "batch") {
+    return run_batch(argc, argv);
+  }
+  if (argc >= 3 && std::string(argv[1]) == "serve") {
+    return run_server(argc, argv);
+  }
+  if (argc == 2 && std::string(argv[1]) == "test") {
+    return run_tests();
+  }
+
   TEST_audio_file_to_image();
 
   return 0;
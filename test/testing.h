@@ -1,15 +1,54 @@
 #pragma once
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "Audio2Image.h"
 #include "Image2Audio.h"
 #include "AudioVisualFilters.h"
+#include "BatchConverter.h"
+#include "ConversionServer.h"
+
+// Failed checks so far, `Audiovisual test` exits non-zero if there are any
+static int test_failures = 0;
+
+#define TEST_CHECK(condition)                                                  \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            std::cout << "FAILED " << __FILE__ << ":" << __LINE__ << ": "      \
+                      << #condition << std::endl;                              \
+            ++test_failures;                                                   \
+        }                                                                      \
+    } while (0)
 
 static void TEST_libraries(); // Pass
 static void TEST_audio_file_regex(); // Pass
 void TEST_audio_file_to_image();
+void TEST_audio2image();
+void TEST_parallel_matches_serial();
+void TEST_steady_state_allocations();
+void TEST_image_to_audio();
+void TEST_export_image_to_audio_file();
+void TEST_filter_chain();
+void TEST_incremental_update();
+void TEST_data_matrix();
+void TEST_tiled_audio_image();
+void TEST_image_pyramid();
+void TEST_stft_settings();
+void TEST_batch_conversion();
+void TEST_video_soundtrack();
+void TEST_conversion_stats();
+void TEST_conversion_server();
+void TEST_conversion_cache();
+void TEST_channel_images();
 
 /* Simple test for FFTW, OpenCV and FFmpeg libraries. */
 void TEST_libraries() {
@@ -75,4 +114,770 @@ void TEST_audio_file_to_image() {
 
     cv::imshow("Audio Image", audio_image);
     cv::waitKey(0);
-}
\ No newline at end of file
+}
+
+/* A file of at least AUDIO_DURATION_SEC converts whole, a clip running past
+ * its end is padded and reported as unfilled */
+void TEST_audio2image() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+
+    auto [conversion_status, audio_image] = audio2image.audio2image(test_filename);
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_AUDIO2IMAGE);
+    TEST_CHECK(audio_image.rows == SQUARE_IMG_SIZE_Y && audio_image.cols == SQUARE_IMG_SIZE_X);
+
+    cv::Mat clipped_image;
+    AUDIO2IMAGE_RET_T clip_status = audio2image.audio_file_to_image(test_filename, clipped_image, 5.0);
+    TEST_CHECK(clip_status == AUDIO2IMAGE_RET_T::UNFILLED_MATRIX);
+}
+
+/* FFT workers must write exactly the image a single thread does, on the mapped
+ * PCM path and on the FFmpeg path */
+void TEST_parallel_matches_serial() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image serial_audio2image(1);
+    Audio2Image parallel_audio2image(4);
+
+    cv::Mat serial_image;
+    cv::Mat parallel_image;
+    serial_audio2image.audio_file_to_image(test_filename, serial_image);
+    parallel_audio2image.audio_file_to_image(test_filename, parallel_image);
+    TEST_CHECK(!serial_image.empty());
+    TEST_CHECK(cv::norm(serial_image, parallel_image, cv::NORM_INF) == 0);
+
+    MediaSession session;
+    TEST_CHECK(session.open(test_filename) == AUDIO2IMAGE_RET_T::GOOD_IMPORT);
+    auto [serial_status, serial_decoded_image] = serial_audio2image.audio_file_to_image(session);
+    TEST_CHECK(session.open(test_filename) == AUDIO2IMAGE_RET_T::GOOD_IMPORT);
+    auto [parallel_status, parallel_decoded_image] = parallel_audio2image.audio_file_to_image(session);
+    TEST_CHECK(!serial_decoded_image.empty());
+    TEST_CHECK(cv::norm(serial_decoded_image, parallel_decoded_image, cv::NORM_INF) == 0);
+}
+
+/* The conversion loop must not allocate once its buffers are warm, on either
+ * path and whatever the number of FFT workers. Needs a build with
+ * -DAUDIOVISUAL_COUNT_ALLOCATIONS=ON to count anything. */
+void TEST_steady_state_allocations() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+
+    if (!ALLOCATION_COUNTER_ENABLED) {
+        std::cout << "Allocation counter disabled, skipping" << std::endl;
+        return;
+    }
+
+    for (int num_fft_workers : {1, 4}) {
+        Audio2Image audio2image(num_fft_workers);
+        cv::Mat audio_image;
+
+        // The first run warms the buffers up, the second must not allocate
+        for (int run = 0; run < 2; ++run) {
+            audio2image.audio_file_to_image(test_filename, audio_image);
+        }
+        TEST_CHECK(audio2image.last_steady_state_allocations() == 0);
+
+        for (int run = 0; run < 2; ++run) {
+            MediaSession session;
+            session.open(test_filename);
+            audio2image.audio_file_to_image(session);
+        }
+        TEST_CHECK(audio2image.last_steady_state_allocations() == 0);
+    }
+}
+
+/* Round trip from audio to image and back to audio, at the same levels */
+void TEST_image_to_audio() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    Image2Audio image2audio;
+    AudioBuffer audio;
+
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(image2audio.image_to_audio(audio_image, audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+
+    // Red 255 is full scale, nothing renders past it
+    float peak = 0.0f;
+    for (float sample : audio.samples) {
+        peak = std::max(peak, std::abs(sample));
+    }
+    TEST_CHECK(peak > 0.0f && peak <= 1.0f);
+
+    // The rendered audio converts back to about the same red levels
+    TEST_CHECK(image2audio.export_image_to_audio_file(audio_image, "test_round_trip.wav") ==
+               IMAGE2AUDIO_RET_T::GOOD_EXPORT);
+    auto [round_trip_status, round_trip_image] = audio2image.audio_file_to_image("test_round_trip.wav");
+    TEST_CHECK(round_trip_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    double sum_red = 0.0;
+    double sum_round_trip_red = 0.0;
+    int lit_cells = 0;
+    for (int y = 0; y < audio_image.rows; ++y) {
+        for (int x = 0; x < audio_image.cols; ++x) {
+            const cv::Vec3b& pixel = audio_image.at<cv::Vec3b>(y, x);
+            const cv::Vec3b& round_trip_pixel = round_trip_image.at<cv::Vec3b>(y, x);
+            if (pixel[0] != 0 && round_trip_pixel[0] != 0) {
+                sum_red += pixel[2];
+                sum_round_trip_red += round_trip_pixel[2];
+                ++lit_cells;
+            }
+        }
+    }
+    TEST_CHECK(lit_cells > 0);
+    std::cout << "Mean red " << sum_red / lit_cells << ", after the round trip "
+              << sum_round_trip_red / lit_cells << std::endl;
+    TEST_CHECK(std::abs(sum_red - sum_round_trip_red) / lit_cells < RED_LEVELS_PER_OCTAVE);
+}
+
+/* Frames in an audio file, decoded to the end with FFmpeg, -1 if it cannot be
+ * decoded */
+static int64_t decoded_num_frames(const std::string& filename) {
+    MediaSession session;
+    if (session.open(filename) != AUDIO2IMAGE_RET_T::GOOD_IMPORT) {
+        return -1;
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    int64_t num_frames = 0;
+    bool draining = false;
+    bool failed = false;
+    while (!draining && !failed) {
+        if (av_read_frame(session.format_context(), packet) < 0) {
+            draining = true;
+            failed = avcodec_send_packet(session.codec_context(), nullptr) < 0;
+        } else if (packet->stream_index == session.stream_index()) {
+            failed = avcodec_send_packet(session.codec_context(), packet) < 0;
+        }
+        av_packet_unref(packet);
+
+        int ret = 0;
+        while (!failed && (ret = avcodec_receive_frame(session.codec_context(), frame)) >= 0) {
+            num_frames += frame->nb_samples;
+        }
+        failed = failed || (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF);
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    return failed ? -1 : num_frames;
+}
+
+/* Round trip from audio to image and back to a FLAC file, which decodes to
+ * as many samples as the render */
+void TEST_export_image_to_audio_file() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    Image2Audio image2audio;
+    AudioBuffer audio;
+
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    TEST_CHECK(image2audio.export_image_to_audio_file(audio_image, "test_export.flac") == IMAGE2AUDIO_RET_T::GOOD_EXPORT);
+    TEST_CHECK(image2audio.image_to_audio(audio_image, audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+
+    const int64_t exported_frames = decoded_num_frames("test_export.flac");
+    std::cout << "Exported " << exported_frames << " samples to test_export.flac" << std::endl;
+    TEST_CHECK(exported_frames == static_cast<int64_t>(audio.samples.size()));
+}
+
+/* RMS of a render */
+static double rms_level(const AudioBuffer& audio) {
+    double sum_squares = 0.0;
+    for (float sample : audio.samples) {
+        sum_squares += static_cast<double>(sample) * sample;
+    }
+    return audio.samples.empty() ? 0.0 : std::sqrt(sum_squares / audio.samples.size());
+}
+
+/* Index of the last cell that is not black, -1 if there is none */
+static int last_lit_cell(const cv::Mat& image) {
+    for (int cell = image.rows * image.cols - 1; cell >= 0; --cell) {
+        if (image.at<cv::Vec3b>(cell / image.cols, cell % image.cols) != cv::Vec3b(0, 0, 0)) {
+            return cell;
+        }
+    }
+    return -1;
+}
+
+/* 16-bit PCM WAV of interleaved samples */
+static void write_test_wav(const std::string& filename, int sample_rate, int16_t channels,
+                           const std::vector<int16_t>& samples) {
+    auto put = [](std::ofstream& file, auto value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    const uint32_t data_bytes = static_cast<uint32_t>(samples.size() * sizeof(int16_t));
+    std::ofstream file(filename, std::ios::binary);
+    file.write("RIFF", 4);
+    put(file, uint32_t{36} + data_bytes);
+    file.write("WAVEfmt ", 8);
+    put(file, uint32_t{16});
+    put(file, int16_t{1});  // PCM
+    put(file, channels);
+    put(file, static_cast<uint32_t>(sample_rate));
+    put(file, static_cast<uint32_t>(sample_rate * channels * sizeof(int16_t)));
+    put(file, static_cast<int16_t>(channels * sizeof(int16_t)));
+    put(file, int16_t{16});
+    file.write("data", 4);
+    put(file, data_bytes);
+    file.write(reinterpret_cast<const char*>(samples.data()), data_bytes);
+}
+
+/* Stacked filters applied in one pass, then rendered back to audio, and an
+ * attenuation that halves the rendered level */
+void TEST_filter_chain() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    Image2Audio image2audio;
+    FilterChain filters;
+    AudioBuffer audio;
+    AudioBuffer filtered_audio;
+
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(image2audio.image_to_audio(audio_image, audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+    const double level = rms_level(audio);
+    TEST_CHECK(level > 0.0);
+
+    cv::Mat chain_image = audio_image.clone();
+    TEST_CHECK(filters.add(low_pass_filter(8000.0, 0.0, 5.0)) == FILTERS_RET_T::GOOD_FILTERING);
+    TEST_CHECK(filters.add(high_pass_filter(200.0, 2.0, 8.0, FILTER_EDGE_T::GRADIENT, 0.5)) ==
+               FILTERS_RET_T::GOOD_FILTERING);
+    TEST_CHECK(filters.add(scale_amplitude_filter(0.8)) == FILTERS_RET_T::GOOD_FILTERING);
+    TEST_CHECK(filters.apply(chain_image) == FILTERS_RET_T::GOOD_FILTERING);
+    TEST_CHECK(image2audio.image_to_audio(chain_image, filtered_audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+    TEST_CHECK(rms_level(filtered_audio) < 0.85 * level);
+
+    // Half the amplitude is one octave of red below, wherever red has room
+    cv::Mat halved_image = audio_image.clone();
+    TEST_CHECK(scale_amplitude(0.5, halved_image) == FILTERS_RET_T::GOOD_FILTERING);
+    TEST_CHECK(image2audio.image_to_audio(halved_image, filtered_audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+    const double halved_ratio = rms_level(filtered_audio) / level;
+    std::cout << "Scaled by 0.5, the rendered level is " << halved_ratio << " of the original" << std::endl;
+    TEST_CHECK(halved_ratio > 0.45 && halved_ratio < 0.55);
+}
+
+/* A filtered range re-rendered and patched into the exported WAV: samples
+ * outside the dirty cells stay as they were, and the patched file is the
+ * export of the filtered image, up to 16-bit rounding */
+void TEST_incremental_update() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    Image2Audio image2audio;
+    FilterChain filters;
+    DirtyRegions dirty;
+    AudioBuffer audio;
+
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(image2audio.image_to_audio(audio_image, audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+    TEST_CHECK(image2audio.export_image_to_audio_file(audio_image, "test_update.wav") == IMAGE2AUDIO_RET_T::GOOD_EXPORT);
+    const std::vector<float> original_samples = audio.samples;
+
+    TEST_CHECK(filters.add(scale_amplitude_filter(0.5, 1.0, 2.0)) == FILTERS_RET_T::GOOD_FILTERING);
+    TEST_CHECK(filters.apply(audio_image, dirty) == FILTERS_RET_T::GOOD_FILTERING);
+    TEST_CHECK(!dirty.empty());
+    TEST_CHECK(image2audio.update_audio(audio_image, dirty, audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+    TEST_CHECK(audio.samples.size() == original_samples.size());
+
+    const size_t samples_per_cell = audio.samples.size() / (SQUARE_IMG_SIZE_X * SQUARE_IMG_SIZE_Y);
+    std::vector<bool> dirty_samples(audio.samples.size(), false);
+    for (const CellRange& cells : dirty.ranges()) {
+        const size_t end_sample = std::min(cells.end_cell * samples_per_cell, dirty_samples.size());
+        std::fill(dirty_samples.begin() + cells.first_cell * samples_per_cell, dirty_samples.begin() + end_sample, true);
+    }
+    size_t changed_clean_samples = 0;
+    size_t changed_dirty_samples = 0;
+    for (size_t i = 0; i < audio.samples.size() && i < original_samples.size(); ++i) {
+        if (audio.samples[i] != original_samples[i]) {
+            ++(dirty_samples[i] ? changed_dirty_samples : changed_clean_samples);
+        }
+    }
+    TEST_CHECK(changed_clean_samples == 0);
+    TEST_CHECK(changed_dirty_samples > 0);
+
+    TEST_CHECK(image2audio.patch_exported_file("test_update.wav", audio, dirty) == IMAGE2AUDIO_RET_T::GOOD_EXPORT);
+    std::cout << "Patched " << dirty.num_cells() << " cells of test_update.wav" << std::endl;
+    dirty.clear();
+
+    Image2Audio full_image2audio;
+    TEST_CHECK(full_image2audio.export_image_to_audio_file(audio_image, "test_update_full.wav") == IMAGE2AUDIO_RET_T::GOOD_EXPORT);
+    MappedPCMFile patched_file;
+    MappedPCMFile full_file;
+    TEST_CHECK(patched_file.open("test_update.wav") && full_file.open("test_update_full.wav"));
+    TEST_CHECK(patched_file.view().num_frames == full_file.view().num_frames);
+    if (patched_file.view().num_frames == full_file.view().num_frames) {
+        const int num_frames = static_cast<int>(full_file.view().num_frames);
+        std::vector<float> patched_samples(num_frames);
+        std::vector<float> full_samples(num_frames);
+        patched_file.read_mono(0, num_frames, patched_samples.data());
+        full_file.read_mono(0, num_frames, full_samples.data());
+        float max_difference = 0.0f;
+        for (int i = 0; i < num_frames; ++i) {
+            max_difference = std::max(max_difference, std::abs(patched_samples[i] - full_samples[i]));
+        }
+        // One 16-bit step either way
+        TEST_CHECK(max_difference <= 1.0f / 32768.0f + 1e-7f);
+    }
+}
+
+/* High-fidelity round trip through a half precision data matrix file, one
+ * segment per converted cell and N samples per segment */
+void TEST_data_matrix() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    Image2Audio image2audio;
+    SpectralMatrixWriter writer;
+    SpectralMatrix data_matrix;
+    AudioBuffer audio;
+    using Config = Audio2ImageConfig<CD_AUDIO_FILE_FREQUENCY_HZ>;
+
+    TEST_CHECK(writer.open("test_data_matrix.avd", CD_AUDIO_FILE_FREQUENCY_HZ, Config::NUM_SAMPLES_PER_SEGMENT,
+                           SPECTRUM_ENCODING_T::FLOAT_16));
+    audio2image.set_data_matrix(&writer);
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    audio2image.set_data_matrix(nullptr);
+    TEST_CHECK(writer.finish());
+    TEST_CHECK(data_matrix.open("test_data_matrix.avd"));
+
+    // Frames are converted whole, so the last one may end in silent cells
+    const int converted_cells = last_lit_cell(audio_image) + 1;
+    const int converted_frames = (converted_cells + Config::SEGMENTS_PER_FRAME - 1) / Config::SEGMENTS_PER_FRAME;
+    TEST_CHECK(converted_cells > 0);
+    TEST_CHECK(data_matrix.num_segments() == static_cast<int64_t>(converted_frames) * Config::SEGMENTS_PER_FRAME);
+
+    TEST_CHECK(image2audio.data_matrix_to_audio(data_matrix, audio) == IMAGE2AUDIO_RET_T::GOOD_IMAGE2AUDIO);
+    TEST_CHECK(audio.samples.size() ==
+               static_cast<size_t>(data_matrix.num_segments()) * Config::NUM_SAMPLES_PER_SEGMENT);
+    std::cout << "Rendered " << data_matrix.num_segments() << " segments from the data matrix" << std::endl;
+}
+
+/* Whole-file conversion into tiles, spilling all but two of them. With a hop
+ * of one sample, 15 seconds of noise run over three tiles, and the first one
+ * is read back from disk the same as the image of a plain conversion */
+void TEST_tiled_audio_image() {
+    const std::string test_filename = "test_tiles.wav";
+    std::vector<int16_t> samples(15 * CD_AUDIO_FILE_FREQUENCY_HZ);
+    uint32_t state = 1;
+    for (int16_t& sample : samples) {
+        state = state * 1664525u + 1013904223u;
+        sample = static_cast<int16_t>(state >> 20) - 2048;
+    }
+    write_test_wav(test_filename, CD_AUDIO_FILE_FREQUENCY_HZ, 1, samples);
+
+    Audio2Image audio2image;
+    TEST_CHECK(audio2image.set_stft(STFT_WINDOW_T::RECTANGULAR, 1));
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+
+    std::string spill_directory = (std::filesystem::temp_directory_path() / "audiovisual-tiles-XXXXXX").string();
+    TEST_CHECK(mkdtemp(spill_directory.data()) != nullptr);
+    {
+        TiledAudioImage tiles(spill_directory, 2);
+        TEST_CHECK(audio2image.audio_file_to_tiles(test_filename, tiles) == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+
+        // Cells run to the end of the last frame, one frame is 64 samples
+        const double frame_sec = 64.0 / CD_AUDIO_FILE_FREQUENCY_HZ;
+        TEST_CHECK(tiles.duration_sec() >= 15.0 && tiles.duration_sec() < 15.0 + frame_sec);
+        TEST_CHECK(tiles.cells_per_tile() == SQUARE_IMG_SIZE_X * SQUARE_IMG_SIZE_Y);
+        TEST_CHECK(tiles.num_tiles() == 3);
+
+        TEST_CHECK(std::filesystem::exists(spill_directory + "/tile_0.bgr"));
+        cv::Mat first_tile = tiles.tile(0);
+        const bool same_size = first_tile.rows == audio_image.rows && first_tile.cols == audio_image.cols;
+        TEST_CHECK(same_size);
+        if (same_size) {
+            TEST_CHECK(cv::norm(first_tile, audio_image, cv::NORM_INF) == 0);
+        }
+
+        for (double seconds : {5.0, 10.0}) {
+            auto [tile_index, cell] = tiles.locate(seconds);
+            const int64_t expected_cell = static_cast<int64_t>(seconds * CD_AUDIO_FILE_FREQUENCY_HZ);
+            TEST_CHECK(tile_index * tiles.cells_per_tile() + cell == expected_cell);
+            TEST_CHECK(cell >= 0 && cell < tiles.cells_per_tile());
+            std::cout << seconds << " seconds is cell " << cell << " of tile " << tile_index << std::endl;
+        }
+
+        TEST_CHECK(tiles.tiles_in_range(7.0, 12.0) == std::make_tuple(int64_t{1}, int64_t{2}));
+        TEST_CHECK(tiles.tiles_in_range(0.0, 100.0) == std::make_tuple(int64_t{0}, tiles.num_tiles()));
+        TEST_CHECK(tiles.tiles_in_range(12.0, 7.0) == std::make_tuple(int64_t{0}, int64_t{0}));
+    }
+    std::filesystem::remove_all(spill_directory);
+}
+
+/* Overview of a conversion, at most 100 cells wide. Level l holds
+ * ceil(n / 2^l) of the n cells, and merging weights frequency by amplitude */
+void TEST_image_pyramid() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    AudioImagePyramid pyramid;
+
+    audio2image.set_pyramid(&pyramid);
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    auto [level, pixels] = pyramid.query(0.0, 10.0, 100);
+    std::cout << "Pyramid of " << pyramid.num_levels() << " levels, 10 seconds at level " << level
+              << " are " << pixels.size() << " cells" << std::endl;
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    TEST_CHECK(pyramid.num_levels() > 1 && pyramid.num_cells(pyramid.num_levels()) == 1);
+    for (int l = 2; l <= pyramid.num_levels(); ++l) {
+        TEST_CHECK(pyramid.num_cells(l) == (pyramid.num_cells(l - 1) + 1) / 2);
+    }
+    TEST_CHECK(!pixels.empty() && pixels.size() <= 100);
+
+    // 11 cells in blocks of 4, the last one short
+    std::vector<PyramidCell> scratch;
+    std::vector<double> frequency(4, 1.0);
+    std::vector<double> amplitude(4, 0.5);
+    pyramid.reset(1.0, 4, 100.0);
+    pyramid.add_block(8, 3, frequency.data(), amplitude.data(), scratch);
+    pyramid.add_block(0, 4, frequency.data(), amplitude.data(), scratch);
+    pyramid.add_block(4, 4, frequency.data(), amplitude.data(), scratch);
+    pyramid.finish(11);
+    TEST_CHECK(pyramid.num_levels() == 4);
+    for (int l = 1; l <= pyramid.num_levels(); ++l) {
+        TEST_CHECK(pyramid.num_cells(l) == (11 + (1 << l) - 1) >> l);
+    }
+
+    // Bins 1 and 3 of 10 kHz at amplitudes 0.75 and 0.25 merge to 15 kHz,
+    // not the 20 kHz plain mean, at amplitude 0.5
+    double two_cell_frequency[] = {1.0, 3.0};
+    double two_cell_amplitude[] = {0.75, 0.25};
+    pyramid.reset(1.0, 2, 10000.0);
+    pyramid.add_block(0, 2, two_cell_frequency, two_cell_amplitude, scratch);
+    pyramid.finish(2);
+    auto [merged_level, merged_pixels] = pyramid.query(0.0, 2.0, 1);
+    TEST_CHECK(merged_level == 1 && merged_pixels.size() == 1);
+    if (merged_pixels.size() == 1) {
+        TEST_CHECK(merged_pixels[0][0] == static_cast<int>(15000.0f * MAX_PIXEL_VALUE / MAX_FREQUENCY_IN_AUDIO_SIGNAL_HZ));
+        TEST_CHECK(merged_pixels[0][2] == static_cast<int>((RED_AMPLITUDE_OCTAVES - 1.0f) * RED_LEVELS_PER_OCTAVE));
+    }
+}
+
+/* Mean red of the cells that are not black */
+static double mean_lit_red(const cv::Mat& image) {
+    double sum_red = 0.0;
+    int lit_cells = 0;
+    for (int y = 0; y < image.rows; ++y) {
+        for (int x = 0; x < image.cols; ++x) {
+            const cv::Vec3b& pixel = image.at<cv::Vec3b>(y, x);
+            if (pixel != cv::Vec3b(0, 0, 0)) {
+                sum_red += pixel[2];
+                ++lit_cells;
+            }
+        }
+    }
+    return lit_cells > 0 ? sum_red / lit_cells : 0.0;
+}
+
+/* Overlapping Hann windows, a cell every half segment. Windows keep the level
+ * of a full scale tone, and a hop of 1 fills the image without running past
+ * it */
+void TEST_stft_settings() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+
+    TEST_CHECK(audio2image.set_stft(STFT_WINDOW_T::HANN, 8));
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    // One cell per hop of the 10 second clip, the file is 48 kHz
+    const int clip_samples = 10 * 48000;
+    TEST_CHECK(last_lit_cell(audio_image) + 1 == (clip_samples + 7) / 8);
+
+    TEST_CHECK(audio2image.set_stft(STFT_WINDOW_T::HANN, 1));
+    auto [hop_1_status, hop_1_image] = audio2image.audio_file_to_image(test_filename);
+    TEST_CHECK(hop_1_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    TEST_CHECK(last_lit_cell(hop_1_image) + 1 == SQUARE_IMG_SIZE_X * SQUARE_IMG_SIZE_Y);
+
+    // A tone two octaves below full scale at every cell, analyzed with each
+    // window
+    Image2Audio image2audio;
+    cv::Mat tone_image(SQUARE_IMG_SIZE_Y, SQUARE_IMG_SIZE_X, CV_8UC3,
+                       cv::Scalar(28, 0, MAX_PIXEL_VALUE - 2 * RED_LEVELS_PER_OCTAVE));
+    TEST_CHECK(image2audio.export_image_to_audio_file(tone_image, "test_tone.wav") == IMAGE2AUDIO_RET_T::GOOD_EXPORT);
+    TEST_CHECK(audio2image.set_stft(STFT_WINDOW_T::RECTANGULAR, 16));
+    auto [rectangular_status, rectangular_image] = audio2image.audio_file_to_image("test_tone.wav");
+    const double rectangular_red = mean_lit_red(rectangular_image);
+    for (STFT_WINDOW_T window : {STFT_WINDOW_T::HANN, STFT_WINDOW_T::BLACKMAN}) {
+        TEST_CHECK(audio2image.set_stft(window, 16));
+        auto [window_status, window_image] = audio2image.audio_file_to_image("test_tone.wav");
+        std::cout << "Tone red level " << mean_lit_red(window_image) << " windowed, " << rectangular_red
+                  << " rectangular" << std::endl;
+        TEST_CHECK(std::abs(mean_lit_red(window_image) - rectangular_red) < RED_LEVELS_PER_OCTAVE / 2);
+    }
+}
+
+/* Every audio file of the data directory, and inputs whose stems collide,
+ * one image each */
+void TEST_batch_conversion() {
+    std::vector<std::string> filenames = expand_batch_inputs({"../data"});
+    TEST_CHECK(!filenames.empty());
+
+    // Two inputs share a stem, and the first suffix they would get is the
+    // stem of a third
+    std::string stem = "test_audio-street_noise-10sec";
+    std::filesystem::copy_file("../data/" + stem + ".wav", stem + "_1.wav",
+                               std::filesystem::copy_options::overwrite_existing);
+    BatchConverter batch_converter(2);
+    std::vector<BatchResult> results = batch_converter.convert(
+        {"../data/" + stem + ".wav", "../data/../data/" + stem + ".wav", stem + "_1.wav"}, ".");
+    std::set<std::string> output_filenames;
+    for (const BatchResult& result : results) {
+        std::cout << result.input_filename << " -> " << result.output_filename
+                  << " status " << static_cast<int>(result.status) << std::endl;
+        TEST_CHECK(result.status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+        output_filenames.insert(result.output_filename);
+    }
+    TEST_CHECK(results.size() == 3 && output_filenames.size() == 3);
+    TEST_CHECK(results.size() == 3 && results[2].output_filename == "./" + stem + "_1.png");
+}
+
+/* The audio stream of a video, the video stream is never demuxed. A clip
+ * shorter than AUDIO_DURATION_SEC is refused by audio2image and comes out
+ * padded from audio_file_to_image; either way the soundtrack is not silence */
+void TEST_video_soundtrack() {
+    std::string test_filename = "../data/test_video-cat.mp4";
+    Audio2Image audio2image;
+
+    MediaSession session;
+    TEST_CHECK(session.open(test_filename) == AUDIO2IMAGE_RET_T::GOOD_IMPORT);
+    if (!session.is_open()) {
+        return;
+    }
+    const double duration = session.duration();
+    session.close();
+
+    auto [conversion_status, audio_image] = audio2image.audio2image(test_filename);
+    std::cout << "Video soundtrack of " << duration << " seconds, conversion status "
+              << static_cast<int>(conversion_status) << std::endl;
+    if (duration >= 10.0) {
+        TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_AUDIO2IMAGE);
+    } else {
+        TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::AUDIO_FILE_DURATION_TOO_SHORT);
+        AUDIO2IMAGE_RET_T padded_status = audio2image.audio_file_to_image(test_filename, audio_image);
+        TEST_CHECK(padded_status == AUDIO2IMAGE_RET_T::UNFILLED_MATRIX);
+    }
+    TEST_CHECK(audio_image.rows == SQUARE_IMG_SIZE_Y && audio_image.cols == SQUARE_IMG_SIZE_X);
+    TEST_CHECK(last_lit_cell(audio_image) >= 0);
+}
+
+/* Where the time of a conversion went, stage by stage, on the FFmpeg path
+ * that demuxes, decodes and resamples */
+void TEST_conversion_stats() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    ConversionStats stats;
+    MediaSession session;
+
+    if (!CONVERSION_STATS_ENABLED) {
+        std::cout << "Conversion stats disabled, skipping" << std::endl;
+        return;
+    }
+
+    audio2image.set_stats(&stats);
+    TEST_CHECK(session.open(test_filename) == AUDIO2IMAGE_RET_T::GOOD_IMPORT);
+    auto [conversion_status, audio_image] = audio2image.audio_file_to_image(session);
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    auto milliseconds = [](ConversionStats::Duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    std::cout << "demux " << milliseconds(stats.demux) << " ms, decode " << milliseconds(stats.decode)
+              << " ms, resample " << milliseconds(stats.resample) << " ms, fft " << milliseconds(stats.fft)
+              << " ms, normalize " << milliseconds(stats.normalize) << " ms, pixel write "
+              << milliseconds(stats.pixel_write) << " ms" << std::endl;
+    std::cout << stats.packets << " packets, " << stats.frames << " frames, " << stats.samples << " samples, "
+              << stats.dropped_samples << " dropped" << std::endl;
+    TEST_CHECK(stats.packets > 0 && stats.frames > 0 && stats.samples > 0);
+    TEST_CHECK(stats.dropped_samples <= stats.samples);
+}
+
+/* Two requests to a server on a local socket, then shut it down, checking
+ * every reply */
+void TEST_conversion_server() {
+    char socket_directory[] = "/tmp/audiovisual-test-XXXXXX";
+    TEST_CHECK(mkdtemp(socket_directory) != nullptr);
+    std::string socket_path = std::string(socket_directory) + "/server.sock";
+    ConversionServer server(socket_path);
+    if (!server.start()) {
+        std::cout << "Server did not start!" << std::endl;
+        ++test_failures;
+        rmdir(socket_directory);
+        return;
+    }
+    std::thread server_thread([&server] { server.run(); });
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::copy(socket_path.begin(), socket_path.end(), address.sun_path);
+    int client_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    std::string replies;
+    if (connect(client_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        std::string requests = "image ../data/test_audio-street_noise-10sec.wav test_audio-server.png\n"
+                               "filter test_audio-server.png test_audio-server-low_pass.png low_pass:4000\n"
+                               "shutdown\n";
+        size_t sent = 0;
+        while (sent < requests.size()) {
+            ssize_t num_bytes = write(client_fd, requests.data() + sent, requests.size() - sent);
+            if (num_bytes <= 0) {
+                break;
+            }
+            sent += num_bytes;
+        }
+        TEST_CHECK(sent == requests.size());
+
+        char buffer[256];
+        ssize_t num_bytes;
+        while ((num_bytes = read(client_fd, buffer, sizeof(buffer))) > 0) {
+            replies.append(buffer, num_bytes);
+        }
+    } else {
+        server.stop();
+    }
+    close(client_fd);
+    server_thread.join();
+    std::filesystem::remove_all(socket_directory);
+
+    std::cout << replies;
+    std::vector<std::string> reply_lines;
+    std::istringstream reply_stream(replies);
+    for (std::string line; std::getline(reply_stream, line);) {
+        reply_lines.push_back(line);
+    }
+    TEST_CHECK(reply_lines.size() == 3);
+    if (reply_lines.size() == 3) {
+        TEST_CHECK(reply_lines[0] == std::format("OK {}", static_cast<int>(AUDIO2IMAGE_RET_T::GOOD_CONVERSION)));
+        TEST_CHECK(reply_lines[1] == std::format("OK {}", static_cast<int>(FILTERS_RET_T::GOOD_FILTERING)));
+        TEST_CHECK(reply_lines[2] == "OK");
+    }
+}
+
+/* The second conversion of the same file is read back from the cache, with
+ * nothing decoded, through audio2image and audio_file_to_image alike */
+void TEST_conversion_cache() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    std::filesystem::remove_all("audiovisual-cache");
+    ConversionCache cache("audiovisual-cache", 64 << 20);
+    Audio2Image audio2image;
+    ConversionStats stats;
+
+    audio2image.set_cache(&cache);
+    audio2image.set_stats(&stats);
+    auto [first_status, first_image] = audio2image.audio2image(test_filename);
+    TEST_CHECK(first_status == AUDIO2IMAGE_RET_T::GOOD_AUDIO2IMAGE);
+    int num_entries = 0;
+    for (const auto& entry : std::filesystem::directory_iterator("audiovisual-cache")) {
+        num_entries += entry.path().extension() == ".image";
+    }
+    TEST_CHECK(num_entries == 1);
+
+    if (CONVERSION_STATS_ENABLED) {
+        TEST_CHECK(stats.samples > 0);
+    }
+    auto [cached_status, cached_image] = audio2image.audio2image(test_filename);
+    TEST_CHECK(cached_status == AUDIO2IMAGE_RET_T::GOOD_AUDIO2IMAGE);
+    TEST_CHECK(stats.samples == 0);
+    TEST_CHECK(cv::norm(first_image, cached_image, cv::NORM_INF) == 0);
+
+    stats.samples = 1;
+    cv::Mat file_image;
+    TEST_CHECK(audio2image.audio_file_to_image(test_filename, file_image) == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    TEST_CHECK(stats.samples == 0);
+    TEST_CHECK(cv::norm(first_image, file_image, cv::NORM_INF) == 0);
+
+    // Entries are checked before they are trusted: a wrong pixel type or an
+    // unknown status in the header misses
+    const uint64_t key = 1;
+    const std::string entry_filename = std::format("audiovisual-cache/{:016x}.image", key);
+    cv::Mat entry_image;
+    TEST_CHECK(cache.store(key, first_image, AUDIO2IMAGE_RET_T::GOOD_CONVERSION, nullptr));
+    TEST_CHECK(cache.load(key, entry_image, nullptr) == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    TEST_CHECK(!cache.store(key + 1, first_image, AUDIO2IMAGE_RET_T::ERROR_WRITING_IMAGE, nullptr));
+    auto patch_entry = [](const std::string& filename, long offset, auto value) {
+        std::fstream entry(filename, std::ios::in | std::ios::out | std::ios::binary);
+        entry.seekp(offset);
+        entry.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    const long status_offset = 12;  // after the magic and the version
+    const long type_offset = 24;    // after the status, rows and cols
+    patch_entry(entry_filename, type_offset, int32_t{CV_8SC3});
+    TEST_CHECK(!cache.load(key, entry_image, nullptr));
+    patch_entry(entry_filename, type_offset, int32_t{CV_8UC3});
+    patch_entry(entry_filename, status_offset, int32_t{1000});
+    TEST_CHECK(!cache.load(key, entry_image, nullptr));
+    patch_entry(entry_filename, status_offset, static_cast<int32_t>(AUDIO2IMAGE_RET_T::UNFILLED_MATRIX));
+    TEST_CHECK(cache.load(key, entry_image, nullptr) == AUDIO2IMAGE_RET_T::UNFILLED_MATRIX);
+
+    // So is the data matrix of an entry: its offsets and counts have to match
+    // the layout of the writer it is copied into, and its data the file
+    using Config = Audio2ImageConfig<CD_AUDIO_FILE_FREQUENCY_HZ>;
+    const uint64_t matrix_key = 3;
+    const std::string matrix_filename = std::format("audiovisual-cache/{:016x}.matrix", matrix_key);
+    const int num_segments = 100;
+    const int num_bins = Config::NUM_SAMPLES_PER_SEGMENT / 2 + 1;
+    std::vector<double> real(num_bins * num_segments, 0.25);
+    std::vector<double> imag(num_bins * num_segments, -0.5);
+    std::vector<uint8_t> encoded;
+    SpectralMatrixWriter writer;
+    TEST_CHECK(writer.open("test_cache_source.avd", CD_AUDIO_FILE_FREQUENCY_HZ, Config::NUM_SAMPLES_PER_SEGMENT));
+    writer.write_segments(0, num_segments, real.data(), imag.data(), num_segments, encoded);
+    TEST_CHECK(cache.store(matrix_key, first_image, AUDIO2IMAGE_RET_T::GOOD_CONVERSION, &writer));
+    writer.close();
+
+    SpectralMatrixHeader header{};
+    std::ifstream(matrix_filename, std::ios::binary).read(reinterpret_cast<char*>(&header), sizeof(header));
+    SpectralMatrixWriter copy;
+    TEST_CHECK(copy.open("test_cache_copy.avd", CD_AUDIO_FILE_FREQUENCY_HZ, Config::NUM_SAMPLES_PER_SEGMENT));
+    auto load_matrix = [&]() { return cache.load(matrix_key, entry_image, &copy); };
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, data_offset), header.data_offset + 4096);
+    TEST_CHECK(!load_matrix());
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, data_offset), header.data_offset);
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, index_offset), header.data_offset - 1);
+    TEST_CHECK(!load_matrix());
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, index_offset), uint64_t{1} << 40);
+    TEST_CHECK(!load_matrix());
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, index_offset), header.index_offset);
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, num_segments), header.num_segments + header.segments_per_chunk);
+    TEST_CHECK(!load_matrix());
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, num_segments), header.num_segments - 1);
+    TEST_CHECK(!load_matrix());
+    patch_entry(matrix_filename, offsetof(SpectralMatrixHeader, num_segments), header.num_segments);
+    TEST_CHECK(load_matrix() == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    std::filesystem::resize_file(matrix_filename, header.data_offset + 10);
+    TEST_CHECK(!load_matrix());
+
+    SpectralMatrix copied_matrix;
+    TEST_CHECK(copy.finish() && copied_matrix.open("test_cache_copy.avd"));
+    TEST_CHECK(copied_matrix.num_segments() == num_segments);
+    std::vector<float> spectrum(2 * num_bins);
+    copied_matrix.read_segments(num_segments - 1, 1, spectrum.data());
+    TEST_CHECK(spectrum[0] == 0.25f && spectrum[1] == -0.5f);
+}
+
+/* One image per channel of a stereo file, then both stacked; a stereo file
+ * holding the same signal twice gives the same image twice */
+void TEST_channel_images() {
+    std::string test_filename = "../data/test_audio-street_noise-10sec.wav";
+    Audio2Image audio2image;
+    std::vector<cv::Mat> channel_images;
+
+    AUDIO2IMAGE_RET_T conversion_status = audio2image.audio_file_to_channel_images(test_filename, channel_images);
+    TEST_CHECK(conversion_status == AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    TEST_CHECK(channel_images.size() == 2);
+    for (const cv::Mat& channel_image : channel_images) {
+        TEST_CHECK(channel_image.rows == SQUARE_IMG_SIZE_Y && channel_image.cols == SQUARE_IMG_SIZE_X &&
+                   channel_image.type() == CV_8UC3);
+    }
+    cv::Mat stacked_image = stack_channel_images(channel_images);
+    TEST_CHECK(stacked_image.rows == 2 * SQUARE_IMG_SIZE_Y && stacked_image.cols == SQUARE_IMG_SIZE_X);
+
+    // 10 seconds of pseudo-random noise, the same in both channels
+    std::vector<int16_t> samples(2 * 10 * CD_AUDIO_FILE_FREQUENCY_HZ);
+    uint32_t state = 1;
+    for (size_t i = 0; i < samples.size(); i += 2) {
+        state = state * 1664525u + 1013904223u;
+        samples[i] = samples[i + 1] = static_cast<int16_t>(state >> 20) - 2048;
+    }
+    write_test_wav("test_dual_mono.wav", CD_AUDIO_FILE_FREQUENCY_HZ, 2, samples);
+    TEST_CHECK(audio2image.audio_file_to_channel_images("test_dual_mono.wav", channel_images) ==
+               AUDIO2IMAGE_RET_T::GOOD_CONVERSION);
+    TEST_CHECK(channel_images.size() == 2);
+    if (channel_images.size() == 2) {
+        TEST_CHECK(last_lit_cell(channel_images[0]) >= 0);
+        TEST_CHECK(cv::norm(channel_images[0], channel_images[1], cv::NORM_INF) == 0);
+    }
+}